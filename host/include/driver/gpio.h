@@ -0,0 +1,5 @@
+#pragma once
+
+// Host build: only the pin type.
+
+typedef int gpio_num_t;
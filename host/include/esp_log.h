@@ -0,0 +1,29 @@
+#pragma once
+
+// Host build: ESP_LOGx print to stderr when at or below sim_log_level.
+
+#include <stdio.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+extern esp_log_level_t sim_log_level;
+
+#define SIM_LOG(level, letter, tag, fmt, ...) \
+    do { \
+        if (sim_log_level >= (level)) { \
+            fprintf(stderr, letter " (%s) " fmt "\n", tag, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define ESP_LOGE(tag, fmt, ...) SIM_LOG(ESP_LOG_ERROR, "E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) SIM_LOG(ESP_LOG_WARN, "W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) SIM_LOG(ESP_LOG_INFO, "I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) SIM_LOG(ESP_LOG_DEBUG, "D", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) SIM_LOG(ESP_LOG_VERBOSE, "V", tag, fmt, ##__VA_ARGS__)
@@ -0,0 +1,7 @@
+#pragma once
+
+// Host build: esp_timer_get_time() reads the simulated clock (sim.h).
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
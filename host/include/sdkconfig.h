@@ -0,0 +1,16 @@
+#pragma once
+
+// Host build: the Kconfig values the core reads. Defaults, except the
+// program limits, which are raised for the benchmark sizes.
+
+#define CONFIG_CYCLE_JSON_CHUNK_SIZE     256
+#define CONFIG_CYCLE_MOTOR_DEADTIME_MS   200
+#define CONFIG_CYCLE_TELEMETRY           0
+#define CONFIG_CYCLE_REJECT_CONFLICTS    1
+#define CONFIG_CYCLE_MAX_PHASES          16384
+#define CONFIG_CYCLE_MAX_COMPONENTS      65535
+#define CONFIG_CYCLE_MAX_MOTOR_STEPS     4096
+#define CONFIG_CYCLE_MAX_MOTOR_SEGMENTS  16384
+#define CONFIG_CYCLE_MAX_TRIGGERS        4096
+#define CONFIG_CYCLE_INRUSH_CAP_MA       1000
+#define CONFIG_CYCLE_INRUSH_STAGGER_US   3000
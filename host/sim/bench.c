@@ -0,0 +1,271 @@
+// Host benchmark of the parse / compile / schedule core over synthetic
+// programs. Run from the build directory:
+//
+//   ./cycle_bench [max_components] [-v]
+//
+// Sizes go 1, 10, 100, ... up to max_components (default 10000). Each
+// size is parsed from a generated input.json, compiled, checked, and
+// walked on the simulated clock; the run fails if a stage fails or the walk does not
+// end with every output OFF. A fixed program with runs of empty phases
+// then checks that one wake-up never reports more phases than the
+// scheduler's report queue holds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "components.h"
+#include "jitter.h"
+#include "outputs.h"
+#include "program.h"
+#include "program_check.h"
+#include "program_json.h"
+#include "timeline.h"
+#include "sim.h"
+
+#define COMPONENTS_PER_PHASE  16
+#define MOTOR_EVERY_PHASES    4      // a toggling motor in every 4th phase
+#define PLAIN_COMPONENTS      6      // component_states before Motor / Motor Direction
+#define REPORT_QUEUE_LEN      CONFIG_CYCLE_MAX_PHASES   // as in main/scheduler.c
+
+typedef struct {
+    int      components;
+    double   parse_ms;
+    double   compile_ms;
+    double   check_ms;
+    size_t   heap_peak;
+    double   run_ms;            // real time to walk the whole cycle
+    int      edges;
+    uint32_t p99_us;            // worst component
+    uint32_t max_us;
+} BenchResult;
+
+static double real_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static bool write_program(const char* path, int n) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    fputs("[\n", f);
+    int phase = 0;
+    for (int k = 0; k < n; phase++) {
+        fprintf(f, "%s  { \"name\": \"Phase %d\", \"startTime\": 0, \"components\": [\n",
+                phase ? ",\n" : "", phase);
+        bool motor = phase % MOTOR_EVERY_PHASES == 0;
+        int in_phase = 0;
+        for (; in_phase < COMPONENTS_PER_PHASE && k < n; in_phase++, k++) {
+            if (motor && in_phase == 0) {
+                fprintf(f, "    { \"compId\": \"Motor\", \"start\": 0, \"duration\": 6000, \"motorConfig\": "
+                           "{ \"runningStyle\": \"toggle\", \"stepTime\": 1000, \"pauseTime\": 300 } }");
+            } else {
+                fprintf(f, "%s    { \"compId\": \"%s\", \"start\": %d, \"duration\": %d, \"motorConfig\": null }",
+                        in_phase ? ",\n" : "", component_states[k % PLAIN_COMPONENTS].name,
+                        (k * 137) % 2000, 500 + (k * 53) % 3000);
+            }
+        }
+        fputs("\n  ] }", f);
+    }
+    fputs("\n]\n", f);
+    return fclose(f) == 0;
+}
+
+static int s_reports = 0;
+static int s_burst = 0;         // reports since the last wake-up
+static int s_max_burst = 0;
+
+static bool sim_apply(const TimelineEdge* e) {
+    outputs_apply(e->gpio_mask_set, e->gpio_mask_clear);
+    return true;
+}
+
+static bool sim_held(void) {
+    return false;
+}
+
+static void sim_report(const PhaseReport* r) {
+    s_reports++;
+    if (++s_burst > s_max_burst) {
+        s_max_burst = s_burst;
+    }
+}
+
+static const TimelineHooks s_hooks = {
+    .apply  = sim_apply,
+    .held   = sim_held,
+    .report = sim_report,
+    .sense  = sim_sensor_read,
+};
+
+static bool bench(int n, const char* path, BenchResult* out) {
+    *out = (BenchResult){ .components = n };
+    if (!write_program(path, n)) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return false;
+    }
+
+    Program prog;
+    program_init(&prog);
+    sim_heap_reset_peak();
+    size_t heap_base = sim_heap_in_use();
+
+    double t0 = real_ms();
+    if (!load_json_config(path, &prog)) {
+        return false;
+    }
+    double t1 = real_ms();
+    if (program_compile(&prog) != ESP_OK) {
+        program_free(&prog);
+        return false;
+    }
+    double t2 = real_ms();
+    // The generated programs open valves regardless of the drain pump, so
+    // they do have conflicts; only the cost of the check is measured, and
+    // its report is kept for -v.
+    esp_log_level_t level = sim_log_level;
+    if (level < ESP_LOG_INFO) {
+        sim_log_level = ESP_LOG_NONE;
+    }
+    ProgramCheck check;
+    program_check(&prog, &check);
+    sim_log_level = level;
+    double t3 = real_ms();
+    out->parse_ms   = t1 - t0;
+    out->compile_ms = t2 - t1;
+    out->check_ms   = t3 - t2;
+    out->heap_peak  = sim_heap_peak() - heap_base;
+    out->edges      = prog.num_edges;
+
+    // Jump the clock from one wake-up to the next; whatever the walk
+    // spends after each jump is measured as lateness.
+    sim_outputs_reset();
+    jitter_reset();
+    s_reports = 0;
+    Timeline tl;
+    timeline_begin(&tl, &prog, 0, &s_hooks);
+    sim_clock_set(0);
+    double t4 = real_ms();
+    int64_t due;
+    while ((due = timeline_run(&tl, sim_clock_now())) != TIMELINE_DONE) {
+        sim_clock_set(due);
+    }
+    timeline_finish(&tl);
+    out->run_ms = real_ms() - t4;
+
+    JitterStats stats[NUM_COMPONENTS];
+    jitter_snapshot(stats);
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        uint32_t p99 = jitter_percentile(&stats[i], 99);
+        if (p99 > out->p99_us) {
+            out->p99_us = p99;
+        }
+        if (stats[i].count && stats[i].max_us > out->max_us) {
+            out->max_us = stats[i].max_us;
+        }
+    }
+
+    bool ok = true;
+    if ((sim_outputs() & outputs_mask()) != outputs_mask()) {
+        fprintf(stderr, "%d components: outputs left ON (0x%08x)\n", n, (unsigned int)~sim_outputs() & outputs_mask());
+        ok = false;
+    }
+    if (s_reports != prog.num_phases || (int)sim_motor_segments() != prog.num_segments) {
+        fprintf(stderr, "%d components: %d/%d phase reports, %u/%d motor segments\n", n, s_reports,
+                prog.num_phases, (unsigned int)sim_motor_segments(), prog.num_segments);
+        ok = false;
+    }
+    program_free(&prog);
+    return ok;
+}
+
+// A valve phase, six empty ones, another valve phase and five empty ones:
+// the first run ends inside timeline_run(), the last in timeline_finish().
+static bool write_empty_phases(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    static const int runs[] = { 6, 5 };
+    fputs("[\n", f);
+    for (int i = 0; i < 2; i++) {
+        fprintf(f, "%s  { \"name\": \"Fill %d\", \"startTime\": 0, \"components\": [\n"
+                   "    { \"compId\": \"%s\", \"start\": 0, \"duration\": 1000, \"motorConfig\": null }\n  ] }",
+                i ? ",\n" : "", i, component_states[0].name);
+        for (int j = 0; j < runs[i]; j++) {
+            fprintf(f, ",\n  { \"name\": \"Empty %d.%d\", \"startTime\": 0, \"components\": [] }", i, j);
+        }
+    }
+    fputs("\n]\n", f);
+    return fclose(f) == 0;
+}
+
+static bool bench_empty_phases(const char* path) {
+    Program prog;
+    program_init(&prog);
+    if (!write_empty_phases(path) || !load_json_config(path, &prog)) {
+        return false;
+    }
+    if (program_compile(&prog) != ESP_OK) {
+        program_free(&prog);
+        return false;
+    }
+    sim_outputs_reset();
+    s_reports   = 0;
+    s_max_burst = 0;
+    Timeline tl;
+    timeline_begin(&tl, &prog, 0, &s_hooks);
+    sim_clock_set(0);
+    int64_t due;
+    for (s_burst = 0; (due = timeline_run(&tl, sim_clock_now())) != TIMELINE_DONE; s_burst = 0) {
+        sim_clock_set(due);
+    }
+    timeline_finish(&tl);
+
+    bool ok = s_reports == prog.num_phases && s_max_burst <= REPORT_QUEUE_LEN;
+    printf("empty phases: %d/%d phase reports, up to %d in one wake-up (queue %d)%s\n", s_reports,
+           prog.num_phases, s_max_burst, REPORT_QUEUE_LEN, ok ? "" : " FAILED");
+    program_free(&prog);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    int max_components = 10000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            sim_log_level = ESP_LOG_INFO;
+        } else {
+            max_components = atoi(argv[i]);
+        }
+    }
+    if (max_components < 1) {
+        fprintf(stderr, "usage: %s [max_components] [-v]\n", argv[0]);
+        return 2;
+    }
+
+    const char* path = "bench_input.json";
+    printf("%11s %10s %11s %9s %10s %8s %9s %8s %8s\n",
+           "components", "parse ms", "compile ms", "check ms", "heap peak", "edges", "walk ms", "p99 us", "max us");
+    bool ok = true;
+    for (int n = 1; n <= max_components; n *= 10) {
+        BenchResult r;
+        if (!bench(n, path, &r)) {
+            printf("%11d FAILED\n", n);
+            ok = false;
+            continue;
+        }
+        printf("%11d %10.2f %11.2f %9.2f %10zu %8d %9.2f %8u %8u\n", r.components, r.parse_ms, r.compile_ms,
+               r.check_ms, r.heap_peak, r.edges, r.run_ms, (unsigned int)r.p99_us, (unsigned int)r.max_us);
+    }
+    if (!bench_empty_phases(path)) {
+        ok = false;
+    }
+    remove(path);
+    return ok ? 0 : 1;
+}
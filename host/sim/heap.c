@@ -0,0 +1,79 @@
+#include "sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The core objects are linked with -Wl,--wrap=malloc,... so their heap use
+// goes through here. Each block carries its size in front of it.
+
+#define HEADER  16
+
+void* __real_malloc(size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void  __real_free(void* ptr);
+
+static size_t s_in_use = 0;
+static size_t s_peak   = 0;
+
+static void* account(unsigned char* raw, size_t size) {
+    if (!raw) {
+        return NULL;
+    }
+    memcpy(raw, &size, sizeof(size));
+    s_in_use += size;
+    if (s_in_use > s_peak) {
+        s_peak = s_in_use;
+    }
+    return raw + HEADER;
+}
+
+static size_t block_size(void* ptr) {
+    size_t size;
+    memcpy(&size, (unsigned char*)ptr - HEADER, sizeof(size));
+    return size;
+}
+
+void* __wrap_malloc(size_t size) {
+    return account(__real_malloc(size + HEADER), size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    void* p = __wrap_malloc(n * size);
+    if (p) {
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    if (!ptr) {
+        return __wrap_malloc(size);
+    }
+    size_t old = block_size(ptr);
+    unsigned char* raw = __real_realloc((unsigned char*)ptr - HEADER, size + HEADER);
+    if (!raw) {
+        return NULL;
+    }
+    s_in_use -= old;
+    return account(raw, size);
+}
+
+void __wrap_free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    s_in_use -= block_size(ptr);
+    __real_free((unsigned char*)ptr - HEADER);
+}
+
+void sim_heap_reset_peak(void) {
+    s_peak = s_in_use;
+}
+
+size_t sim_heap_in_use(void) {
+    return s_in_use;
+}
+
+size_t sim_heap_peak(void) {
+    return s_peak;
+}
@@ -0,0 +1,131 @@
+#include "sim.h"
+
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "components.h"
+#include "motor.h"
+#include "outputs.h"
+
+esp_log_level_t sim_log_level = ESP_LOG_WARN;
+
+static int64_t  s_sim_us  = 0;
+static int64_t  s_real_at = 0;      // real clock at the last sim_clock_set
+static uint32_t s_levels  = UINT32_MAX;
+static uint32_t s_motor_segments = 0;
+static int32_t  s_sensors[NUM_SENSORS];
+static uint32_t s_sensors_set = 0;
+
+static int64_t real_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void sim_clock_set(int64_t now_us) {
+    s_sim_us  = now_us;
+    s_real_at = real_us();
+}
+
+int64_t sim_clock_now(void) {
+    return s_sim_us + (real_us() - s_real_at);
+}
+
+int64_t esp_timer_get_time(void) {
+    return sim_clock_now();
+}
+
+const char* esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK:                  return "ESP_OK";
+        case ESP_FAIL:                return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:          return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:     return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:   return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:    return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:       return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_INVALID_CRC:     return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+        default:                      return "ESP_ERR_UNKNOWN";
+    }
+}
+
+// ---- outputs.h ----
+
+static uint32_t pin_mask(void) {
+    uint32_t mask = 0;
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        mask |= 1u << component_states[i].pin;
+    }
+    return mask;
+}
+
+esp_err_t outputs_init(void) {
+    sim_outputs_reset();
+    return ESP_OK;
+}
+
+void outputs_apply(uint32_t set_mask, uint32_t clear_mask) {
+    uint32_t mask = pin_mask();
+    s_levels |= set_mask & mask;
+    s_levels &= ~(clear_mask & mask);
+}
+
+void outputs_all_off(void) {
+    s_levels = UINT32_MAX;
+}
+
+uint32_t outputs_mask(void) {
+    return pin_mask();
+}
+
+uint32_t sim_outputs(void) {
+    return s_levels;
+}
+
+void sim_outputs_reset(void) {
+    s_levels = UINT32_MAX;
+    s_motor_segments = 0;
+    s_sensors_set = 0;
+}
+
+// ---- motor.h ----
+
+esp_err_t motor_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t motor_start(const Program* prog, const MotorSegment* seg, uint32_t elapsed_ms) {
+    s_motor_segments++;
+    return ESP_OK;
+}
+
+void motor_stop(void) {
+}
+
+bool motor_running(void) {
+    return false;
+}
+
+uint32_t sim_motor_segments(void) {
+    return s_motor_segments;
+}
+
+// ---- sensors ----
+
+void sim_sensor_set(uint8_t sensor, int32_t value) {
+    if (sensor < NUM_SENSORS) {
+        s_sensors[sensor] = value;
+        s_sensors_set |= 1u << sensor;
+    }
+}
+
+bool sim_sensor_read(uint8_t sensor, int32_t* value) {
+    if (sensor >= NUM_SENSORS || !(s_sensors_set & (1u << sensor))) {
+        return false;
+    }
+    *value = s_sensors[sensor];
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// ------------------------- HOST SIMULATION -------------------------
+// Fake hardware for running the core natively:
+//   - clock: esp_timer_get_time() returns the time the simulation jumped
+//     to plus the real time spent since the jump, so work done after a
+//     wake-up shows up as lateness just like on the device;
+//   - GPIO: outputs_apply() updates a fake output register (active low,
+//     like the relays);
+//   - motor: motor_start()/motor_stop() only count segments;
+//   - sensors: values set by the test, read through sim_sensor_read() as
+//     the timeline's sense hook.
+
+void     sim_clock_set(int64_t now_us);
+int64_t  sim_clock_now(void);
+
+uint32_t sim_outputs(void);           // levels, 1 = OFF
+void     sim_outputs_reset(void);
+uint32_t sim_motor_segments(void);    // motor_start() calls since reset
+
+// No sensor has a value until it is set; sim_outputs_reset() clears them.
+void     sim_sensor_set(uint8_t sensor, int32_t value);
+bool     sim_sensor_read(uint8_t sensor, int32_t* value);
+
+// Heap accounting for everything the core allocates (see heap.c).
+void     sim_heap_reset_peak(void);
+size_t   sim_heap_in_use(void);
+size_t   sim_heap_peak(void);
@@ -0,0 +1,88 @@
+// Performance counters of a board (main/diag.h, CONFIG_CYCLE_DIAGNOSTICS)
+// over its HTTP server:
+//   fetchDiag    GET /diag: build, boot load times, heap, task stacks,
+//                timer dispatch latency and scheduler load
+//   runBench     POST /diag/bench: a synthetic program of closely spaced
+//                edges through the scheduler, no output switched
+//   benchBoard   fetchDiag, then `runs` benches of the same program, for
+//                scripts/bench-device.js and POST /api/device-bench
+//   compareRuns  the numbers of two benchBoard() results side by side
+// Latencies come as { count, minUs, avgUs, p50Us, p99Us, maxUs, buckets },
+// bucket b counting those under 2^b us; p50/p99 are bucket bounds.
+// The bench carries the board's CONFIG_CYCLE_HTTP_TOKEN, `token` or
+// DEVICE_TOKEN in the environment.
+
+const DIAG_TIMEOUT_MS = 3000;
+
+async function getJson(url, options, timeoutMs) {
+  const response = await fetch(url, { ...options, signal: AbortSignal.timeout(timeoutMs) });
+  const body = await response.json().catch(() => ({}));
+  if (!response.ok) {
+    const err = new Error(body.error || response.statusText);
+    err.status = response.status; // 409: a cycle is running, 401: wrong token
+    throw err;
+  }
+  return body;
+}
+
+function fetchDiag(host) {
+  return getJson(`http://${host}/diag`, {}, DIAG_TIMEOUT_MS);
+}
+
+// Leave `edges` and `spacingMs` unset to run the build's defaults
+// (CONFIG_CYCLE_DIAG_BENCH_EDGES / _SPACING_MS), so builds compare on the
+// same program. The board answers once the run is over.
+function runBench(host, { edges, spacingMs, token = process.env.DEVICE_TOKEN } = {}) {
+  const query = new URLSearchParams();
+  if (edges) query.set("edges", String(edges));
+  if (spacingMs) query.set("spacingMs", String(spacingMs));
+  const runMs = 5000; // the longest bench the board accepts (DIAG_BENCH_MAX_RUN_MS)
+  const headers = token ? { Authorization: `Bearer ${token}` } : {};
+  return getJson(`http://${host}/diag/bench?${query}`, { method: "POST", headers }, runMs + 10000);
+}
+
+const median = (values) => {
+  const sorted = [...values].sort((a, b) => a - b);
+  return sorted.length ? sorted[Math.floor(sorted.length / 2)] : 0;
+};
+
+// Median over the runs of what compareRuns() looks at.
+function summarize(benches) {
+  const pick = (f) => median(benches.map(f));
+  return {
+    lateP99Us: pick((b) => b.late.p99Us),
+    lateMaxUs: pick((b) => b.late.maxUs),
+    dispatchP50Us: pick((b) => b.dispatch.p50Us),
+    dispatchP99Us: pick((b) => b.dispatch.p99Us),
+    dispatchMaxUs: pick((b) => b.dispatch.maxUs),
+    cpuPermille: pick((b) => b.cpuPermille),
+    stackFree: Math.min(...benches.map((b) => b.stackFree)),
+  };
+}
+
+// { build, diag, benches, summary }: the board's counters, then `runs`
+// benches one after the other.
+async function benchBoard(host, { runs = 3, edges, spacingMs, token } = {}) {
+  const diag = await fetchDiag(host);
+  const benches = [];
+  for (let i = 0; i < runs; i++) {
+    benches.push(await runBench(host, { edges, spacingMs, token }));
+  }
+  return { build: diag.build, diag, benches, summary: summarize(benches) };
+}
+
+// Rows of { what, before, after, change } for two benchBoard() results.
+function compareRuns(before, after) {
+  const rows = [
+    ["load total us", (r) => r.diag.load.totalUs],
+    ["heap after load", (r) => r.diag.heap.afterLoad],
+    ...Object.keys(after.summary).map((k) => [k, (r) => r.summary[k]]),
+  ];
+  return rows.map(([what, f]) => {
+    const a = f(before);
+    const b = f(after);
+    return { what, before: a, after: b, change: a ? Math.round(((b - a) / a) * 1000) / 10 : null };
+  });
+}
+
+module.exports = { fetchDiag, runBench, benchBoard, compareRuns };
@@ -0,0 +1,212 @@
+// Registry of boards for fleet operations: push one program to many
+// boards at once, and follow all their live status streams in one view.
+//
+// The registry is a JSON file (FLEET_FILE, default fleet.json next to
+// server.js) holding [{ "id": "rig-1", "host": "192.168.1.40",
+// "tags": ["lab-a"] }, ...]. Boards need CONFIG_CYCLE_HTTP_UPLOAD for
+// pushes and CONFIG_CYCLE_LIVE_STATUS for status.
+
+const fs = require("fs");
+const path = require("path");
+const { pushProgram } = require("./program-upload");
+const { openLiveStatus } = require("./live-status");
+
+const DEFAULT_CONCURRENCY = 4;
+const RECONNECT_MS = 5000; // after a status stream drops
+const STALE_MS = 3000; // no frame for this long: the board counts as offline
+
+// Run `worker(item)` over `items` with at most `limit` in flight; resolves
+// with one { ok, value } or { ok: false, error } per item, in order.
+async function runPool(items, limit, worker) {
+  const results = new Array(items.length);
+  let next = 0;
+  const lane = async () => {
+    while (next < items.length) {
+      const i = next++;
+      try {
+        results[i] = { ok: true, value: await worker(items[i]) };
+      } catch (error) {
+        results[i] = { ok: false, error };
+      }
+    }
+  };
+  const lanes = Math.max(1, Math.min(limit, items.length));
+  await Promise.all(Array.from({ length: lanes }, lane));
+  return results;
+}
+
+class Fleet {
+  constructor(file = process.env.FLEET_FILE || path.join(__dirname, "..", "fleet.json")) {
+    this.file = file;
+    this.devices = new Map(); // id -> { id, host, tags }
+    this.live = new Map(); // id -> { stream, status, lastSeen, error, timer }
+    this.listeners = new Set();
+    this.watching = false;
+    this.load();
+  }
+
+  load() {
+    if (!fs.existsSync(this.file)) return;
+    const list = JSON.parse(fs.readFileSync(this.file, "utf8"));
+    if (!Array.isArray(list)) throw new Error(`${this.file}: expected an array of devices`);
+    for (const d of list) this.devices.set(d.id, normalize(d));
+  }
+
+  save() {
+    fs.writeFileSync(this.file, JSON.stringify([...this.devices.values()], null, 2));
+  }
+
+  list() {
+    return [...this.devices.values()];
+  }
+
+  upsert(device) {
+    const d = normalize(device);
+    const old = this.devices.get(d.id);
+    this.devices.set(d.id, d);
+    this.save();
+    if (old && old.host !== d.host) this.unfollow(d.id);
+    if (this.watching) this.follow(d.id);
+    return d;
+  }
+
+  remove(id) {
+    this.unfollow(id);
+    const removed = this.devices.delete(id);
+    if (removed) this.save();
+    return removed;
+  }
+
+  // Devices by ID and/or tag; all of them when neither is given.
+  select({ ids, tag } = {}) {
+    let list = this.list();
+    if (Array.isArray(ids) && ids.length) {
+      const unknown = ids.filter((id) => !this.devices.has(id));
+      if (unknown.length) throw new Error(`Unknown devices: ${unknown.join(", ")}`);
+      list = list.filter((d) => ids.includes(d.id));
+    }
+    if (tag) list = list.filter((d) => d.tags.includes(tag));
+    return list;
+  }
+
+  // Push one compiled program to every device in `devices`, at most
+  // `concurrency` uploads at a time. Boards that already hold it are
+  // skipped (pushProgram). Never rejects; each device gets its own result.
+  async push(devices, binary, { concurrency = DEFAULT_CONCURRENCY, timeoutMs, force } = {}) {
+    const started = Date.now();
+    const results = await runPool(devices, concurrency, (d) => pushProgram(d.host, binary, { timeoutMs, force }));
+    const report = devices.map((d, i) =>
+      results[i].ok
+        ? {
+            id: d.id,
+            host: d.host,
+            ok: true,
+            skipped: results[i].value.skipped,
+            elapsedMs: results[i].value.elapsedMs,
+            device: results[i].value,
+          }
+        : {
+            id: d.id,
+            host: d.host,
+            ok: false,
+            rejected: !!results[i].error.rejected,
+            busy: !!results[i].error.busy,
+            error: results[i].error.message,
+          }
+    );
+    return {
+      ok: report.filter((r) => r.ok).length,
+      failed: report.filter((r) => !r.ok).length,
+      skipped: report.filter((r) => r.skipped).length,
+      elapsedMs: Date.now() - started,
+      devices: report,
+    };
+  }
+
+  // Status streams are opened on the first status() or subscribe() and
+  // kept open from then on, so the aggregated view stays current.
+  watch() {
+    this.watching = true;
+    for (const id of this.devices.keys()) this.follow(id);
+  }
+
+  // onStatus gets (id, status) for every frame from every board.
+  subscribe(onStatus) {
+    this.listeners.add(onStatus);
+    this.watch();
+    return () => this.listeners.delete(onStatus);
+  }
+
+  follow(id) {
+    const device = this.devices.get(id);
+    if (!device) return;
+    let entry = this.live.get(id);
+    if (!entry) {
+      entry = { stream: null, status: null, lastSeen: 0, error: null, timer: null };
+      this.live.set(id, entry);
+    }
+    if (entry.stream || entry.timer) return;
+    try {
+      entry.stream = openLiveStatus(device.host, {
+        onStatus: (status) => {
+          entry.status = status;
+          entry.lastSeen = Date.now();
+          entry.error = null;
+          for (const listener of this.listeners) listener(id, status);
+        },
+        onError: (err) => {
+          entry.error = err.message;
+        },
+        onClose: () => {
+          entry.stream = null;
+          if (this.live.get(id) !== entry) return;
+          entry.timer = setTimeout(() => {
+            entry.timer = null;
+            this.follow(id);
+          }, RECONNECT_MS);
+        },
+      });
+    } catch (err) {
+      entry.error = err.message;
+    }
+  }
+
+  unfollow(id) {
+    const entry = this.live.get(id);
+    if (!entry) return;
+    this.live.delete(id);
+    clearTimeout(entry.timer);
+    if (entry.stream) entry.stream.close();
+  }
+
+  // One view of the whole fleet: every device with its latest status, and
+  // how many are running, paused, idle or offline.
+  status() {
+    this.watch();
+    const now = Date.now();
+    const summary = { total: this.devices.size, running: 0, paused: 0, idle: 0, offline: 0 };
+    const devices = this.list().map((d) => {
+      const entry = this.live.get(d.id);
+      const online = !!entry && now - entry.lastSeen < STALE_MS;
+      const state = !online ? "offline" : entry.status.paused ? "paused" : entry.status.running ? "running" : "idle";
+      summary[state]++;
+      return {
+        ...d,
+        state,
+        status: entry ? entry.status : null,
+        lastSeenMs: entry && entry.lastSeen ? now - entry.lastSeen : null,
+        error: entry ? entry.error : null,
+      };
+    });
+    return { ...summary, devices };
+  }
+}
+
+function normalize(d) {
+  if (!d || typeof d.id !== "string" || !d.id || typeof d.host !== "string" || !d.host) {
+    throw new Error('A device needs an "id" and a "host"');
+  }
+  return { id: d.id, host: d.host, tags: Array.isArray(d.tags) ? d.tags.map(String) : [] };
+}
+
+module.exports = { Fleet, runPool, DEFAULT_CONCURRENCY };
@@ -0,0 +1,56 @@
+// Live status frames from the board's ws://<host>/live (main/live_status.h,
+// CONFIG_CYCLE_LIVE_STATUS). Layout mirrors LiveStatusFrame; keep the two
+// in sync.
+
+const { COMPONENTS } = require("./program-binary");
+
+const VERSION = 1;
+const FRAME_SIZE = 24;
+const RUNNING = 0x01;
+const PAUSED = 0x02;
+
+function decodeStatusFrame(buffer) {
+  const buf = Buffer.from(buffer);
+  if (buf.length !== FRAME_SIZE || buf.readUInt8(0) !== VERSION) {
+    throw new Error(`Not a version ${VERSION} status frame (${buf.length} bytes)`);
+  }
+  const flags = buf.readUInt8(1);
+  const mask = buf.readUInt32LE(8);
+  return {
+    seq: buf.readUInt32LE(4),
+    running: (flags & RUNNING) !== 0,
+    paused: (flags & PAUSED) !== 0,
+    phase: buf.readUInt16LE(2),
+    components: COMPONENTS.filter((c, i) => mask & (1 << i)).map((c) => c.name),
+    elapsedMs: buf.readUInt32LE(12),
+    remainingMs: buf.readUInt32LE(16),
+    uptimeMs: buf.readUInt32LE(20),
+  };
+}
+
+// Calls onStatus with every decoded frame until close() is called or the
+// board goes away (onClose). Needs the WebSocket client built into
+// Node 22 and later.
+function openLiveStatus(host, { onStatus, onError, onClose }) {
+  if (typeof WebSocket === "undefined") {
+    throw new Error("WebSocket client needs Node 22 or later");
+  }
+  const ws = new WebSocket(`ws://${host}/live`);
+  ws.binaryType = "arraybuffer";
+  ws.onmessage = (event) => {
+    try {
+      onStatus(decodeStatusFrame(event.data));
+    } catch (err) {
+      if (onError) onError(err);
+    }
+  };
+  ws.onerror = (event) => {
+    if (onError) onError(event.error || new Error("WebSocket error"));
+  };
+  ws.onclose = () => {
+    if (onClose) onClose();
+  };
+  return { close: () => ws.close() };
+}
+
+module.exports = { decodeStatusFrame, openLiveStatus };
@@ -0,0 +1,420 @@
+// Compiles an input.json program into the firmware's input.bin format.
+// Layout and compile rules mirror main/program_bin.h and main/program.c;
+// keep the three in sync.
+
+const crypto = require("crypto");
+const zlib = require("zlib");
+
+// Same order and pins as CYCLE_COMPONENTS in main/main.h.
+const COMPONENTS = [
+  { name: "Retractor", pin: 7 },
+  { name: "Detergent Valve", pin: 8 },
+  { name: "Cold Valve", pin: 9 },
+  { name: "Drain Pump", pin: 19 },
+  { name: "Hot Valve", pin: 5 },
+  { name: "Softener Valve", pin: 18 },
+  { name: "Motor", pin: 4 },
+  { name: "Motor Direction", pin: 10 },
+];
+
+// Same order as CYCLE_SENSORS in main/main.h.
+const SENSORS = ["Water Level", "Pressure", "Temperature"];
+
+const MAGIC = 0x504f5943; // "CYOP"
+const VERSION = 3;
+const HEADER_SIZE = 40;
+const CRC_OFFSET = 36;
+const PHASE_SIZE = 16;
+const COMPONENT_SIZE = 24;
+const EDGE_SIZE = 12;
+const SEGMENT_SIZE = 24;
+const STEP_SIZE = 12;
+const TRIGGER_SIZE = 12;
+const PHASE_GAP_MS = 50;
+
+// RunningStyle in main/program.h; index = enum value.
+const RUNNING_STYLES = ["none", "toggle", "singleDir", "pattern"];
+const STYLE_NONE = 0;
+const STYLE_PATTERN = 3;
+const MOTOR_PIN = 4;
+const MOTOR_MAX_PATTERN_STEPS = 16;
+const COMPONENT_NONE = 0xff;
+const TRIGGER_ABOVE = 0;
+const TRIGGER_BELOW = 1;
+
+function crc32(buf, crc = 0) {
+  return zlib.crc32 ? zlib.crc32(buf, crc) >>> 0 : crc32Slow(buf, crc);
+}
+
+// Fallback for Node versions without zlib.crc32.
+function crc32Slow(buf, crc = 0) {
+  crc = ~crc >>> 0;
+  for (const byte of buf) {
+    crc ^= byte;
+    for (let k = 0; k < 8; k++) {
+      crc = crc & 1 ? (crc >>> 1) ^ 0xedb88320 : crc >>> 1;
+    }
+  }
+  return ~crc >>> 0;
+}
+
+// Same clamping as the firmware's JSON loader: missing or negative -> 0.
+function ms(value) {
+  const v = Number(value);
+  return Number.isFinite(v) && v > 0 ? Math.min(Math.floor(v), 0xffffffff) : 0;
+}
+
+// An "endOn" condition, as the firmware loader reads it: a sensor and
+// "above" or "below" a threshold; a bare sensor means a switch that closed.
+function parseTrigger(endOn, phaseName) {
+  if (!endOn || typeof endOn !== "object" || Array.isArray(endOn)) {
+    return null;
+  }
+  if (typeof endOn.sensor !== "string") {
+    throw new Error(`endOn without sensor in phase "${phaseName}"`);
+  }
+  const sensor = SENSORS.indexOf(endOn.sensor);
+  if (sensor < 0) {
+    throw new Error(`unknown sensor "${endOn.sensor}" in phase "${phaseName}"`);
+  }
+  let op = TRIGGER_ABOVE;
+  let threshold = 0;
+  if (typeof endOn.above === "number") {
+    threshold = endOn.above;
+  } else if (typeof endOn.below === "number") {
+    op = TRIGGER_BELOW;
+    threshold = endOn.below;
+  }
+  threshold = Math.max(-0x80000000, Math.min(0x7fffffff, Math.trunc(threshold)));
+  return { sensor, op, threshold };
+}
+
+// Same rules as the firmware loader: a motorConfig that cannot run leaves
+// the component running plain, and is reported in `warnings`.
+function parseMotor(compJson, pin, steps, warnings, phaseName) {
+  const motor = { runningStyle: STYLE_NONE, ccw: 0, stepTime: 0, pauseTime: 0, firstStep: 0, numSteps: 0 };
+  const cfg = compJson.motorConfig;
+  if (!cfg || typeof cfg !== "object" || Array.isArray(cfg)) {
+    return motor;
+  }
+  if (typeof cfg.runningStyle === "string") {
+    const style = RUNNING_STYLES.indexOf(cfg.runningStyle);
+    if (style > STYLE_NONE) {
+      motor.runningStyle = style;
+    } else {
+      warnings.push({ phase: phaseName, compId: compJson.compId, reason: `unknown runningStyle "${cfg.runningStyle}"` });
+    }
+  }
+  if (typeof cfg.direction === "string") motor.ccw = cfg.direction === "ccw" ? 1 : 0;
+  if (typeof cfg.stepTime === "number") motor.stepTime = ms(cfg.stepTime);
+  if (typeof cfg.pauseTime === "number") motor.pauseTime = ms(cfg.pauseTime);
+
+  const pattern = Array.isArray(cfg.pattern)
+    ? cfg.pattern.filter((s) => s && typeof s === "object" && !Array.isArray(s))
+    : [];
+  if (pattern.length > MOTOR_MAX_PATTERN_STEPS) {
+    throw new Error(`motor pattern has too many steps in phase "${phaseName}"`);
+  }
+  const patternSteps = pattern.map((s) => ({
+    onMs: typeof s.stepTime === "number" ? ms(s.stepTime) : 0,
+    offMs: typeof s.pauseTime === "number" ? ms(s.pauseTime) : 0,
+    ccw: s.direction === "ccw" ? 1 : 0,
+  }));
+  if (patternSteps.length > 0) {
+    motor.runningStyle = STYLE_PATTERN;
+  }
+  if (motor.runningStyle === STYLE_NONE) {
+    return motor;
+  }
+
+  let why = null;
+  if (pin !== MOTOR_PIN) {
+    why = "motorConfig on a component that is not the motor";
+  } else if (motor.runningStyle === STYLE_PATTERN) {
+    if (patternSteps.length === 0) why = "empty pattern";
+    else if (patternSteps.some((s) => s.onMs === 0)) why = "pattern step without stepTime";
+  } else if (motor.stepTime === 0) {
+    why = "no stepTime";
+  }
+  if (why) {
+    warnings.push({ phase: phaseName, compId: compJson.compId, reason: why });
+    return { ...motor, runningStyle: STYLE_NONE };
+  }
+  if (motor.runningStyle === STYLE_PATTERN) {
+    motor.firstStep = steps.length;
+    motor.numSteps = patternSteps.length;
+    steps.push(...patternSteps);
+  }
+  return motor;
+}
+
+// Returns { phases, components, edges, segments, steps, triggers, totalMs,
+// warnings } in firmware terms. Unknown components are rejected, as on the device.
+function compileProgram(phasesJson) {
+  if (!Array.isArray(phasesJson)) {
+    throw new Error("program must be an array of phases");
+  }
+
+  const phases = [];
+  const components = [];
+  const steps = [];
+  const triggers = [];
+  const warnings = [];
+
+  for (const phaseJson of phasesJson) {
+    const phaseIndex = phases.length;
+    const phaseTrigger = parseTrigger(phaseJson.endOn, phaseJson.name);
+    if (phaseTrigger) {
+      triggers.push({ phase: phaseIndex, component: COMPONENT_NONE, ...phaseTrigger });
+    }
+    const phase = {
+      startTime: ms(phaseJson.startTime),
+      startMs: 0,
+      durationMs: 0,
+      firstComponent: components.length,
+      numComponents: 0,
+    };
+    for (const compJson of phaseJson.components || []) {
+      if (typeof compJson.compId !== "string") {
+        throw new Error(`component without compId in phase "${phaseJson.name}"`);
+      }
+      const index = COMPONENTS.findIndex((c) => c.name === compJson.compId);
+      if (index < 0) {
+        throw new Error(`unknown component "${compJson.compId}" in phase "${phaseJson.name}"`);
+      }
+      const motor = parseMotor(compJson, COMPONENTS[index].pin, steps, warnings, phaseJson.name);
+      const compTrigger = parseTrigger(compJson.endOn, phaseJson.name);
+      if (compTrigger) {
+        triggers.push({ phase: phaseIndex, component: index, ...compTrigger });
+      }
+      components.push({
+        component: index,
+        start: ms(compJson.start),
+        duration: ms(compJson.duration),
+        ...motor,
+      });
+      phase.numComponents++;
+    }
+    phases.push(phase);
+  }
+
+  // 1) Place every phase on the cycle clock.
+  let t = 0;
+  let prevStartTime = 0;
+  phases.forEach((phase, i) => {
+    for (let j = 0; j < phase.numComponents; j++) {
+      const c = components[phase.firstComponent + j];
+      phase.durationMs = Math.max(phase.durationMs, c.start + c.duration);
+    }
+    if (i > 0) {
+      const prev = phases[i - 1];
+      t = prev.startMs + prev.durationMs + PHASE_GAP_MS;
+    }
+    if (phase.startTime > prevStartTime) {
+      t += phase.startTime - prevStartTime;
+    }
+    // The board's cycle clock is 32 bits (program_place_phases()).
+    if (t + phase.durationMs > 0xffffffff) {
+      throw new Error(`phase ${i} ends past ${0xffffffff} ms, beyond the cycle clock`);
+    }
+    phase.startMs = t;
+    prevStartTime = phase.startTime;
+  });
+  const last = phases[phases.length - 1];
+  const totalMs = last ? last.startMs + last.durationMs : 0;
+
+  // 2) Motor components with a running style become segments; the motor
+  //    engine times them, so they produce no edges.
+  const segments = [];
+  for (const phase of phases) {
+    for (let j = 0; j < phase.numComponents; j++) {
+      const c = components[phase.firstComponent + j];
+      if (c.runningStyle === STYLE_NONE || c.duration === 0) continue;
+      const on = phase.startMs + c.start;
+      segments.push({
+        startMs: on,
+        endMs: on + c.duration,
+        stepMs: c.stepTime,
+        pauseMs: c.pauseTime,
+        style: c.runningStyle,
+        ccw: c.ccw,
+        firstStep: c.firstStep,
+        numSteps: c.numSteps,
+      });
+    }
+  }
+  segments.sort((a, b) => a.startMs - b.startMs);
+  for (let i = 1; i < segments.length; i++) {
+    if (segments[i].startMs < segments[i - 1].endMs) {
+      throw new Error(`motor patterns overlap at ${segments[i].startMs} ms`);
+    }
+  }
+
+  // 3) Raw edges, ON before OFF at the same instant.
+  const raw = [];
+  for (const phase of phases) {
+    for (let j = 0; j < phase.numComponents; j++) {
+      const c = components[phase.firstComponent + j];
+      if (c.runningStyle !== STYLE_NONE) continue;
+      const pin = COMPONENTS[c.component].pin;
+      const on = phase.startMs + c.start;
+      raw.push({ time: on, pin, delta: 1 });
+      raw.push({ time: on + c.duration, pin, delta: -1 });
+    }
+  }
+  raw.sort((a, b) => a.time - b.time || b.delta - a.delta);
+
+  // 4) Sweep into one record per instant with a real level change.
+  const holders = new Array(32).fill(0);
+  let onMask = 0;
+  const edges = [];
+  for (let i = 0; i < raw.length; ) {
+    const now = raw[i].time;
+    const before = onMask;
+    for (; i < raw.length && raw[i].time === now; i++) {
+      const { pin, delta } = raw[i];
+      if (delta > 0) {
+        if (holders[pin]++ === 0) onMask = (onMask | (1 << pin)) >>> 0;
+      } else if (--holders[pin] === 0) {
+        onMask = (onMask & ~(1 << pin)) >>> 0;
+      }
+    }
+    const turnedOn = (onMask & ~before) >>> 0;
+    const turnedOff = (before & ~onMask) >>> 0;
+    if (turnedOn || turnedOff) {
+      edges.push({ time: now, set: turnedOff, clear: turnedOn });
+    }
+  }
+
+  return { phases, components, edges, segments, steps, triggers, totalMs, warnings };
+}
+
+// Serialize a compiled program. `sourceCrc` is the CRC-32 of the exact
+// input.json bytes it was compiled from.
+function encodeProgram(compiled, sourceCrc) {
+  const { phases, components, edges, segments, steps, triggers = [], totalMs } = compiled;
+  const pinBytes = (COMPONENTS.length + 3) & ~3;
+  const size =
+    HEADER_SIZE +
+    pinBytes +
+    phases.length * PHASE_SIZE +
+    components.length * COMPONENT_SIZE +
+    edges.length * EDGE_SIZE +
+    segments.length * SEGMENT_SIZE +
+    steps.length * STEP_SIZE +
+    triggers.length * TRIGGER_SIZE;
+  const buf = Buffer.alloc(size);
+
+  buf.writeUInt32LE(MAGIC, 0);
+  buf.writeUInt16LE(VERSION, 4);
+  buf.writeUInt16LE(HEADER_SIZE, 6);
+  buf.writeUInt16LE(COMPONENTS.length, 8);
+  buf.writeUInt16LE(phases.length, 10);
+  buf.writeUInt32LE(components.length, 12);
+  buf.writeUInt32LE(edges.length, 16);
+  buf.writeUInt32LE(totalMs, 20);
+  buf.writeUInt32LE(sourceCrc >>> 0, 24);
+  buf.writeUInt16LE(segments.length, 28);
+  buf.writeUInt16LE(steps.length, 30);
+  buf.writeUInt16LE(triggers.length, 32);
+
+  let off = HEADER_SIZE;
+  COMPONENTS.forEach((c, i) => buf.writeUInt8(c.pin, off + i));
+  off += pinBytes;
+
+  for (const p of phases) {
+    buf.writeUInt32LE(p.startTime, off);
+    buf.writeUInt32LE(p.startMs, off + 4);
+    buf.writeUInt32LE(p.durationMs, off + 8);
+    buf.writeUInt16LE(p.firstComponent, off + 12);
+    buf.writeUInt16LE(p.numComponents, off + 14);
+    off += PHASE_SIZE;
+  }
+  for (const c of components) {
+    buf.writeUInt8(c.component, off);
+    buf.writeUInt8(c.runningStyle, off + 1);
+    buf.writeUInt8(c.ccw, off + 2);
+    buf.writeUInt32LE(c.start, off + 4);
+    buf.writeUInt32LE(c.duration, off + 8);
+    buf.writeUInt32LE(c.stepTime, off + 12);
+    buf.writeUInt32LE(c.pauseTime, off + 16);
+    buf.writeUInt16LE(c.firstStep, off + 20);
+    buf.writeUInt16LE(c.numSteps, off + 22);
+    off += COMPONENT_SIZE;
+  }
+  for (const e of edges) {
+    buf.writeUInt32LE(e.time, off);
+    buf.writeUInt32LE(e.set, off + 4);
+    buf.writeUInt32LE(e.clear, off + 8);
+    off += EDGE_SIZE;
+  }
+  for (const m of segments) {
+    buf.writeUInt32LE(m.startMs, off);
+    buf.writeUInt32LE(m.endMs, off + 4);
+    buf.writeUInt32LE(m.stepMs, off + 8);
+    buf.writeUInt32LE(m.pauseMs, off + 12);
+    buf.writeUInt8(m.style, off + 16);
+    buf.writeUInt8(m.ccw, off + 17);
+    buf.writeUInt16LE(m.firstStep, off + 18);
+    buf.writeUInt16LE(m.numSteps, off + 20);
+    off += SEGMENT_SIZE;
+  }
+  for (const st of steps) {
+    buf.writeUInt32LE(st.onMs, off);
+    buf.writeUInt32LE(st.offMs, off + 4);
+    buf.writeUInt8(st.ccw, off + 8);
+    off += STEP_SIZE;
+  }
+  for (const k of triggers) {
+    buf.writeUInt16LE(k.phase, off);
+    buf.writeUInt8(k.component, off + 2);
+    buf.writeUInt8(k.sensor, off + 3);
+    buf.writeUInt8(k.op, off + 4);
+    buf.writeInt32LE(k.threshold, off + 8);
+    off += TRIGGER_SIZE;
+  }
+
+  // CRC over the header up to the crc field, then everything after it.
+  let crc = crc32(buf.subarray(0, CRC_OFFSET));
+  crc = crc32(buf.subarray(HEADER_SIZE), crc);
+  buf.writeUInt32LE(crc, CRC_OFFSET);
+  return buf;
+}
+
+// Programs built lately, by SHA-256 of their input.json text, so pushing
+// or reloading an unchanged program does not parse and compile it again.
+// Entries are shared: callers must not modify them.
+const BUILD_CACHE_MAX = 32;
+const buildCache = new Map();
+
+// input.json text -> input.bin buffer.
+function buildProgramBinary(jsonText) {
+  const key = crypto.createHash("sha256").update(jsonText).digest("hex");
+  const cached = buildCache.get(key);
+  if (cached) {
+    buildCache.delete(key); // most recently used last
+    buildCache.set(key, cached);
+    return cached;
+  }
+  const compiled = compileProgram(JSON.parse(jsonText));
+  const source = Buffer.from(jsonText, "utf8");
+  const built = {
+    binary: encodeProgram(compiled, crc32(source)),
+    compiled,
+  };
+  buildCache.set(key, built);
+  if (buildCache.size > BUILD_CACHE_MAX) {
+    buildCache.delete(buildCache.keys().next().value);
+  }
+  return built;
+}
+
+module.exports = {
+  COMPONENTS,
+  SENSORS,
+  RUNNING_STYLES,
+  crc32,
+  compileProgram,
+  encodeProgram,
+  buildProgramBinary,
+};
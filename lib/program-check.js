@@ -0,0 +1,86 @@
+// Conflict analysis of a compiled program, the same sweep as the
+// firmware's program_check() (main/program_check.c); keep the two in sync.
+// It flags forbidden combinations of outputs ON together, the motor
+// direction switching while the motor runs, and the program holding a
+// motor pin while a motor pattern drives it.
+
+const { COMPONENTS } = require("./program-binary");
+
+const pinOf = (name) => COMPONENTS.find((c) => c.name === name).pin;
+const MOTOR_BIT = 1 << pinOf("Motor");
+const DIR_BIT = 1 << pinOf("Motor Direction");
+
+// Outputs that must never all be ON at the same time: s_forbidden.
+const FORBIDDEN = [
+  { components: ["Hot Valve", "Drain Pump"], what: "Hot Valve open while the Drain Pump runs" },
+  { components: ["Cold Valve", "Drain Pump"], what: "Cold Valve open while the Drain Pump runs" },
+].map((f) => ({ ...f, mask: f.components.reduce((m, name) => (m | (1 << pinOf(name))) >>> 0, 0) }));
+
+// `compiled` as returned by compileProgram(). Returns { totalMs, onMs,
+// conflicts: [{ timeMs, phase, what }] } with onMs by component name.
+function checkProgram(compiled) {
+  const { phases, edges, segments, totalMs } = compiled;
+  const onMs = Object.fromEntries(COMPONENTS.map((c) => [c.name, 0]));
+  const conflicts = [];
+  const addOnTime = (mask, ms) => {
+    for (const c of COMPONENTS) if (mask & (1 << c.pin)) onMs[c.name] += ms;
+  };
+
+  let on = 0;
+  let segOn = false;
+  let lastMs = 0;
+  let phase = 0;
+  let e = 0;
+  let s = 0;
+  const nextInstant = () => {
+    let at = e < edges.length ? edges[e].time : Infinity;
+    if (s < segments.length) at = Math.min(at, segOn ? segments[s].endMs : segments[s].startMs);
+    return at;
+  };
+  for (let now = nextInstant(); now !== Infinity; now = nextInstant()) {
+    const onBefore = on;
+    const segBefore = segOn;
+    const before = (on | (segOn ? MOTOR_BIT : 0)) >>> 0;
+    addOnTime(before, now - lastMs);
+    lastMs = now;
+    while (phase + 1 < phases.length && phases[phase + 1].startMs <= now) phase++;
+
+    let switched = 0;
+    for (; e < edges.length && edges[e].time === now; e++) {
+      on = ((on & ~edges[e].set) | edges[e].clear) >>> 0;
+      switched |= edges[e].set | edges[e].clear;
+    }
+    while (s < segments.length) {
+      if (segOn && segments[s].endMs === now) {
+        segOn = false;
+        s++;
+      } else if (!segOn && segments[s].startMs === now) {
+        segOn = true;
+      } else {
+        break;
+      }
+    }
+    const after = (on | (segOn ? MOTOR_BIT : 0)) >>> 0;
+
+    if (switched & DIR_BIT && before & MOTOR_BIT && after & MOTOR_BIT) {
+      conflicts.push({ timeMs: now, phase, what: "Motor Direction switched while the motor runs" });
+    }
+    const clash = segOn ? on & (MOTOR_BIT | DIR_BIT) : 0;
+    const clashed = segBefore ? onBefore & (MOTOR_BIT | DIR_BIT) : 0;
+    if (clash & ~clashed & MOTOR_BIT) {
+      conflicts.push({ timeMs: now, phase, what: "Motor held ON by the program during a motor pattern" });
+    }
+    if (clash & ~clashed & DIR_BIT) {
+      conflicts.push({ timeMs: now, phase, what: "Motor Direction held ON by the program during a motor pattern" });
+    }
+    for (const f of FORBIDDEN) {
+      if ((after & f.mask) >>> 0 === f.mask && (before & f.mask) >>> 0 !== f.mask) {
+        conflicts.push({ timeMs: now, phase, what: f.what });
+      }
+    }
+  }
+  if (totalMs > lastMs) addOnTime((on | (segOn ? MOTOR_BIT : 0)) >>> 0, totalMs - lastMs);
+  return { totalMs, onMs, conflicts };
+}
+
+module.exports = { FORBIDDEN, checkProgram };
@@ -0,0 +1,93 @@
+// Packs several compiled programs into one library.bin for the program
+// partition. Layout mirrors main/program_library.h; keep the two in sync.
+
+const fs = require("fs");
+const path = require("path");
+const { crc32, buildProgramBinary } = require("./program-binary");
+
+const MAGIC = 0x424c5943; // "CYLB"
+const VERSION = 1;
+const HEADER_SIZE = 16;
+const CRC_OFFSET = 12;
+const ENTRY_SIZE = 32;
+const PROGRAM_MAGIC = 0x504f5943; // "CYOP", input.bin
+const PROGRAM_CRC_OFFSET = 36;
+const NAME_LEN = 24;
+
+function align4(n) {
+  return (n + 3) & ~3;
+}
+
+// [{ name, jsonText }] -> { binary, programs: [{ id, name, bytes, totalMs }] }.
+// A program's ID is its position in the list.
+function buildProgramLibrary(sources) {
+  if (sources.length === 0 || sources.length > 0xffff) {
+    throw new Error("a library holds 1 to 65535 programs");
+  }
+  const programs = sources.map((src, id) => {
+    const name = Buffer.from(src.name, "utf8");
+    if (name.length >= NAME_LEN) {
+      throw new Error(`program name "${src.name}" is longer than ${NAME_LEN - 1} bytes`);
+    }
+    let built;
+    try {
+      built = buildProgramBinary(src.jsonText);
+    } catch (err) {
+      throw new Error(`${src.name}: ${err.message}`);
+    }
+    return { id, name: src.name, nameBytes: name, binary: built.binary, totalMs: built.compiled.totalMs };
+  });
+
+  let off = HEADER_SIZE + programs.length * ENTRY_SIZE;
+  for (const p of programs) {
+    off = align4(off);
+    p.offset = off;
+    off += p.binary.length;
+  }
+  const buf = Buffer.alloc(off);
+  buf.writeUInt32LE(MAGIC, 0);
+  buf.writeUInt16LE(VERSION, 4);
+  buf.writeUInt16LE(programs.length, 6);
+  buf.writeUInt32LE(buf.length, 8);
+  programs.forEach((p, i) => {
+    const entry = HEADER_SIZE + i * ENTRY_SIZE;
+    buf.writeUInt32LE(p.offset, entry);
+    buf.writeUInt32LE(p.binary.length, entry + 4);
+    p.nameBytes.copy(buf, entry + 8);
+    p.binary.copy(buf, p.offset);
+  });
+
+  let crc = crc32(buf.subarray(0, CRC_OFFSET));
+  crc = crc32(buf.subarray(HEADER_SIZE), crc);
+  buf.writeUInt32LE(crc, CRC_OFFSET);
+
+  return {
+    binary: buf,
+    programs: programs.map((p) => ({ id: p.id, name: p.name, bytes: p.binary.length, totalMs: p.totalMs })),
+  };
+}
+
+// Identity of an input.bin or library.bin image: its header CRC, which
+// covers the whole image, as 8 hex digits. The board reports the same for
+// the image it holds (GET /program), so an unchanged image need not be
+// sent again.
+function imageId(binary) {
+  const magic = binary.readUInt32LE(0);
+  if (magic === MAGIC) return binary.readUInt32LE(CRC_OFFSET).toString(16).padStart(8, "0");
+  if (magic === PROGRAM_MAGIC) return binary.readUInt32LE(PROGRAM_CRC_OFFSET).toString(16).padStart(8, "0");
+  throw new Error("not a program or library image");
+}
+
+// Every *.json in `dir`, by file name; the name without .json names the program.
+function buildLibraryFromDir(dir) {
+  const files = fs.readdirSync(dir).filter((f) => f.endsWith(".json")).sort();
+  return buildProgramLibrary(
+    files.map((f) => ({ name: path.basename(f, ".json"), jsonText: fs.readFileSync(path.join(dir, f), "utf8") }))
+  );
+}
+
+module.exports = {
+  imageId,
+  buildProgramLibrary,
+  buildLibraryFromDir,
+};
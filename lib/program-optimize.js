@@ -0,0 +1,259 @@
+// Cycle optimizer: finds time a program spends waiting and proposes a
+// compacted input.json with a shorter cycle, plus a report of the time
+// saved per phase to review before deploying it (PUT /api/input).
+//
+// What it looks for, on the compiled timeline (lib/program-binary.js):
+//   startDelay   a phase's startTime above the previous one's, which the
+//                firmware adds before the phase (program_compile()); like
+//                idle gaps usually a deliberate wait, so only applied when
+//                asked for
+//   leadingIdle  a phase whose components all start late
+//   idleGap      a stretch inside a phase with nothing running, longer
+//                than PHASE_GAP_MS; often a deliberate soak, so only
+//                applied when asked for
+//   overlapNext  the next phase could start while the last components of
+//                this one are still running, as long as it shares no
+//                output, forbidden pair (lib/program-check.js) or the
+//                motor with them. The two are merged into one phase, the
+//                next one's components moved to where they can start plus
+//                whatever startDelay it still has.
+// Every step is compiled and checked again and kept only if it compiles
+// and adds no conflict. Phases that end on a sensor (endOn) are never
+// merged: their real end is not known in advance.
+
+const { COMPONENTS, compileProgram } = require("./program-binary");
+const { FORBIDDEN, checkProgram } = require("./program-check");
+
+const PHASE_GAP_MS = 50;
+const DEFAULTS = { startDelays: false, leadingIdle: true, idleGaps: false, overlap: true };
+
+const MOTOR_COMPONENTS = ["Motor", "Motor Direction"];
+const nameOf = (index) => COMPONENTS[index].name;
+
+// Same clamping as the loaders: missing or negative -> 0.
+function ms(value) {
+  const v = Number(value);
+  return Number.isFinite(v) && v > 0 ? Math.min(Math.floor(v), 0xffffffff) : 0;
+}
+
+// Two components that must not run at the same time, and need
+// PHASE_GAP_MS between them.
+function clash(a, b) {
+  const na = nameOf(a.component);
+  const nb = nameOf(b.component);
+  if (na === nb) return true;
+  const motor = (c, n) => c.runningStyle !== 0 || MOTOR_COMPONENTS.includes(n);
+  if (motor(a, na) && motor(b, nb)) return true;
+  return FORBIDDEN.some((f) => f.components.includes(na) && f.components.includes(nb));
+}
+
+// The delay each phase's startTime adds before it (program_compile()).
+function startDelays(phases) {
+  let prev = 0;
+  return phases.map((p) => {
+    const st = ms(p.startTime);
+    const delay = Math.max(0, st - prev);
+    prev = st;
+    return delay;
+  });
+}
+
+// Rewrite the startTimes so that phase i is delayed by delays[i].
+function setStartDelays(phases, delays) {
+  let st = 0;
+  phases.forEach((p, i) => {
+    st += delays[i];
+    p.startTime = st;
+  });
+}
+
+const hasTrigger = (phaseJson) =>
+  !!phaseJson.endOn || (phaseJson.components || []).some((c) => !!c.endOn);
+
+// Components of compiled phase `ph` that run, relative to the phase start.
+function windows(compiled, ph) {
+  return compiled.components
+    .slice(ph.firstComponent, ph.firstComponent + ph.numComponents)
+    .filter((c) => c.duration > 0)
+    .map((c) => ({ ...c, end: c.start + c.duration }));
+}
+
+// Compile and check; null if it does not compile.
+function evaluate(phases) {
+  try {
+    const compiled = compileProgram(phases);
+    return { compiled, conflicts: checkProgram(compiled).conflicts.length };
+  } catch (err) {
+    return null;
+  }
+}
+
+// `phasesJson` is input.json's array of phases; it is not modified.
+// Returns { program, report }: the compacted phases, and what was found
+// per phase of the original program with the time each change saved.
+function optimizeProgram(phasesJson, options = {}) {
+  const opts = { ...DEFAULTS, ...options };
+  let phases = JSON.parse(JSON.stringify(phasesJson));
+  const start = evaluate(phases);
+  if (!start) {
+    compileProgram(phases); // throws the reason
+  }
+  const report = start.compiled.phases.map((ph, i) => ({
+    index: i,
+    id: phases[i].id,
+    name: phases[i].name,
+    startMs: ph.startMs,
+    durationMs: ph.durationMs,
+    savedMs: 0,
+    findings: [],
+  }));
+  const origin = phases.map((p, i) => i); // original index of each working phase
+  let current = start;
+
+  // Keep `next` if it compiles, adds no conflict and is shorter, and mark
+  // `findings` applied. A single finding is credited the exact saving.
+  const attempt = (next, findings) => {
+    const result = evaluate(next);
+    const reason = !result
+      ? "would not compile"
+      : result.conflicts > current.conflicts
+        ? "would add a conflict"
+        : result.compiled.totalMs >= current.compiled.totalMs
+          ? "saves nothing"
+          : null;
+    for (const f of findings) {
+      if (reason) f.reason = reason;
+      else f.applied = true;
+    }
+    if (reason) return false;
+    if (findings.length === 1) findings[0].ms = current.compiled.totalMs - result.compiled.totalMs;
+    phases = next;
+    current = result;
+    return true;
+  };
+  const note = (i, finding) => {
+    const list = report[origin[i]].findings;
+    list.push({ kind: finding.kind, applied: false, ...finding });
+    return list[list.length - 1];
+  };
+  const copy = () => JSON.parse(JSON.stringify(phases));
+
+  // 1) Delays from increasing startTime.
+  startDelays(phases).forEach((delay, i) => {
+    if (!delay) return;
+    const finding = note(i, { kind: "startDelay", ms: delay });
+    if (opts.startDelays) {
+      const next = copy();
+      const delays = startDelays(next);
+      delays[i] = 0;
+      setStartDelays(next, delays);
+      attempt(next, [finding]);
+    }
+  });
+
+  // 2) and 3) Idle time at the start of, and inside, each phase.
+  for (let i = 0; i < phases.length; i++) {
+    const lead = Math.min(...windows(current.compiled, current.compiled.phases[i]).map((r) => r.start));
+    if (lead > 0 && lead !== Infinity) {
+      const finding = note(i, { kind: "leadingIdle", ms: lead });
+      if (opts.leadingIdle) {
+        const next = copy();
+        for (const c of next[i].components) c.start = Math.max(0, ms(c.start) - lead);
+        attempt(next, [finding]);
+      }
+    }
+
+    // Gaps between the stretches where something runs, each cut down to
+    // PHASE_GAP_MS; a component moves up by the cuts before its start.
+    const runs = windows(current.compiled, current.compiled.phases[i]).sort((a, b) => a.start - b.start);
+    const gaps = [];
+    let busyUntil = runs.length ? runs[0].end : 0;
+    for (const r of runs.slice(1)) {
+      if (r.start - busyUntil > PHASE_GAP_MS) {
+        const finding = note(i, { kind: "idleGap", atMs: busyUntil, ms: r.start - busyUntil - PHASE_GAP_MS });
+        gaps.push({ until: r.start, finding });
+      }
+      busyUntil = Math.max(busyUntil, r.end);
+    }
+    if (gaps.length && opts.idleGaps) {
+      const next = copy();
+      for (const c of next[i].components) {
+        const start = ms(c.start);
+        c.start = start - gaps.filter((g) => g.until <= start).reduce((sum, g) => sum + g.finding.ms, 0);
+      }
+      attempt(next, gaps.map((g) => g.finding));
+    }
+  }
+
+  // 4) Start the next phase while the end of this one is still running:
+  //    once every component of this phase has started, and PHASE_GAP_MS
+  //    after whatever it clashes with. A startDelay the next phase still
+  //    has (step 1 not applied) is kept in front of its components, so only
+  //    the overlap itself is saved.
+  for (let i = 0; i + 1 < phases.length; ) {
+    const a = current.compiled.phases[i];
+    const b = current.compiled.phases[i + 1];
+    const delay = startDelays(phases)[i + 1];
+    const offset = b.startMs - a.startMs - delay;
+    const first = windows(current.compiled, a);
+    let at = Math.max(0, ...first.map((x) => x.start));
+    for (const x of first) {
+      for (const y of windows(current.compiled, b)) {
+        if (clash(x, y)) at = Math.max(at, x.end + PHASE_GAP_MS - y.start);
+      }
+    }
+    if (at >= offset) {
+      i++;
+      continue;
+    }
+    const finding = note(i, {
+      kind: "overlapNext",
+      ms: offset - at,
+      next: phases[i + 1].id,
+      nextStartsAtMs: at + delay,
+    });
+    if (hasTrigger(phases[i]) || hasTrigger(phases[i + 1])) {
+      finding.reason = "ends on a sensor";
+      i++;
+      continue;
+    }
+    if (!opts.overlap) {
+      i++;
+      continue;
+    }
+    // The merged phase keeps this one's delay; the phases after it keep theirs.
+    const next = copy();
+    const delays = startDelays(next);
+    delays.splice(i + 1, 1);
+    const merged = next[i];
+    merged.name = [merged.name, next[i + 1].name].filter(Boolean).join(" + ");
+    merged.components = [
+      ...(merged.components || []),
+      ...(next[i + 1].components || []).map((c) => ({ ...c, start: ms(c.start) + at + delay })),
+    ];
+    next.splice(i + 1, 1);
+    setStartDelays(next, delays);
+    if (attempt(next, [finding])) {
+      report[origin[i + 1]].mergedInto = phases[i].id;
+      origin.splice(i + 1, 1); // then try the phase after with the merged one
+    } else {
+      i++;
+    }
+  }
+
+  for (const r of report) r.savedMs = r.findings.reduce((sum, f) => sum + (f.applied ? f.ms : 0), 0);
+  return {
+    program: phases,
+    report: {
+      totalMs: start.compiled.totalMs,
+      optimizedMs: current.compiled.totalMs,
+      savedMs: start.compiled.totalMs - current.compiled.totalMs,
+      phases: { before: start.compiled.phases.length, after: current.compiled.phases.length },
+      conflicts: { before: start.conflicts, after: current.conflicts },
+      options: opts,
+      perPhase: report,
+    },
+  };
+}
+
+module.exports = { optimizeProgram };
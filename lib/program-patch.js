@@ -0,0 +1,164 @@
+// Patches for the program a board already runs (main/program_patch.h): a
+// UI edit that only retimes phases or components goes to the board as the
+// new timing of the phases it touched, and the board recompiles just
+// those. Anything that changes the structure of the program needs a full
+// upload instead.
+
+const { crc32 } = require("./program-binary");
+
+const PATCH_MAGIC = 0x54505943; // "CYPT"
+const PATCH_VERSION = 1;
+const PATCH_HEADER_SIZE = 20;
+const PATCH_PHASE_SIZE = 8;
+const PATCH_COMPONENT_SIZE = 16;
+const PATCH_MAX_SIZE = 2048; // PROGRAM_PATCH_MAX_SIZE
+
+// input.bin layout, as in lib/program-binary.js.
+const HEADER_SIZE = 40;
+const PHASE_SIZE = 16;
+const COMPONENT_SIZE = 24;
+
+// Fields an edit may change; anything else is refused.
+const PHASE_FIELDS = ["startTime", "components"];
+const COMPONENT_FIELDS = ["start", "duration", "motorConfig"];
+const MOTOR_FIELDS = ["stepTime", "pauseTime"];
+
+// Thrown when the edit cannot go out as a patch; `status` is the HTTP
+// status for it.
+class PatchError extends Error {
+  constructor(message, status) {
+    super(message);
+    this.status = status;
+  }
+}
+
+// The firmware's program_hash() of an input.bin: CRC-32 over total_ms, the
+// phases, and everything from the edges on.
+function programHash(binary) {
+  const pinBytes = (binary.readUInt16LE(8) + 3) & ~3;
+  const phases = HEADER_SIZE + pinBytes;
+  const edges = phases + binary.readUInt16LE(10) * PHASE_SIZE + binary.readUInt32LE(12) * COMPONENT_SIZE;
+  let crc = crc32(binary.subarray(20, 24));
+  crc = crc32(binary.subarray(phases, phases + binary.readUInt16LE(10) * PHASE_SIZE), crc);
+  return crc32(binary.subarray(edges), crc);
+}
+
+function checkObject(what, obj, allowed) {
+  if (!obj || typeof obj !== "object" || Array.isArray(obj)) {
+    throw new PatchError(`${what}: expected an object`, 400);
+  }
+  const extra = allowed ? Object.keys(obj).filter((k) => !allowed.includes(k)) : [];
+  if (extra.length) {
+    throw new PatchError(`${what}: only timing can be patched, not ${extra.join(", ")}`, 400);
+  }
+}
+
+// Copy the numeric fields of `edit` named in `fields` onto `target`.
+function assignTimes(what, target, edit, fields) {
+  for (const k of fields) {
+    if (edit[k] === undefined) continue;
+    if (typeof edit[k] !== "number" || !(edit[k] >= 0)) {
+      throw new PatchError(`${what}: ${k} must be a number >= 0`, 400);
+    }
+    target[k] = edit[k];
+  }
+}
+
+// Apply `edits` to input.json's phases, by the "id" of each phase and
+// component:
+//   { "phase_a": { "startTime": 0, "components": {
+//       "1752779020217": { "duration": 4000, "motorConfig": { "stepTime": 900 } } } } }
+// Returns a new array; `phasesJson` is left alone.
+function applyEdits(phasesJson, edits) {
+  checkObject("edits", edits);
+  const result = JSON.parse(JSON.stringify(phasesJson));
+  for (const [phaseId, edit] of Object.entries(edits)) {
+    const phase = result.find((p) => p.id === phaseId);
+    if (!phase) throw new PatchError(`no phase "${phaseId}"`, 404);
+    checkObject(`phase "${phaseId}"`, edit, PHASE_FIELDS);
+    assignTimes(`phase "${phaseId}"`, phase, edit, ["startTime"]);
+    if (edit.components === undefined) continue;
+    checkObject(`phase "${phaseId}" components`, edit.components);
+
+    for (const [compId, compEdit] of Object.entries(edit.components)) {
+      const comp = (phase.components || []).find((c) => c.id === compId);
+      if (!comp) throw new PatchError(`no component "${compId}" in phase "${phaseId}"`, 404);
+      const what = `component "${compId}"`;
+      checkObject(what, compEdit, COMPONENT_FIELDS);
+      assignTimes(what, comp, compEdit, ["start", "duration"]);
+      if (compEdit.motorConfig === undefined) continue;
+      checkObject(`${what} motorConfig`, compEdit.motorConfig, MOTOR_FIELDS);
+      if (!comp.motorConfig || typeof comp.motorConfig !== "object") {
+        throw new PatchError(`${what} has no motorConfig to retime`, 409);
+      }
+      assignTimes(`${what} motorConfig`, comp.motorConfig, compEdit.motorConfig, MOTOR_FIELDS);
+    }
+  }
+  return result;
+}
+
+const sameJson = (a, b) => JSON.stringify(a) === JSON.stringify(b);
+
+// The patch that turns the program compiled as `before` (input.bin
+// `beforeBinary`) into the one compiled as `after`: { patch, phases } with
+// the indices of the phases it retimes, or null if none changed.
+// `sourceCrc` is the CRC-32 of the edited input.json. Throws a PatchError
+// (409) if the two differ in more than timing, e.g. a motorConfig that no
+// longer runs and falls back to a plain output.
+function buildPatch(beforeBinary, before, after, sourceCrc) {
+  const shape = (c) => [c.component, c.runningStyle, c.ccw, c.firstStep, c.numSteps];
+  if (
+    before.phases.length !== after.phases.length ||
+    before.phases.some((p, i) => p.numComponents !== after.phases[i].numComponents) ||
+    !sameJson(before.components.map(shape), after.components.map(shape)) ||
+    !sameJson(before.steps, after.steps) ||
+    !sameJson(before.triggers, after.triggers)
+  ) {
+    throw new PatchError("the edit changes the structure of the program; it needs a full upload", 409);
+  }
+
+  const timing = (c) => [c.start, c.duration, c.stepTime, c.pauseTime];
+  const changed = after.phases
+    .map((p, i) => i)
+    .filter((i) => {
+      const p = after.phases[i];
+      const comps = (list) => list.slice(p.firstComponent, p.firstComponent + p.numComponents).map(timing);
+      return p.startTime !== before.phases[i].startTime || !sameJson(comps(before.components), comps(after.components));
+    });
+  if (!changed.length) return null;
+
+  const size =
+    PATCH_HEADER_SIZE +
+    changed.reduce((n, i) => n + PATCH_PHASE_SIZE + after.phases[i].numComponents * PATCH_COMPONENT_SIZE, 0);
+  if (size > PATCH_MAX_SIZE) {
+    throw new PatchError(`the patch would be ${size} bytes (over ${PATCH_MAX_SIZE}); it needs a full upload`, 409);
+  }
+  const buf = Buffer.alloc(size);
+  buf.writeUInt32LE(PATCH_MAGIC, 0);
+  buf.writeUInt16LE(PATCH_VERSION, 4);
+  buf.writeUInt16LE(changed.length, 6);
+  buf.writeUInt32LE(programHash(beforeBinary), 8);
+  buf.writeUInt32LE(sourceCrc >>> 0, 12);
+  let off = PATCH_HEADER_SIZE;
+  for (const i of changed) {
+    const p = after.phases[i];
+    buf.writeUInt16LE(i, off);
+    buf.writeUInt16LE(p.numComponents, off + 2);
+    buf.writeUInt32LE(p.startTime, off + 4);
+    off += PATCH_PHASE_SIZE;
+    for (let j = 0; j < p.numComponents; j++) {
+      const c = after.components[p.firstComponent + j];
+      buf.writeUInt32LE(c.start, off);
+      buf.writeUInt32LE(c.duration, off + 4);
+      buf.writeUInt32LE(c.stepTime, off + 8);
+      buf.writeUInt32LE(c.pauseTime, off + 12);
+      off += PATCH_COMPONENT_SIZE;
+    }
+  }
+  let crc = crc32(buf.subarray(0, 16));
+  crc = crc32(buf.subarray(PATCH_HEADER_SIZE), crc);
+  buf.writeUInt32LE(crc, 16);
+  return { patch: buf, phases: changed };
+}
+
+module.exports = { PatchError, programHash, applyEdits, buildPatch, PATCH_MAX_SIZE };
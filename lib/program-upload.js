@@ -0,0 +1,172 @@
+// Program uploads to a running board.
+//
+// uploadProgram: hot reload over the serial console. Sends "load <bytes>"
+// followed by an input.bin image and waits for the firmware's LOAD OK /
+// LOAD ERR line (main/control.c). The new program starts once the current
+// cycle ends.
+//
+// uploadPatch / pushPatch: the same over serial ("patch <bytes>") and
+// HTTP (PATCH /program) for a patch of the running program
+// (lib/program-patch.js). It is staged like a hot reload; the board does
+// not restart and its partition keeps the full image it had.
+//
+// pushProgram: PUT /program to the board's own HTTP server
+// (CONFIG_CYCLE_HTTP_UPLOAD, main/program_http.h). The board installs the
+// image, or a library.bin, and restarts into it.
+// It first asks the board which image it holds (GET /program) and sends
+// nothing when that is already this one, unless `force` is set. A board in
+// the middle of a cycle answers 409 (err.busy): push again between cycles.
+//
+// PUT and PATCH carry the board's CONFIG_CYCLE_HTTP_TOKEN, `token` or
+// DEVICE_TOKEN in the environment; a board that does not take it answers
+// 401 (err.unauthorized).
+
+const { SerialPort } = require("serialport");
+const { ReadlineParser } = require("@serialport/parser-readline");
+const { imageId } = require("./program-library");
+
+const authHeaders = (token) => (token ? { Authorization: `Bearer ${token}` } : {});
+
+const WAKE_MS = 20; // CONFIG_CYCLE_LIGHT_SLEEP: time to wake up and drop the line
+
+// Send "<command> <bytes>" and `payload` over the console and wait for
+// the firmware's "<TAG> OK ..." / "<TAG> ERR ..." line; resolves with the
+// fields after OK.
+function sendToConsole(portPath, command, tag, payload, { baudRate = 115200, timeoutMs = 5000 } = {}) {
+  return new Promise((resolve, reject) => {
+    // hupcl off and DTR/RTS released so opening the port does not reset the board.
+    const port = new SerialPort({ path: portPath, baudRate, hupcl: false, autoOpen: false });
+    const parser = port.pipe(new ReadlineParser({ delimiter: "\n" }));
+    const started = Date.now();
+    let done = false;
+
+    const finish = (err, result) => {
+      if (done) return;
+      done = true;
+      clearTimeout(timer);
+      if (port.isOpen) port.close();
+      if (err) reject(err);
+      else resolve(result);
+    };
+    const timer = setTimeout(() => finish(new Error("no reply from the device")), timeoutMs);
+
+    port.on("error", (err) => finish(err));
+    parser.on("data", (raw) => {
+      const line = raw.trim();
+      const at = line.indexOf(`${tag} `);
+      if (at < 0) return; // log output
+      const reply = line.slice(at + tag.length + 1).split(" ");
+      if (reply[0] === "OK") {
+        finish(null, { fields: reply.slice(1), elapsedMs: Date.now() - started });
+      } else {
+        const err = new Error(reply.slice(1).join(" ") || line);
+        err.rejected = true;
+        finish(err);
+      }
+    });
+
+    port.open((err) => {
+      if (err) return finish(err);
+      port.set({ dtr: false, rts: false }, () => {
+        // A board in light sleep loses what wakes it; the empty line is
+        // ignored by one that is awake.
+        port.write("\n");
+        setTimeout(() => {
+          port.write(`${command} ${payload.length}\n`);
+          port.write(payload);
+        }, WAKE_MS);
+      });
+    });
+  });
+}
+
+async function uploadProgram(portPath, binary, options) {
+  const { fields, elapsedMs } = await sendToConsole(portPath, "load", "LOAD", binary, options);
+  return { phases: Number(fields[0]), edges: Number(fields[1]), totalMs: Number(fields[2]), elapsedMs };
+}
+
+// Resolves like pushPatch(); `image` is what a full upload would carry.
+async function uploadPatch(portPath, patch, options) {
+  let reply;
+  try {
+    reply = await sendToConsole(portPath, "patch", "PATCH", patch, options);
+  } catch (err) {
+    err.conflict = err.message === "ESP_ERR_INVALID_STATE"; // see pushPatch()
+    err.busy = err.message === "busy";
+    throw err;
+  }
+  const { fields, elapsedMs } = reply;
+  return {
+    status: "staged",
+    phases: Number(fields[0]),
+    edges: Number(fields[1]),
+    totalMs: Number(fields[2]),
+    image: fields[3],
+    elapsedMs,
+  };
+}
+
+const QUERY_TIMEOUT_MS = 3000;
+
+// The board's { image, running, staged, restartPending }, or null from
+// firmware without GET /program. `image` is the one installed in the
+// partition; `running` the one cycles run now, which a patch, a console
+// load or a library selection changes without installing anything.
+async function queryImage(host) {
+  const response = await fetch(`http://${host}/program`, { signal: AbortSignal.timeout(QUERY_TIMEOUT_MS) });
+  return response.ok ? response.json().catch(() => null) : null;
+}
+
+async function pushProgram(host, binary, { timeoutMs = 30000, force = false, token = process.env.DEVICE_TOKEN } = {}) {
+  const started = Date.now();
+  const image = imageId(binary);
+  if (!force) {
+    const held = await queryImage(host).catch(() => null);
+    // Installed is not enough: the board must also run it, or be about to
+    // restart into it.
+    const applied = held && (held.restartPending || (held.running === image && !held.staged));
+    if (held && held.image === image && applied) {
+      return { status: "unchanged", image, skipped: true, device: held, elapsedMs: Date.now() - started };
+    }
+  }
+  const response = await fetch(`http://${host}/program`, {
+    method: "PUT",
+    headers: { "Content-Type": "application/octet-stream", ...authHeaders(token) },
+    body: binary,
+    signal: AbortSignal.timeout(timeoutMs),
+  });
+  const device = await response.json().catch(() => ({}));
+  if (!response.ok) {
+    const err = new Error(device.error || response.statusText);
+    err.rejected = true; // the board answered and refused the program
+    err.busy = response.status === 409;
+    err.unauthorized = response.status === 401;
+    throw err;
+  }
+  return { ...device, image, skipped: false, elapsedMs: Date.now() - started };
+}
+
+// A board running another program than the patch was made for answers
+// 409; err.conflict tells the caller to send the whole program instead.
+// One taking a console "load" at the same time answers 503 (err.busy).
+async function pushPatch(host, patch, { timeoutMs = 10000, token = process.env.DEVICE_TOKEN } = {}) {
+  const started = Date.now();
+  const response = await fetch(`http://${host}/program`, {
+    method: "PATCH",
+    headers: { "Content-Type": "application/octet-stream", ...authHeaders(token) },
+    body: patch,
+    signal: AbortSignal.timeout(timeoutMs),
+  });
+  const device = await response.json().catch(() => ({}));
+  if (!response.ok) {
+    const err = new Error(device.error || response.statusText);
+    err.rejected = true;
+    err.conflict = response.status === 409;
+    err.busy = response.status === 503;
+    err.unauthorized = response.status === 401;
+    throw err;
+  }
+  return { ...device, elapsedMs: Date.now() - started };
+}
+
+module.exports = { uploadProgram, uploadPatch, pushProgram, pushPatch };
@@ -0,0 +1,202 @@
+#include "checkpoint.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include "crc32.h"
+#include "scheduler.h"
+#include "tasks.h"
+
+static const char* TAG = "CHECKPOINT";
+
+#define NVS_NAMESPACE   "cycle"
+#define SLOTS           CONFIG_CYCLE_CHECKPOINT_SLOTS
+#define PERIOD_MS       ((int64_t)CONFIG_CYCLE_CHECKPOINT_PERIOD_S * 1000)
+#define TICK_MS         1000      // also the shortest gap between two records
+#define QUIET_MS        50        // no scheduler work this close to a write
+#define TASK_STACK      3072
+
+typedef enum {
+    STATE_IDLE = 0,
+    STATE_RUNNING,
+    STATE_PAUSED,
+} CheckpointState;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t program;
+    uint32_t elapsed_ms;
+    uint16_t phase;
+    uint16_t state;           // CheckpointState
+    uint32_t crc;             // of everything before it
+} CheckpointRecord;
+
+static nvs_handle_t      s_nvs;
+static SemaphoreHandle_t s_write_lock = NULL;
+static CheckpointRecord  s_last;              // newest record, read at boot, then written
+static int               s_slot = SLOTS - 1;  // key holding s_last
+static uint32_t          s_program = 0;       // program_hash() of the cycle followed
+static volatile bool     s_following = false;
+
+static void slot_key(int slot, char* key, size_t len) {
+    snprintf(key, len, "cp%d", slot);
+}
+
+static uint32_t record_crc(const CheckpointRecord* r) {
+    return crc32_update(0, r, offsetof(CheckpointRecord, crc));
+}
+
+// Newest intact record of the ring, by sequence number (which may wrap).
+static void read_ring(void) {
+    bool found = false;
+    for (int slot = 0; slot < SLOTS; slot++) {
+        char key[8];
+        slot_key(slot, key, sizeof(key));
+        CheckpointRecord r;
+        size_t len = sizeof(r);
+        if (nvs_get_blob(s_nvs, key, &r, &len) != ESP_OK || len != sizeof(r) || r.crc != record_crc(&r)) {
+            continue;
+        }
+        if (!found || (int32_t)(r.seq - s_last.seq) > 0) {
+            s_last = r;
+            s_slot = slot;
+            found  = true;
+        }
+    }
+}
+
+// Append a record in the key after the newest one. A cycle record is
+// dropped if the cycle ended while it waited for the lock.
+static esp_err_t write_record(CheckpointState state, const SchedulerProgress* p) {
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if (state == STATE_IDLE || s_following) {
+        CheckpointRecord r = {
+            .seq        = s_last.seq + 1,
+            .program    = s_program,
+            .elapsed_ms = p ? p->elapsed_ms : 0,
+            .phase      = p ? (uint16_t)p->phase : 0,
+            .state      = state,
+        };
+        r.crc = record_crc(&r);
+        int slot = (s_slot + 1) % SLOTS;
+        char key[8];
+        slot_key(slot, key, sizeof(key));
+        err = nvs_set_blob(s_nvs, key, &r, sizeof(r));
+        if (err == ESP_OK) {
+            err = nvs_commit(s_nvs);
+        }
+        if (err == ESP_OK) {
+            s_last = r;
+            s_slot = slot;
+        }
+    }
+    xSemaphoreGive(s_write_lock);
+    return err;
+}
+
+// Save the running cycle's position once a period, and at once when its
+// phase or pause state changes, between edges.
+static void checkpoint_task(void* arg) {
+    int64_t last_ms = 0;
+    bool    warned  = false;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(TICK_MS));
+        SchedulerProgress p;
+        if (!s_following || !scheduler_progress(&p)) {
+            warned = false;
+            continue;
+        }
+        CheckpointState state = p.paused ? STATE_PAUSED : STATE_RUNNING;
+        int64_t now_ms = esp_timer_get_time() / 1000;
+        bool changed = s_last.program != s_program || s_last.state != state || s_last.phase != p.phase;
+        // A paused cycle does not move.
+        bool due = !p.paused && now_ms - last_ms >= PERIOD_MS;
+        if ((!changed && !due) || p.quiet_ms < QUIET_MS) {
+            continue;
+        }
+        esp_err_t err = write_record(state, &p);
+        if (err == ESP_OK) {
+            last_ms = now_ms;
+        } else if (!warned) {
+            ESP_LOGW(TAG, "Failed to save a checkpoint: %s", esp_err_to_name(err));
+            warned = true;
+        }
+    }
+}
+
+esp_err_t checkpoint_init(void) {
+    if (s_write_lock) {
+        return ESP_OK;
+    }
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    if (err == ESP_OK) {
+        err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &s_nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(err));
+        return err;
+    }
+    read_ring();
+
+    s_write_lock = xSemaphoreCreateMutex();
+    if (!s_write_lock) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(checkpoint_task, "checkpoint", TASK_STACK, NULL,
+                                TASK_PRIO_CHECKPOINT, NULL, TASK_CORE_BG) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create checkpoint task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool checkpoint_pending(const Program* prog, Checkpoint* out) {
+    if (s_last.state == STATE_IDLE) {
+        return false;
+    }
+    if (s_last.program != program_hash(prog)) {
+        ESP_LOGW(TAG, "Interrupted cycle was another program; starting over");
+        return false;
+    }
+    *out = (Checkpoint){
+        .program    = s_last.program,
+        .elapsed_ms = s_last.elapsed_ms,
+        .phase      = s_last.phase,
+        .paused     = s_last.state == STATE_PAUSED,
+    };
+    return true;
+}
+
+void checkpoint_begin(const Program* prog) {
+    if (!s_write_lock) {
+        return;
+    }
+    s_program   = program_hash(prog);
+    s_following = true;
+}
+
+void checkpoint_end(void) {
+    if (!s_write_lock) {
+        return;
+    }
+    s_following = false;
+    if (s_last.state != STATE_IDLE) {
+        esp_err_t err = write_record(STATE_IDLE, NULL);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to clear the checkpoint: %s", esp_err_to_name(err));
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "program.h"
+
+// ------------------------- CYCLE CHECKPOINTS -------------------------
+// With CONFIG_CYCLE_CHECKPOINT the position of the running cycle (program,
+// phase, cycle time reached) is saved to the "nvs" partition, so after a
+// power loss boot carries on from there instead of phase 0.
+//
+// Records go round a ring of CONFIG_CYCLE_CHECKPOINT_SLOTS keys, each
+// with a sequence number and a CRC; the newest intact one wins, so a write
+// cut short by the power loss leaves the one before it. A writer task
+// saves one every CONFIG_CYCLE_CHECKPOINT_PERIOD_S and at every phase
+// change, at most one a second, and only where the scheduler has no edge
+// due for a while: a flash write stalls the CPU.
+
+typedef struct {
+    uint32_t program;         // program_hash()
+    uint32_t elapsed_ms;      // cycle time reached
+    uint16_t phase;
+    bool     paused;
+} Checkpoint;
+
+// Mount NVS, read the newest record and start the writer. Quick enough to
+// run before anything slow at boot.
+esp_err_t checkpoint_init(void);
+
+// The cycle `prog` was running when the power went, if any.
+bool      checkpoint_pending(const Program* prog, Checkpoint* out);
+
+// A cycle of `prog` has started: follow it.
+void      checkpoint_begin(const Program* prog);
+
+// The cycle is over, done or aborted: nothing to carry on from.
+void      checkpoint_end(void);
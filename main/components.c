@@ -0,0 +1,104 @@
+#include "components.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+const ComponentState component_states[NUM_COMPONENTS] = {
+#define COMPONENT_STATE(id, name, pin, inrush)  [COMP_##id] = { name, pin, inrush },
+    CYCLE_COMPONENTS(COMPONENT_STATE)
+#undef COMPONENT_STATE
+};
+
+// Outputs are a uint32_t mask and telemetry stores the index in a byte.
+_Static_assert(NUM_COMPONENTS <= 32, "more components than output mask bits");
+
+#define CHECK_PIN(id, name, pin, inrush)  _Static_assert((pin) >= 0 && (pin) < 32, name " is outside GPIO0..31");
+CYCLE_COMPONENTS(CHECK_PIN)
+#undef CHECK_PIN
+
+#define CHECK_INRUSH(id, name, pin, inrush)  _Static_assert((inrush) > 0 && (inrush) <= 0xFFFF, name " inrush out of range");
+CYCLE_COMPONENTS(CHECK_INRUSH)
+#undef CHECK_INRUSH
+
+// The pins are distinct exactly when adding their bits carries nowhere.
+#define PIN_BIT(id, name, pin, inrush)  | (1ull << (pin))
+#define PIN_SUM(id, name, pin, inrush)  + (1ull << (pin))
+_Static_assert((0 CYCLE_COMPONENTS(PIN_SUM)) == (0 CYCLE_COMPONENTS(PIN_BIT)), "two components share a pin");
+_Static_assert(((0 CYCLE_COMPONENTS(PIN_BIT)) & (1ull << PAUSE_PIN)) == 0, "PAUSE_PIN is also an output");
+#undef PIN_SUM
+
+const SensorState sensor_states[NUM_SENSORS] = {
+#define SENSOR_STATE(id, name, kind, source)  [SENS_##id] = { name, kind, source },
+    CYCLE_SENSORS(SENSOR_STATE)
+#undef SENSOR_STATE
+};
+
+_Static_assert(NUM_SENSORS < SENSOR_NONE, "sensor IDs are stored in a byte");
+
+// On the ESP32-C3 ADC1 channel n is GPIO n, so every sensor owns the GPIO
+// numbered `source`, and none of them may be an output or the pause button.
+#define CHECK_SENSOR(id, name, kind, source)                                                  \
+    _Static_assert((source) >= 0 && (source) < ((kind) == SENSOR_ADC ? 5 : 22),              \
+                   name " is not a usable GPIO or ADC1 channel");                             \
+    _Static_assert(((0 CYCLE_COMPONENTS(PIN_BIT)) & (1ull << (source))) == 0, name " is also an output"); \
+    _Static_assert((source) != PAUSE_PIN, name " is on the pause button");
+CYCLE_SENSORS(CHECK_SENSOR)
+#undef CHECK_SENSOR
+#undef PIN_BIT
+
+// ID + 1 per pin, so unused pins read back as COMPONENT_NONE.
+static const uint8_t s_by_pin[32] = {
+#define PIN_ENTRY(id, name, pin, inrush)  [pin] = COMP_##id + 1,
+    CYCLE_COMPONENTS(PIN_ENTRY)
+#undef PIN_ENTRY
+};
+
+// IDs in name order, built on the first lookup. Only loaders look names
+// up, and they run on one task at a time.
+static uint8_t s_by_name[NUM_COMPONENTS];
+static bool    s_sorted = false;
+
+static void sort_names(void) {
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        int j = i;
+        for (; j > 0 && strcmp(component_states[s_by_name[j - 1]].name, component_states[i].name) > 0; j--) {
+            s_by_name[j] = s_by_name[j - 1];
+        }
+        s_by_name[j] = (uint8_t)i;
+    }
+    s_sorted = true;
+}
+
+uint8_t component_find(const char* name) {
+    if (!s_sorted) {
+        sort_names();
+    }
+    int lo = 0;
+    int hi = NUM_COMPONENTS;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(name, component_states[s_by_name[mid]].name);
+        if (cmp == 0) {
+            return s_by_name[mid];
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return COMPONENT_NONE;
+}
+
+uint8_t component_at_pin(int pin) {
+    return pin >= 0 && pin < 32 ? (uint8_t)(s_by_pin[pin] - 1) : COMPONENT_NONE;
+}
+
+uint8_t sensor_find(const char* name) {
+    for (int i = 0; i < NUM_SENSORS; i++) {
+        if (strcmp(name, sensor_states[i].name) == 0) {
+            return (uint8_t)i;
+        }
+    }
+    return SENSOR_NONE;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "driver/gpio.h"
+#include "main.h"
+
+// ------------------------- COMPONENT TABLE -------------------------
+// Every output the controller can drive, by the name programs use for it.
+// Generated from CYCLE_COMPONENTS in main.h and checked at compile time
+// (one pin per component, all on GPIO0..31). Loaders intern names to a
+// ComponentId once; everything after that indexes by ID.
+
+#define COMPONENT_NONE  0xFF
+
+typedef struct {
+    const char* name;
+    gpio_num_t  pin;
+    uint16_t    inrush_ma;    // drawn from the supply while switching ON
+} ComponentState;
+
+extern const ComponentState component_states[NUM_COMPONENTS];
+
+// ComponentId for `name`, or COMPONENT_NONE. Binary search over the names.
+uint8_t component_find(const char* name);
+
+// ComponentId driving `pin`, or COMPONENT_NONE.
+uint8_t component_at_pin(int pin);
+
+// ------------------------- SENSOR TABLE -------------------------
+// Every input a phase can end on (CYCLE_SENSORS in main.h). Values are
+// read through sensors.h; this table only names them.
+
+#define SENSOR_NONE  0xFF
+
+typedef struct {
+    const char* name;
+    SensorKind  kind;
+    int         source;       // GPIO of a switch, ADC1 channel otherwise
+} SensorState;
+
+extern const SensorState sensor_states[NUM_SENSORS];
+
+// SensorId for `name`, or SENSOR_NONE.
+uint8_t sensor_find(const char* name);
@@ -0,0 +1,530 @@
+#include "control.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "main.h"
+#include "components.h"
+#include "diag.h"
+#include "jitter.h"
+#include "power.h"
+#include "program_flash.h"
+#include "program_patch.h"
+#include "program_slot.h"
+#include "scheduler.h"
+#include "tasks.h"
+#include "telemetry.h"
+
+static const char* TAG = "CONTROL";
+
+#define BUTTON_DEBOUNCE_US    50000     // contact bounce of the pause and select buttons
+#define CONSOLE_LINE_MAX      32
+#define CONSOLE_RX_BUF        256       // must exceed the UART FIFO
+#define CONSOLE_TASK_STACK    3072
+#define LOAD_TIMEOUT_MS       1000      // longest gap inside an upload
+#define SELECT_TASK_STACK     3072
+
+#ifdef CONFIG_ESP_CONSOLE_UART_NUM
+#define CONSOLE_UART  CONFIG_ESP_CONSOLE_UART_NUM
+#else
+#define CONSOLE_UART  UART_NUM_0
+#endif
+
+static SemaphoreHandle_t s_start = NULL;
+
+// The buttons use a level interrupt, which, unlike an edge, also wakes the
+// chip from light sleep (power.h). The handler masks it at the press and a
+// timer unmasks it once the button is found released, so one press is one
+// event however the contact bounces.
+typedef struct {
+    gpio_num_t         pin;
+    void             (*press)(BaseType_t* woken);   // in the interrupt handler
+    esp_timer_handle_t rearm;
+} Button;
+
+static void button_isr(void* arg) {
+    Button* b = arg;
+    gpio_intr_disable(b->pin);
+    BaseType_t woken = pdFALSE;
+    b->press(&woken);
+    esp_timer_start_once(b->rearm, BUTTON_DEBOUNCE_US);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Still held: look again later. Released: take the next press.
+static void button_rearm(void* arg) {
+    Button* b = arg;
+    if (gpio_get_level(b->pin) == 0) {
+        esp_timer_start_once(b->rearm, BUTTON_DEBOUNCE_US);
+    } else {
+        gpio_intr_enable(b->pin);
+    }
+}
+
+// Active low with the internal pull-up.
+static esp_err_t button_init(Button* b) {
+    const gpio_config_t cfg = {
+        .pin_bit_mask = 1ULL << b->pin,
+        .mode         = GPIO_MODE_INPUT,
+        .pull_up_en   = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type    = GPIO_INTR_LOW_LEVEL,
+    };
+    esp_err_t err = gpio_config(&cfg);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const esp_timer_create_args_t args = {
+        .callback        = button_rearm,
+        .arg             = b,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name            = "button",
+    };
+    err = esp_timer_create(&args, &b->rearm);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {    // already installed is fine
+        return err;
+    }
+    err = power_wake_on_low(b->pin);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return gpio_isr_handler_add(b->pin, button_isr, b);
+}
+
+static void pause_press(BaseType_t* woken) {
+    scheduler_command_from_isr(scheduler_paused() ? SCHED_CMD_RESUME : SCHED_CMD_PAUSE, woken);
+}
+
+static Button s_pause = { .pin = PAUSE_PIN, .press = pause_press };
+
+#if CONFIG_CYCLE_PROGRAM_PARTITION && (CONFIG_CYCLE_CONTROL_CONSOLE || CONFIG_CYCLE_SELECT_BUTTON)
+// Stage program `id` of the mapped library for the next cycle and ask for
+// it to start, like a loaded program. `view` (may be NULL) receives it.
+static esp_err_t select_program(int id, Program* view) {
+    Program p;
+    esp_err_t err = program_flash_select(id, &p);
+    if (err == ESP_OK) {
+        err = program_slot_stage(&p, 0);   // no image of its own
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (view) {
+        *view = p;
+    }
+    control_request_start();
+    return ESP_OK;
+}
+#endif
+
+#if CONFIG_CYCLE_SELECT_BUTTON
+static TaskHandle_t s_select_task = NULL;
+
+static void select_press(BaseType_t* woken) {
+    vTaskNotifyGiveFromISR(s_select_task, woken);
+}
+
+static Button s_select = { .pin = CONFIG_CYCLE_SELECT_PIN, .press = select_press };
+
+// Each press steps to the next program of the library, wrapping around.
+static void select_task(void* arg) {
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int count = program_flash_count();
+        if (count < 2) {
+            continue;
+        }
+        int id = (program_flash_selected() + 1) % count;
+        esp_err_t err = select_program(id, NULL);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Cannot select program %d: %s", id, esp_err_to_name(err));
+        }
+    }
+}
+
+static esp_err_t select_pin_init(void) {
+    const int pin = CONFIG_CYCLE_SELECT_PIN;
+    if (pin == PAUSE_PIN || component_at_pin(pin) != COMPONENT_NONE) {
+        ESP_LOGE(TAG, "CONFIG_CYCLE_SELECT_PIN %d is already in use", pin);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (xTaskCreatePinnedToCore(select_task, "select", SELECT_TASK_STACK, NULL,
+                                TASK_PRIO_SELECT, &s_select_task, TASK_CORE_BG) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return button_init(&s_select);
+}
+#endif
+
+#if CONFIG_CYCLE_CONTROL_CONSOLE
+// Read exactly `len` bytes, or fewer if the sender goes quiet. With
+// `dst` NULL the bytes are just drained so they are not taken as commands.
+static size_t read_exact(uint8_t* dst, size_t len) {
+    uint8_t scratch[64];
+    size_t got = 0;
+    while (got < len) {
+        size_t want = len - got;
+        uint8_t* p = dst ? dst + got : scratch;
+        if (!dst && want > sizeof(scratch)) {
+            want = sizeof(scratch);
+        }
+        int n = uart_read_bytes(CONSOLE_UART, p, want, pdMS_TO_TICKS(LOAD_TIMEOUT_MS));
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    return got;
+}
+
+// "load <bytes>" followed by that many bytes of input.bin. The result is
+// one machine-readable line for the uploader (lib/program-upload.js):
+//   LOAD OK <phases> <edges> <cycle ms>   or   LOAD ERR <reason>
+static void load_program(const char* arg) {
+    char* end;
+    unsigned long size = strtoul(arg, &end, 10);
+    if (size == 0 || *end != '\0') {
+        printf("LOAD ERR usage: load <bytes>\n");
+        return;
+    }
+
+    uint8_t* buf = NULL;
+    esp_err_t begun = program_slot_begin(size, &buf);
+    size_t got = read_exact(begun == ESP_OK ? buf : NULL, size);
+    const char* why = NULL;
+    const Program* staged = NULL;
+    if (begun != ESP_OK) {
+        why = begun == ESP_ERR_INVALID_SIZE ? "too large"
+            : begun == ESP_ERR_NOT_FINISHED ? "busy" : esp_err_to_name(begun);
+    } else if (got < size) {
+        program_slot_abort();
+        why = "timeout";
+    } else {
+        esp_err_t err = program_slot_commit(size, &staged);
+        why = err == ESP_OK ? NULL : esp_err_to_name(err);
+    }
+
+    if (why) {
+        printf("LOAD ERR %s\n", why);
+        return;
+    }
+    printf("LOAD OK %d %d %lu\n", staged->num_phases, staged->num_edges, (unsigned long)staged->total_ms);
+    control_request_start();
+}
+
+// "patch <bytes>" followed by that many bytes of a program patch
+// (program_patch.h), applied to the running program for the next cycle:
+//   PATCH OK <phases> <edges> <cycle ms> <image crc>   or   PATCH ERR <reason>
+static void patch_program(const char* arg) {
+    static uint8_t patch[PROGRAM_PATCH_MAX_SIZE];   // console task only
+    char* end;
+    unsigned long size = strtoul(arg, &end, 10);
+    if (size == 0 || *end != '\0') {
+        printf("PATCH ERR usage: patch <bytes>\n");
+        return;
+    }
+
+    bool fits = size <= sizeof(patch);
+    size_t got = read_exact(fits ? patch : NULL, size);
+    const char* why = NULL;
+    const Program* staged = NULL;
+    uint32_t image_crc = 0;
+    if (got < size) {
+        why = "timeout";
+    } else if (!fits) {
+        why = "too large";
+    } else {
+        esp_err_t err = program_slot_patch(patch, size, &staged, &image_crc);
+        why = err == ESP_OK ? NULL : err == ESP_ERR_NOT_FINISHED ? "busy" : esp_err_to_name(err);
+    }
+
+    if (why) {
+        printf("PATCH ERR %s\n", why);
+        return;
+    }
+    printf("PATCH OK %d %d %lu %08lx\n", staged->num_phases, staged->num_edges,
+           (unsigned long)staged->total_ms, (unsigned long)image_crc);
+    control_request_start();
+}
+
+// "status": edge timing per component since boot or the last "status reset",
+// one machine-readable line each:
+//   JITTER "<component>" <count> <min_us> <avg_us> <p99_us> <max_us>
+static void print_status(void) {
+    static JitterStats stats[NUM_COMPONENTS];   // console task only
+    jitter_snapshot(stats);
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        const JitterStats* s = &stats[i];
+        printf("JITTER \"%s\" %lu %lu %lu %lu %lu\n", component_states[i].name,
+               (unsigned long)s->count, (unsigned long)(s->count ? s->min_us : 0),
+               (unsigned long)(s->count ? s->sum_us / s->count : 0),
+               (unsigned long)jitter_percentile(s, 99), (unsigned long)s->max_us);
+    }
+    printf("STATUS %s telemetry_dropped=%lu\n", scheduler_paused() ? "paused" : "ok",
+           (unsigned long)telemetry_dropped());
+}
+
+#if CONFIG_CYCLE_DIAGNOSTICS
+static const char* const s_load_sources[] = { "none", "partition", "binary", "json" };
+
+// <count> <min_us> <avg_us> <p50_us> <p99_us> <max_us>, then the count of
+// each histogram bucket (jitter.h).
+static void print_latency(const char* line, const JitterStats* s) {
+    printf("%s %lu %lu %lu %lu %lu %lu", line, (unsigned long)s->count,
+           (unsigned long)(s->count ? s->min_us : 0),
+           (unsigned long)(s->count ? s->sum_us / s->count : 0),
+           (unsigned long)jitter_percentile(s, 50), (unsigned long)jitter_percentile(s, 99),
+           (unsigned long)s->max_us);
+    for (int b = 0; b < JITTER_BUCKETS; b++) {
+        printf(" %lu", (unsigned long)s->buckets[b]);
+    }
+    printf("\n");
+}
+
+// "diag": the counters of diag.h, one machine-readable line each:
+//   DIAG BUILD "<version>" "<idf version>" "<date>"
+//   DIAG LOAD <source> <mount> <read> <parse> <compile> <save> <total us> <json bytes>
+//   DIAG HEAP <free> <largest> <min> <before load> <largest> <after load> <largest>
+//   DIAG STACK "<task>" <free bytes>
+//   DIAG DISPATCH <latency>
+//   DIAG CPU <permille> <busy us> <window us> <wakeups>
+static void print_diag(void) {
+    static DiagReport d;   // console task only
+    diag_report(&d);
+    const DiagLoad* l = &d.load;
+    printf("DIAG BUILD \"%s\" \"%s\" \"%s\"\n", d.version, d.idf_version, d.built);
+    printf("DIAG LOAD %s %lu %lu %lu %lu %lu %lu %lu\n", s_load_sources[l->source],
+           (unsigned long)l->mount_us, (unsigned long)l->read_us, (unsigned long)l->parse_us,
+           (unsigned long)l->compile_us, (unsigned long)l->save_us, (unsigned long)l->total_us,
+           (unsigned long)l->json_bytes);
+    printf("DIAG HEAP %lu %lu %lu %lu %lu %lu %lu\n", (unsigned long)d.heap_free,
+           (unsigned long)d.heap_largest, (unsigned long)d.heap_min, (unsigned long)l->heap_before,
+           (unsigned long)l->largest_before, (unsigned long)l->heap_after,
+           (unsigned long)l->largest_after);
+    for (int i = 0; i < d.num_stacks; i++) {
+        printf("DIAG STACK \"%s\" %lu\n", d.stacks[i].name, (unsigned long)d.stacks[i].free_min);
+    }
+    print_latency("DIAG DISPATCH", &d.dispatch);
+    printf("DIAG CPU %lu %llu %llu %lu\n", (unsigned long)d.cpu_permille,
+           (unsigned long long)d.busy_us, (unsigned long long)d.window_us, (unsigned long)d.wakeups);
+}
+
+// "diag bench [edges] [spacing ms]": the synthetic program through the
+// scheduler, no output switched (diag_bench):
+//   BENCH OK <edges> <spacing ms> <outputs> <run us> <cpu permille> <stack free> <heap free>
+//   BENCH LATE <latency>
+//   BENCH DISPATCH <latency>
+// or BENCH ERR <reason>.
+static void run_bench(const char* arg) {
+    char* end;
+    unsigned long edges = strtoul(arg, &end, 10);
+    unsigned long spacing = strtoul(end, &end, 10);
+    while (*end == ' ') {
+        end++;
+    }
+    if (*end != '\0') {
+        printf("BENCH ERR usage: diag bench [edges] [spacing ms]\n");
+        return;
+    }
+    static DiagBench b;   // console task only
+    esp_err_t err = diag_bench(edges, spacing, &b);
+    if (err != ESP_OK) {
+        printf("BENCH ERR %s\n", esp_err_to_name(err));
+        return;
+    }
+    printf("BENCH OK %lu %lu %lu %lu %lu %lu %lu\n", (unsigned long)b.edges,
+           (unsigned long)b.spacing_ms, (unsigned long)b.outputs, (unsigned long)b.run_us,
+           (unsigned long)b.cpu_permille, (unsigned long)b.stack_free, (unsigned long)b.heap_free);
+    print_latency("BENCH LATE", &b.late);
+    print_latency("BENCH DISPATCH", &b.dispatch);
+}
+#endif
+
+#if CONFIG_CYCLE_PROGRAM_PARTITION
+// "list": the programs of the mapped library, then the selection:
+//   PROGRAM <id> "<name>"
+//   PROGRAMS <count> <selected>
+static void list_programs(void) {
+    int count = program_flash_count();
+    for (int id = 0; id < count; id++) {
+        const char* name = program_flash_name(id);
+        printf("PROGRAM %d \"%s\"\n", id, name ? name : "");
+    }
+    printf("PROGRAMS %d %d\n", count, program_flash_selected());
+}
+
+// "select <id>": run that program of the library from the next cycle on.
+//   SELECT OK <id> <phases> <cycle ms>   or   SELECT ERR <reason>
+static void select_from_console(const char* arg) {
+    char* end;
+    long id = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0') {
+        printf("SELECT ERR usage: select <id>\n");
+        return;
+    }
+    Program view;
+    esp_err_t err = select_program((int)id, &view);
+    if (err != ESP_OK) {
+        printf("SELECT ERR %s\n", esp_err_to_name(err));
+        return;
+    }
+    printf("SELECT OK %ld %d %lu\n", id, view.num_phases, (unsigned long)view.total_ms);
+}
+#endif
+
+static void handle_line(const char* line) {
+    SchedulerCommand cmd;
+    if (strncmp(line, "load ", 5) == 0) {
+        load_program(line + 5);
+        return;
+    }
+    if (strncmp(line, "patch ", 6) == 0) {
+        patch_program(line + 6);
+        return;
+    }
+#if CONFIG_CYCLE_PROGRAM_PARTITION
+    if (strcmp(line, "list") == 0) {
+        list_programs();
+        return;
+    }
+    if (strncmp(line, "select ", 7) == 0) {
+        select_from_console(line + 7);
+        return;
+    }
+#endif
+    if (strcmp(line, "status") == 0) {
+        print_status();
+        return;
+    }
+    if (strcmp(line, "status reset") == 0) {
+        jitter_reset();
+        return;
+    }
+    if (strcmp(line, "start") == 0) {
+        control_request_start();
+        return;
+    }
+#if CONFIG_CYCLE_DIAGNOSTICS
+    if (strcmp(line, "diag") == 0) {
+        print_diag();
+        return;
+    }
+    if (strcmp(line, "diag reset") == 0) {
+        diag_reset();
+        return;
+    }
+    if (strcmp(line, "diag bench") == 0 || strncmp(line, "diag bench ", 11) == 0) {
+        run_bench(line + 10);
+        return;
+    }
+#endif
+    if (strcmp(line, "pause") == 0) {
+        cmd = SCHED_CMD_PAUSE;
+    } else if (strcmp(line, "resume") == 0) {
+        cmd = SCHED_CMD_RESUME;
+    } else if (strcmp(line, "abort") == 0) {
+        cmd = SCHED_CMD_ABORT;
+    } else {
+        ESP_LOGW(TAG, "Unknown command \"%s\" (start, pause, resume, abort, load, patch, list, select, status, diag)", line);
+        return;
+    }
+    if (scheduler_command(cmd) != ESP_OK) {
+        ESP_LOGW(TAG, "\"%s\": no cycle running", line);
+    }
+}
+
+static void console_task(void* arg) {
+    char line[CONSOLE_LINE_MAX];
+    int len = 0;
+    bool awake = false;
+    while (1) {
+        // Awake from the first character until the line goes quiet, so
+        // light sleep does not drop the rest of a command or an upload.
+        char c;
+        if (uart_read_bytes(CONSOLE_UART, &c, 1, awake ? pdMS_TO_TICKS(LOAD_TIMEOUT_MS) : portMAX_DELAY) != 1) {
+            awake = false;
+            power_hold(POWER_CONSOLE, false);
+            continue;
+        }
+        if (!awake) {
+            awake = true;
+            power_hold(POWER_CONSOLE, true);
+        }
+        if (c == '\r' || c == '\n') {
+            line[len] = '\0';
+            if (len > 0) {
+                handle_line(line);
+            }
+            len = 0;
+        } else if (len < CONSOLE_LINE_MAX - 1) {
+            line[len++] = c;
+        }
+    }
+}
+
+static esp_err_t console_init(void) {
+    esp_err_t err = uart_driver_install(CONSOLE_UART, CONSOLE_RX_BUF, 0, 0, NULL, 0);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // What wakes the chip is lost; the uploader leads with an empty line.
+    err = power_wake_on_uart(CONSOLE_UART);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (xTaskCreatePinnedToCore(console_task, "control", CONSOLE_TASK_STACK, NULL,
+                                TASK_PRIO_CONSOLE, NULL, TASK_CORE_BG) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+#endif
+
+void control_request_start(void) {
+    if (s_start) {
+        xSemaphoreGive(s_start);
+    }
+}
+
+bool control_wait_start(TickType_t timeout) {
+    return s_start && xSemaphoreTake(s_start, timeout) == pdTRUE;
+}
+
+esp_err_t control_init(void) {
+    s_start = xSemaphoreCreateBinary();
+    if (!s_start) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = button_init(&s_pause);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up PAUSE_PIN: %s", esp_err_to_name(err));
+        return err;
+    }
+#if CONFIG_CYCLE_SELECT_BUTTON
+    // Selecting from the console still works without the button.
+    if (select_pin_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Program select button unavailable");
+    }
+#endif
+#if CONFIG_CYCLE_CONTROL_CONSOLE
+    err = console_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the command console: %s", esp_err_to_name(err));
+        return err;
+    }
+#endif
+    return ESP_OK;
+}
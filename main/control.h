@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// ------------------------- CYCLE CONTROL -------------------------
+// Pause, resume and abort for the running cycle:
+//   - PAUSE_PIN (active low, internal pull-up): each press toggles
+//     pause/resume. The outputs go OFF inside the interrupt handler.
+//   - console lines "pause", "resume" and "abort" on the console UART
+//     (CONFIG_CYCLE_CONTROL_CONSOLE).
+// The console also takes "load <bytes>" followed by a program image, which
+// is staged in program_slot and started once the current cycle is over,
+// "patch <bytes>" followed by a patch of the running program
+// (program_patch.h), staged the same way, "start" to run the current
+// program again, "status" / "status reset" for the per-component edge
+// jitter (jitter.h), "diag", "diag reset" and "diag bench [edges]
+// [spacing ms]" for the performance counters and the scheduler bench
+// (diag.h), and, with a program library in the program partition, "list"
+// and "select <id>". With
+// CONFIG_CYCLE_SELECT_BUTTON each press of CONFIG_CYCLE_SELECT_PIN (active
+// low, internal pull-up) selects the next program of the library instead.
+// A selected program is started like a loaded one. Both buttons, and
+// the console, also wake the chip from light sleep (power.h).
+
+esp_err_t control_init(void);
+
+// Ask for the next cycle to start; app_main waits for this between cycles.
+void control_request_start(void);
+bool control_wait_start(TickType_t timeout);
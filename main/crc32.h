@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Standard CRC-32 (IEEE 802.3, same as zlib's crc32()). Start with 0 and
+// pass the previous result to continue over several buffers.
+uint32_t crc32_update(uint32_t crc, const void* buf, size_t len);
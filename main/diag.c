@@ -0,0 +1,212 @@
+#include "diag.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_app_desc.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "main.h"
+#include "outputs.h"
+#include "scheduler.h"
+
+static const char* TAG = "DIAG";
+
+#define BENCH_LEAD_MS          10     // first record slightly ahead, as for a cycle
+#define BENCH_MAX_SPACING_MS   1000
+
+// Looked up by name, so a task left out of the build is simply skipped.
+static const char* const s_tasks[DIAG_MAX_TASKS] = {
+    "scheduler", "sensors", "control", "select", "httpd", "live",
+    "checkpoint", "sensor_up", "telemetry", "main", "esp_timer", "tiT",
+};
+
+static DiagLoad          s_load;
+static JitterStats       s_dispatch = { .min_us = UINT32_MAX };
+static uint32_t          s_wakeups = 0;
+static uint64_t          s_busy_us = 0;
+static int64_t           s_since_us = 0;
+static portMUX_TYPE      s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void diag_heap(uint32_t* free, uint32_t* largest) {
+    *free    = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    *largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
+
+void diag_set_load(const DiagLoad* load) {
+    s_load = *load;
+}
+
+void diag_record_dispatch(int64_t late_us) {
+    uint32_t late = late_us < 0 ? 0 : late_us > UINT32_MAX ? UINT32_MAX : (uint32_t)late_us;
+    portENTER_CRITICAL(&s_lock);
+    jitter_add(&s_dispatch, late);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void diag_record_busy(int64_t busy_us) {
+    portENTER_CRITICAL(&s_lock);
+    s_wakeups++;
+    s_busy_us += busy_us > 0 ? (uint64_t)busy_us : 0;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void diag_reset(void) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    jitter_clear(&s_dispatch);
+    s_wakeups  = 0;
+    s_busy_us  = 0;
+    s_since_us = now;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static uint32_t permille(uint64_t part, uint64_t whole) {
+    return whole ? (uint32_t)(part * 1000 / whole) : 0;
+}
+
+static uint32_t stack_free(const char* name) {
+    TaskHandle_t task = xTaskGetHandle(name);
+    // ESP-IDF counts stack in bytes.
+    return task ? (uint32_t)uxTaskGetStackHighWaterMark(task) : 0;
+}
+
+void diag_report(DiagReport* out) {
+    const esp_app_desc_t* app = esp_app_get_description();
+    *out = (DiagReport){
+        .version     = app->version,
+        .idf_version = app->idf_ver,
+        .built       = app->date,
+        .load        = s_load,
+        .heap_min    = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+    };
+    diag_heap(&out->heap_free, &out->heap_largest);
+    for (int i = 0; i < DIAG_MAX_TASKS; i++) {
+        TaskHandle_t task = xTaskGetHandle(s_tasks[i]);
+        if (task) {
+            out->stacks[out->num_stacks++] = (DiagStack){
+                .name = s_tasks[i], .free_min = (uint32_t)uxTaskGetStackHighWaterMark(task),
+            };
+        }
+    }
+
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_lock);
+    out->dispatch  = s_dispatch;
+    out->wakeups   = s_wakeups;
+    out->busy_us   = s_busy_us;
+    out->window_us = (uint64_t)(now - s_since_us);
+    portEXIT_CRITICAL(&s_lock);
+    out->cpu_permille = permille(out->busy_us, out->window_us);
+}
+
+// Every output but the motor's, each switched ON in turn for one record
+// while the one before goes OFF: a single output changes per direction, so
+// no inrush stagger hides the dispatch time. The last record switches the
+// last output OFF. One phase spans it all. 0 when there is nothing to switch.
+static int bench_program(Program* prog, Phase* phase, TimelineEdge* edges, uint32_t count,
+                         uint32_t spacing_ms) {
+    uint32_t mask = outputs_mask() & ~((1u << MOTOR_ON_PIN) | (1u << MOTOR_DIRECTION_PIN));
+    int pins[32];
+    int num_pins = 0;
+    for (uint32_t m = mask; m; m &= m - 1) {
+        pins[num_pins++] = __builtin_ctz(m);
+    }
+    if (num_pins == 0) {
+        return 0;
+    }
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t prev = k ? 1u << pins[(k - 1) % num_pins] : 0;
+        uint32_t next = k + 1 < count ? 1u << pins[k % num_pins] : 0;
+        edges[k] = (TimelineEdge){
+            .abs_time_ms     = k * spacing_ms,
+            .gpio_mask_set   = prev,
+            .gpio_mask_clear = next,
+        };
+    }
+    uint32_t total_ms = (count - 1) * spacing_ms;
+    *phase = (Phase){ .duration_ms = total_ms };
+    program_init(prog);
+    prog->phases     = phase;
+    prog->num_phases = 1;
+    prog->edges      = edges;
+    prog->num_edges  = (int)count;
+    prog->total_ms   = total_ms;
+    prog->mapped     = true;   // tables are the bench's, not the pool's
+    return num_pins;
+}
+
+esp_err_t diag_bench(uint32_t edges, uint32_t spacing_ms, DiagBench* out) {
+    if (edges == 0) {
+        edges = CONFIG_CYCLE_DIAG_BENCH_EDGES;
+    }
+    if (spacing_ms == 0) {
+        spacing_ms = CONFIG_CYCLE_DIAG_BENCH_SPACING_MS;
+    }
+    if (edges < 2 || edges > DIAG_BENCH_MAX_EDGES || spacing_ms > BENCH_MAX_SPACING_MS ||
+        (edges - 1) * spacing_ms > DIAG_BENCH_MAX_RUN_MS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!scheduler_claim(0)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    TimelineEdge* table = malloc(edges * sizeof(TimelineEdge));
+    if (!table) {
+        scheduler_release();
+        return ESP_ERR_NO_MEM;
+    }
+    Program prog;
+    Phase phase;
+    *out = (DiagBench){ .edges = edges, .spacing_ms = spacing_ms };
+    out->outputs = (uint32_t)bench_program(&prog, &phase, table, edges, spacing_ms);
+    if (out->outputs == 0) {
+        free(table);
+        scheduler_release();
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint32_t largest;
+    diag_heap(&out->heap_free, &largest);
+
+    jitter_reset();
+    diag_reset();
+    int64_t epoch_us = esp_timer_get_time() + BENCH_LEAD_MS * 1000;
+    esp_err_t err = scheduler_start_dry_run(&prog, epoch_us);
+    if (err == ESP_OK) {
+        PhaseReport r;
+        TickType_t timeout = pdMS_TO_TICKS(prog.total_ms + BENCH_LEAD_MS + 1000);
+        if (!scheduler_wait_report(&r, timeout) || !scheduler_wait_idle(pdMS_TO_TICKS(1000))) {
+            ESP_LOGE(TAG, "Bench did not finish; aborting it");
+            scheduler_command(SCHED_CMD_ABORT);
+            scheduler_wait_idle(portMAX_DELAY);
+            err = ESP_ERR_TIMEOUT;
+        }
+    }
+    int64_t now = esp_timer_get_time();
+    free(table);
+
+    if (err == ESP_OK) {
+        static JitterStats stats[NUM_COMPONENTS];   // under scheduler_claim()
+        jitter_snapshot(stats);
+        jitter_clear(&out->late);
+        for (int i = 0; i < NUM_COMPONENTS; i++) {
+            jitter_merge(&out->late, &stats[i]);
+        }
+        DiagReport report;
+        diag_report(&report);
+        out->run_us       = (uint32_t)(now - epoch_us);
+        out->dispatch     = report.dispatch;
+        out->cpu_permille = permille(report.busy_us, out->run_us);
+        out->stack_free   = stack_free("scheduler");
+        ESP_LOGI(TAG, "Bench: %lu edges %lu ms apart, %lu us late at worst, dispatch p99 %lu us, "
+                 "scheduler busy %lu.%lu%%",
+                 (unsigned long)edges, (unsigned long)spacing_ms, (unsigned long)out->late.max_us,
+                 (unsigned long)jitter_percentile(&out->dispatch, 99),
+                 (unsigned long)(out->cpu_permille / 10), (unsigned long)(out->cpu_permille % 10));
+    }
+    scheduler_release();
+    return err;
+}
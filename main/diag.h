@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "jitter.h"
+
+// ------------------------- DIAGNOSTICS -------------------------
+// Performance counters for comparing firmware builds on the board itself,
+// measured the same way on every build (console "diag", HTTP GET /diag):
+//   - how the program was loaded at boot, the time spent reading, parsing
+//     and compiling it, and the heap before and after
+//   - the least free stack each task has had since boot
+//   - timer dispatch latency: from the time the scheduler's timer was set
+//     for to the scheduler task running, in the histogram of jitter.h
+//   - the share of time the scheduler task spent working
+//
+// diag_bench() runs a synthetic program of closely spaced edges through
+// the scheduler without driving any output and reports the same numbers
+// for just that run, so two builds can be compared on the same load.
+//
+// Only the scheduler task records dispatch and busy time. Readers take a
+// snapshot.
+
+#define DIAG_MAX_TASKS         12
+#define DIAG_BENCH_MAX_EDGES   8192    // 12 bytes each, from the heap for the run only
+#define DIAG_BENCH_MAX_RUN_MS  5000    // the caller (console, httpd task) waits it out
+
+typedef enum {
+    DIAG_LOAD_NONE = 0,
+    DIAG_LOAD_PARTITION,      // mapped from the program partition
+    DIAG_LOAD_BINARY,         // input.bin from SPIFFS
+    DIAG_LOAD_JSON,           // input.json parsed and compiled
+} DiagLoadSource;
+
+// Boot-time load of the program. Times in us.
+typedef struct {
+    DiagLoadSource source;
+    uint32_t mount_us;        // SPIFFS mount
+    uint32_t read_us;         // reading input.bin (with its checks), input.json or the partition
+    uint32_t parse_us;        // input.json only
+    uint32_t compile_us;      // input.json only
+    uint32_t save_us;         // writing input.bin and installing it in the partition
+    uint32_t total_us;
+    uint32_t json_bytes;
+    uint32_t heap_before;     // free 8-bit heap before the load
+    uint32_t largest_before;  // and its largest free block
+    uint32_t heap_after;
+    uint32_t largest_after;
+} DiagLoad;
+
+typedef struct {
+    const char* name;
+    uint32_t    free_min;     // bytes of stack never used so far
+} DiagStack;
+
+typedef struct {
+    const char* version;      // esp_app_desc_t of the running build
+    const char* idf_version;
+    const char* built;        // date of the build
+    DiagLoad    load;
+    uint32_t    heap_free;    // 8-bit heap now
+    uint32_t    heap_largest;
+    uint32_t    heap_min;     // least free since boot
+    DiagStack   stacks[DIAG_MAX_TASKS];
+    int         num_stacks;   // tasks that exist in this build
+    JitterStats dispatch;     // since diag_reset()
+    uint32_t    wakeups;      // scheduler task runs since diag_reset()
+    uint64_t    busy_us;      // time the scheduler task spent in them
+    uint64_t    window_us;    // since diag_reset()
+    uint32_t    cpu_permille; // busy_us / window_us
+} DiagReport;
+
+typedef struct {
+    uint32_t    edges;        // records of the synthetic program
+    uint32_t    spacing_ms;   // between two records
+    uint32_t    outputs;      // outputs it switches in turn, one ON per record
+    uint32_t    run_us;       // first record due to the scheduler idle again
+    JitterStats late;         // per output switched, against its compiled time
+    JitterStats dispatch;
+    uint32_t    cpu_permille; // scheduler task busy over run_us
+    uint32_t    stack_free;   // scheduler task's least free stack afterwards
+    uint32_t    heap_free;    // with the program allocated
+} DiagBench;
+
+// Free 8-bit heap and its largest block.
+void diag_heap(uint32_t* free, uint32_t* largest);
+
+// Record how the program was loaded; copied.
+void diag_set_load(const DiagLoad* load);
+
+// Scheduler task: a timer wake-up `late_us` after the time it was set
+// for, and one run of `busy_us`.
+void diag_record_dispatch(int64_t late_us);
+void diag_record_busy(int64_t busy_us);
+
+void diag_report(DiagReport* out);
+
+// Start the dispatch and busy counters over.
+void diag_reset(void);
+
+// Run `edges` records `spacing_ms` apart (0 for the defaults) through the
+// scheduler with the outputs left alone, and measure it. Blocks for the
+// length of the run. The jitter (status), dispatch and busy counters start
+// over with it. ESP_ERR_INVALID_STATE while a cycle or an upload holds
+// the scheduler (scheduler_claim),
+// ESP_ERR_INVALID_ARG for under 2 or over DIAG_BENCH_MAX_EDGES edges,
+// records over 1000 ms apart or a run over DIAG_BENCH_MAX_RUN_MS,
+// ESP_ERR_NOT_FOUND if the build has no output but the motor's to switch,
+// ESP_ERR_NO_MEM if the program does not fit the heap, ESP_ERR_TIMEOUT if
+// the run did not finish and was aborted.
+esp_err_t diag_bench(uint32_t edges, uint32_t spacing_ms, DiagBench* out);
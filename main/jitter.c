@@ -0,0 +1,102 @@
+#include "jitter.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "components.h"
+
+static JitterStats  s_stats[NUM_COMPONENTS];
+static bool         s_ready = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void init_tables(void) {
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        jitter_clear(&s_stats[i]);
+    }
+    s_ready = true;
+}
+
+static int bucket_of(uint32_t late_us) {
+    int b = late_us ? 32 - __builtin_clz(late_us) : 0;
+    return b < JITTER_BUCKETS ? b : JITTER_BUCKETS - 1;
+}
+
+void jitter_clear(JitterStats* s) {
+    *s = (JitterStats){ .min_us = UINT32_MAX };
+}
+
+void jitter_add(JitterStats* s, uint32_t late_us) {
+    s->count++;
+    s->sum_us += late_us;
+    if (late_us < s->min_us) {
+        s->min_us = late_us;
+    }
+    if (late_us > s->max_us) {
+        s->max_us = late_us;
+    }
+    s->buckets[bucket_of(late_us)]++;
+}
+
+void jitter_merge(JitterStats* into, const JitterStats* from) {
+    into->count += from->count;
+    into->sum_us += from->sum_us;
+    if (from->min_us < into->min_us) {
+        into->min_us = from->min_us;
+    }
+    if (from->max_us > into->max_us) {
+        into->max_us = from->max_us;
+    }
+    for (int b = 0; b < JITTER_BUCKETS; b++) {
+        into->buckets[b] += from->buckets[b];
+    }
+}
+
+void jitter_record(uint32_t set_mask, uint32_t clear_mask, int64_t late_us) {
+    uint32_t late = late_us < 0 ? 0 : late_us > UINT32_MAX ? UINT32_MAX : (uint32_t)late_us;
+
+    portENTER_CRITICAL(&s_lock);
+    if (!s_ready) {
+        init_tables();
+    }
+    for (uint32_t m = set_mask | clear_mask; m; m &= m - 1) {
+        uint8_t i = component_at_pin(__builtin_ctz(m));
+        if (i == COMPONENT_NONE) {
+            continue;
+        }
+        jitter_add(&s_stats[i], late);
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void jitter_snapshot(JitterStats out[NUM_COMPONENTS]) {
+    portENTER_CRITICAL(&s_lock);
+    if (!s_ready) {
+        init_tables();
+    }
+    memcpy(out, s_stats, sizeof(s_stats));
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void jitter_reset(void) {
+    portENTER_CRITICAL(&s_lock);
+    init_tables();
+    portEXIT_CRITICAL(&s_lock);
+}
+
+uint32_t jitter_percentile(const JitterStats* s, int p) {
+    if (s->count == 0) {
+        return 0;
+    }
+    // Smallest bucket that covers p% of the samples.
+    uint64_t need = ((uint64_t)s->count * p + 99) / 100;
+    uint64_t seen = 0;
+    for (int b = 0; b < JITTER_BUCKETS - 1; b++) {
+        seen += s->buckets[b];
+        if (seen >= need) {
+            uint32_t bound = (1u << b) - 1;
+            return bound < s->max_us ? bound : s->max_us;
+        }
+    }
+    return s->max_us;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "components.h"
+
+// ------------------------- EDGE JITTER -------------------------
+// Per-component statistics of how late each output switch lands against
+// its compiled time (actual esp_timer_get_time() right after the GPIO
+// write minus epoch + abs_time_ms). Fixed memory: a log2 histogram per
+// component, so p99 is known to within a factor of two and the cost per
+// edge does not depend on how long the stats have been running.
+//
+// Only the scheduler task records. Readers take a snapshot.
+
+#define JITTER_BUCKETS  16    // bucket b: late < 2^b us; the last one is open-ended
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[JITTER_BUCKETS];
+} JitterStats;
+
+// Count one switch of every component in `set_mask | clear_mask`.
+void jitter_record(uint32_t set_mask, uint32_t clear_mask, int64_t late_us);
+
+// Consistent copy of all components' stats, indexed like component_states.
+void jitter_snapshot(JitterStats out[NUM_COMPONENTS]);
+
+void jitter_reset(void);
+
+// The same histogram for other latencies (diag.h). No locking: the caller
+// owns `s`.
+void jitter_clear(JitterStats* s);
+void jitter_add(JitterStats* s, uint32_t late_us);
+// Fold `from` into `into`, e.g. all components into one.
+void jitter_merge(JitterStats* into, const JitterStats* from);
+
+// Upper bound (us) of the bucket holding the p-th percentile, p in 1..100.
+// 0 when nothing was recorded.
+uint32_t jitter_percentile(const JitterStats* s, int p);
@@ -0,0 +1,320 @@
+#include "json_stream.h"
+
+#include <string.h>
+
+enum {
+    EXPECT_VALUE,
+    EXPECT_VALUE_OR_END,    // just after '['
+    EXPECT_KEY,
+    EXPECT_KEY_OR_END,      // just after '{'
+    EXPECT_COLON,
+    EXPECT_COMMA_OR_END,
+    EXPECT_NOTHING,         // top-level value complete
+};
+
+enum {
+    LEX_NONE,
+    LEX_STRING,
+    LEX_ESCAPE,
+    LEX_UNICODE,
+    LEX_NUMBER,
+    LEX_LITERAL,
+};
+
+void json_stream_init(JsonStream* js, json_event_cb cb, void* ctx) {
+    memset(js, 0, sizeof(*js));
+    js->cb     = cb;
+    js->ctx    = ctx;
+    js->expect = EXPECT_VALUE;
+    js->lex    = LEX_NONE;
+}
+
+static bool emit(JsonStream* js, JsonEvent ev, const char* text) {
+    if (!js->cb(js->ctx, js, ev, text, js->depth)) {
+        js->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static void token_reset(JsonStream* js) {
+    js->token_len = 0;
+    js->truncated = false;
+}
+
+static void token_append(JsonStream* js, char c) {
+    if (js->token_len < JSON_STREAM_TOKEN_LEN - 1) {
+        js->token[js->token_len++] = c;
+    } else {
+        js->truncated = true;
+    }
+}
+
+static const char* token_str(JsonStream* js) {
+    js->token[js->token_len] = '\0';
+    return js->token;
+}
+
+static void value_done(JsonStream* js) {
+    if (js->depth == 0) {
+        js->expect = EXPECT_NOTHING;
+        js->done   = true;
+    } else {
+        js->expect = EXPECT_COMMA_OR_END;
+    }
+}
+
+static bool open_container(JsonStream* js, char c) {
+    if (js->depth >= JSON_STREAM_MAX_DEPTH) {
+        return false;
+    }
+    if (!emit(js, c == '{' ? JSON_EV_OBJECT_START : JSON_EV_ARRAY_START, NULL)) {
+        return false;
+    }
+    js->stack[js->depth++] = (uint8_t)c;
+    js->expect = c == '{' ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+    return true;
+}
+
+static bool close_container(JsonStream* js, char c) {
+    char open = c == '}' ? '{' : '[';
+    if (js->depth == 0 || js->stack[js->depth - 1] != open) {
+        return false;
+    }
+    js->depth--;
+    if (!emit(js, c == '}' ? JSON_EV_OBJECT_END : JSON_EV_ARRAY_END, NULL)) {
+        return false;
+    }
+    value_done(js);
+    return true;
+}
+
+static void append_utf8(JsonStream* js, uint16_t cp) {
+    if (cp < 0x80) {
+        token_append(js, (char)cp);
+    } else if (cp < 0x800) {
+        token_append(js, (char)(0xC0 | (cp >> 6)));
+        token_append(js, (char)(0x80 | (cp & 0x3F)));
+    } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+        token_append(js, '?');    // surrogate pairs are not needed for our keys
+    } else {
+        token_append(js, (char)(0xE0 | (cp >> 12)));
+        token_append(js, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        token_append(js, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static const char* literal_text(char first) {
+    switch (first) {
+        case 't': return "true";
+        case 'f': return "false";
+        default:  return "null";
+    }
+}
+
+// Consume one character outside of any token. Returns false on error.
+static bool structural(JsonStream* js, char c) {
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        return true;
+    }
+
+    switch (js->expect) {
+        case EXPECT_NOTHING:
+            return false;
+
+        case EXPECT_COLON:
+            if (c != ':') {
+                return false;
+            }
+            js->expect = EXPECT_VALUE;
+            return true;
+
+        case EXPECT_COMMA_OR_END:
+            if (c == ',') {
+                js->expect = js->stack[js->depth - 1] == '{' ? EXPECT_KEY : EXPECT_VALUE;
+                return true;
+            }
+            if (c == '}' || c == ']') {
+                return close_container(js, c);
+            }
+            return false;
+
+        case EXPECT_KEY_OR_END:
+            if (c == '}') {
+                return close_container(js, c);
+            }
+            // fall through
+        case EXPECT_KEY:
+            if (c != '"') {
+                return false;
+            }
+            token_reset(js);
+            js->key_token = true;
+            js->lex = LEX_STRING;
+            return true;
+
+        case EXPECT_VALUE_OR_END:
+            if (c == ']') {
+                return close_container(js, c);
+            }
+            // fall through
+        case EXPECT_VALUE:
+            if (c == '{' || c == '[') {
+                return open_container(js, c);
+            }
+            token_reset(js);
+            if (c == '"') {
+                js->key_token = false;
+                js->lex = LEX_STRING;
+                return true;
+            }
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                token_append(js, c);
+                js->lex = LEX_NUMBER;
+                return true;
+            }
+            if (c == 't' || c == 'f' || c == 'n') {
+                token_append(js, c);
+                js->literal_pos = 1;
+                js->lex = LEX_LITERAL;
+                return true;
+            }
+            return false;
+    }
+    return false;
+}
+
+bool json_stream_feed(JsonStream* js, const char* buf, size_t len) {
+    if (js->failed) {
+        return false;
+    }
+
+    size_t i = 0;
+    while (i < len) {
+        char c = buf[i];
+        bool ok = true;
+
+        switch (js->lex) {
+            case LEX_STRING:
+                if (c == '"') {
+                    js->lex = LEX_NONE;
+                    if (js->key_token) {
+                        ok = emit(js, JSON_EV_KEY, token_str(js));
+                        js->expect = EXPECT_COLON;
+                    } else {
+                        ok = emit(js, JSON_EV_STRING, token_str(js));
+                        value_done(js);
+                    }
+                } else if (c == '\\') {
+                    js->lex = LEX_ESCAPE;
+                } else if ((unsigned char)c < 0x20) {
+                    ok = false;
+                } else {
+                    token_append(js, c);
+                }
+                break;
+
+            case LEX_ESCAPE:
+                js->lex = LEX_STRING;
+                switch (c) {
+                    case '"':  token_append(js, '"');  break;
+                    case '\\': token_append(js, '\\'); break;
+                    case '/':  token_append(js, '/');  break;
+                    case 'b':  token_append(js, '\b'); break;
+                    case 'f':  token_append(js, '\f'); break;
+                    case 'n':  token_append(js, '\n'); break;
+                    case 'r':  token_append(js, '\r'); break;
+                    case 't':  token_append(js, '\t'); break;
+                    case 'u':
+                        js->lex        = LEX_UNICODE;
+                        js->esc_digits = 0;
+                        js->esc_code   = 0;
+                        break;
+                    default:
+                        ok = false;
+                        break;
+                }
+                break;
+
+            case LEX_UNICODE: {
+                int v = hex_value(c);
+                if (v < 0) {
+                    ok = false;
+                    break;
+                }
+                js->esc_code = (uint16_t)((js->esc_code << 4) | v);
+                if (++js->esc_digits == 4) {
+                    append_utf8(js, js->esc_code);
+                    js->lex = LEX_STRING;
+                }
+                break;
+            }
+
+            case LEX_NUMBER:
+                if (is_number_char(c)) {
+                    token_append(js, c);
+                    break;
+                }
+                // The number ends here; emit it and handle `c` as structure.
+                js->lex = LEX_NONE;
+                if (!emit(js, JSON_EV_NUMBER, token_str(js))) {
+                    return false;
+                }
+                value_done(js);
+                continue;
+
+            case LEX_LITERAL: {
+                const char* lit = literal_text(js->token[0]);
+                if (c != lit[js->literal_pos]) {
+                    ok = false;
+                    break;
+                }
+                if (lit[++js->literal_pos] == '\0') {
+                    js->lex = LEX_NONE;
+                    ok = emit(js, lit[0] == 't' ? JSON_EV_TRUE :
+                                  lit[0] == 'f' ? JSON_EV_FALSE : JSON_EV_NULL, NULL);
+                    value_done(js);
+                }
+                break;
+            }
+
+            default:
+                ok = structural(js, c);
+                break;
+        }
+
+        if (!ok) {
+            js->failed = true;
+            return false;
+        }
+        i++;
+        js->offset++;
+    }
+    return true;
+}
+
+bool json_stream_finish(JsonStream* js) {
+    if (js->failed) {
+        return false;
+    }
+    // A bare top-level number has no terminator of its own.
+    if (js->lex == LEX_NUMBER) {
+        js->lex = LEX_NONE;
+        if (!emit(js, JSON_EV_NUMBER, token_str(js))) {
+            return false;
+        }
+        value_done(js);
+    }
+    return js->lex == LEX_NONE && js->done;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// ------------------------- STREAMING JSON -------------------------
+// Incremental, SAX-style JSON tokenizer. Input is fed in chunks of any
+// size and every token is reported through a callback as soon as it is
+// complete, so memory use is one fixed-size token buffer no matter how
+// large the document is.
+
+#define JSON_STREAM_MAX_DEPTH   16
+#define JSON_STREAM_TOKEN_LEN   64    // longer strings are truncated (see JsonStream.truncated)
+
+typedef enum {
+    JSON_EV_OBJECT_START,
+    JSON_EV_OBJECT_END,
+    JSON_EV_ARRAY_START,
+    JSON_EV_ARRAY_END,
+    JSON_EV_KEY,          // text = key
+    JSON_EV_STRING,       // text = value
+    JSON_EV_NUMBER,       // text = number as written
+    JSON_EV_TRUE,
+    JSON_EV_FALSE,
+    JSON_EV_NULL,
+} JsonEvent;
+
+struct JsonStream;
+
+// `depth` is the number of containers enclosing the token; a container's
+// own START/END events report the depth outside of it. Return false to
+// stop parsing.
+typedef bool (*json_event_cb)(void* ctx, const struct JsonStream* js,
+                              JsonEvent ev, const char* text, int depth);
+
+typedef struct JsonStream {
+    json_event_cb cb;
+    void*         ctx;
+
+    uint8_t  stack[JSON_STREAM_MAX_DEPTH];  // '{' or '['
+    int      depth;
+    uint8_t  expect;       // internal parser state
+    uint8_t  lex;          // internal lexer state
+    uint8_t  literal_pos;
+    uint8_t  esc_digits;
+    uint16_t esc_code;
+    bool     key_token;    // string being lexed is an object key
+    bool     truncated;    // last string/number did not fit the token buffer
+    bool     done;         // top-level value complete
+    bool     failed;
+
+    char     token[JSON_STREAM_TOKEN_LEN];
+    size_t   token_len;
+    size_t   offset;       // bytes consumed, for error messages
+} JsonStream;
+
+void json_stream_init(JsonStream* js, json_event_cb cb, void* ctx);
+
+// Feed the next chunk. Returns false on a syntax error or when the
+// callback stopped parsing; js->offset then points at the offending byte.
+bool json_stream_feed(JsonStream* js, const char* buf, size_t len);
+
+// Signal end of input. Returns true if exactly one complete value was seen.
+bool json_stream_finish(JsonStream* js);
@@ -0,0 +1,180 @@
+#include "live_status.h"
+
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "components.h"
+#include "outputs.h"
+#include "scheduler.h"
+#include "tasks.h"
+
+static const char* TAG = "LIVE";
+
+#define TASK_STACK     3072
+
+// Sent as is.
+_Static_assert(sizeof(LiveStatusFrame) == 24, "LiveStatusFrame layout");
+
+static httpd_handle_t   s_server = NULL;
+static TaskHandle_t     s_task = NULL;
+
+// Socket of each client, -1 for a free entry. Only the server task
+// touches the table; the sampling task reads the count.
+static int              s_clients[LIVE_MAX_CLIENTS];
+static volatile int     s_num_clients = 0;
+
+// Frame being sent. The sampling task fills it and queues send_frame() on
+// the server task, and leaves it alone until that clears s_sending; a
+// change meanwhile goes out with the next frame.
+static LiveStatusFrame  s_frame;
+static volatile bool    s_sending = false;
+
+static void drop_client(int i) {
+    s_clients[i] = -1;
+    s_num_clients--;
+}
+
+// Runs on the server task.
+static void send_frame(void* arg) {
+    httpd_ws_frame_t ws = {
+        .final   = true,
+        .type    = HTTPD_WS_TYPE_BINARY,
+        .payload = (uint8_t*)&s_frame,
+        .len     = sizeof(s_frame),
+    };
+    for (int i = 0; i < LIVE_MAX_CLIENTS; i++) {
+        int fd = s_clients[i];
+        if (fd < 0) {
+            continue;
+        }
+        // A closed client's socket may since belong to a plain HTTP request.
+        if (httpd_ws_get_fd_info(s_server, fd) != HTTPD_WS_CLIENT_WEBSOCKET ||
+            httpd_ws_send_frame_async(s_server, fd, &ws) != ESP_OK) {
+            drop_client(i);
+        }
+    }
+    s_sending = false;
+}
+
+static esp_err_t add_client(int fd) {
+    int free_slot = -1;
+    for (int i = 0; i < LIVE_MAX_CLIENTS; i++) {
+        if (s_clients[i] == fd) {
+            return ESP_OK;
+        }
+        if (s_clients[i] < 0 && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot < 0) {
+        ESP_LOGW(TAG, "Refusing a client: %d connected", LIVE_MAX_CLIENTS);
+        return ESP_FAIL;
+    }
+    s_clients[free_slot] = fd;
+    s_num_clients++;
+    return ESP_OK;
+}
+
+static esp_err_t live_ws(httpd_req_t* req) {
+    if (req->method == HTTP_GET) {
+        // Handshake done: the client gets the current state at once.
+        esp_err_t err = add_client(httpd_req_to_sockfd(req));
+        if (err == ESP_OK) {
+            xTaskNotifyGive(s_task);
+        }
+        return err;
+    }
+    // Clients have nothing to say; read and drop whatever they send.
+    uint8_t buf[16];
+    httpd_ws_frame_t ws = { 0 };
+    esp_err_t err = httpd_ws_recv_frame(req, &ws, 0);
+    if (err != ESP_OK || ws.len == 0) {
+        return err;
+    }
+    if (ws.len > sizeof(buf)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    ws.payload = buf;
+    return httpd_ws_recv_frame(req, &ws, sizeof(buf));
+}
+
+static void sample(LiveStatusFrame* f) {
+    SchedulerProgress p;
+    bool running = scheduler_progress(&p);
+    uint32_t on = outputs_on();
+    uint32_t components = 0;
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        if (on & (1u << component_states[i].pin)) {
+            components |= 1u << i;
+        }
+    }
+    *f = (LiveStatusFrame){
+        .version    = LIVE_STATUS_VERSION,
+        .components = components,
+        .uptime_ms  = (uint32_t)(esp_timer_get_time() / 1000),
+    };
+    if (running) {
+        f->flags        = LIVE_RUNNING | (p.paused ? LIVE_PAUSED : 0);
+        f->phase        = (uint16_t)p.phase;
+        f->elapsed_ms   = p.elapsed_ms;
+        f->remaining_ms = p.total_ms > p.elapsed_ms ? p.total_ms - p.elapsed_ms : 0;
+    }
+}
+
+static void live_task(void* arg) {
+    LiveStatusFrame last = { 0 };
+    uint32_t seq = 0;
+    bool force = true;
+    while (1) {
+        if (s_num_clients == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            force = true;
+            continue;
+        }
+        // A new client is sent the state straight away.
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LIVE_TICK_MS))) {
+            force = true;
+        }
+        if (s_sending) {
+            continue;
+        }
+        LiveStatusFrame f;
+        sample(&f);
+        bool changed = f.flags != last.flags || f.phase != last.phase ||
+                       f.components != last.components;
+        if (!force && !changed && f.uptime_ms - last.uptime_ms < LIVE_HEARTBEAT_MS) {
+            continue;
+        }
+        f.seq = ++seq;
+        s_frame = f;
+        s_sending = true;
+        if (httpd_queue_work(s_server, send_frame, NULL) != ESP_OK) {
+            s_sending = false;
+            continue;
+        }
+        last = f;
+        force = false;
+    }
+}
+
+esp_err_t live_status_start(httpd_handle_t server) {
+    s_server = server;
+    for (int i = 0; i < LIVE_MAX_CLIENTS; i++) {
+        s_clients[i] = -1;
+    }
+    if (xTaskCreatePinnedToCore(live_task, "live", TASK_STACK, NULL, TASK_PRIO_LIVE,
+                                &s_task, TASK_CORE_BG) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create live status task");
+        return ESP_ERR_NO_MEM;
+    }
+    const httpd_uri_t live = {
+        .uri          = "/live",
+        .method       = HTTP_GET,
+        .handler      = live_ws,
+        .is_websocket = true,
+    };
+    return httpd_register_uri_handler(server, &live);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// ------------------------- LIVE STATUS -------------------------
+// With CONFIG_CYCLE_LIVE_STATUS the HTTP server (program_http.h) takes
+// WebSocket clients at /live and pushes each of them a small binary frame
+// whenever the cycle changes: another phase, an output switched, a pause
+// or resume, the cycle starting or ending. Changes within one
+// LIVE_TICK_MS are coalesced into one frame; with nothing changing a
+// frame still goes out every LIVE_HEARTBEAT_MS so elapsed and remaining
+// time keep moving. Nothing is sampled while no client is connected.
+//
+// Frame, little endian, 24 bytes (lib/live-status.js decodes it):
+//   u8  version         LIVE_STATUS_VERSION
+//   u8  flags           LIVE_RUNNING, LIVE_PAUSED
+//   u16 phase           phase of the next edge
+//   u32 seq             frame counter, a gap is a lost frame
+//   u32 components      bit i: component i of CYCLE_COMPONENTS is ON
+//   u32 elapsed_ms      cycle time reached, frozen while paused
+//   u32 remaining_ms    until the end of the program's last phase
+//   u32 uptime_ms
+
+#define LIVE_STATUS_VERSION  1
+#define LIVE_TICK_MS         50
+#define LIVE_HEARTBEAT_MS    1000
+#define LIVE_MAX_CLIENTS     4
+
+#define LIVE_RUNNING         0x01
+#define LIVE_PAUSED          0x02
+
+typedef struct {
+    uint8_t  version;
+    uint8_t  flags;
+    uint16_t phase;
+    uint32_t seq;
+    uint32_t components;
+    uint32_t elapsed_ms;
+    uint32_t remaining_ms;
+    uint32_t uptime_ms;
+} LiveStatusFrame;
+
+// Register /live on `server` and start the sampling task.
+esp_err_t live_status_start(httpd_handle_t server);
@@ -1,279 +1,301 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <string.h>
-#include <stdlib.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp_timer.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "esp_spiffs.h"
-#include "cJSON.h"
+#include "sdkconfig.h"
 #include "main.h"
-
-#define NUM_COMPONENTS 8
-#define MAX_TASK_NAME_LEN 32
-
-typedef struct {
-    const char* name;
-    gpio_num_t  pin;
-    bool        is_active;            // not strictly needed here, but kept for reference
-} ComponentState;
-
-ComponentState component_states[NUM_COMPONENTS] = {
-    {"Retractor", RETRACTOR_PIN, 0, false},
-    {"Detergent Valve", DETERGENT_VALVE_PIN, 0, false},
-    {"Cold Valve", COLD_VALVE_PIN, 0, false},
-    {"Drain Pump", DRAIN_PUMP_PIN, 0, false},
-    {"Hot Valve", HOT_VALVE_PIN, 0, false},
-    {"Softener Valve", SOFT_VALVE_PIN, 0, false},
-    {"Motor", MOTOR_ON_PIN, 0, false},
-    {"Motor Direction", MOTOR_DIRECTION_PIN, 0, false},
-};
-
-gpio_num_t map_name_to_pin(const char* name) {
-    for (int i = 0; i < NUM_COMPONENTS; i++) {
-        if (strcmp(component_states[i].name, name) == 0) {
-            return component_states[i].pin;
-        }
-    }
-    return -1;
-}
-
-
-typedef struct {
-    const char* compId;
-    gpio_num_t  pin;
-    uint32_t    start;    // ms delay from phase start before running
-    uint32_t    duration;         // how long (ms) to run this component
-    uint32_t    stepTime;         // used for motor styles
-    const char* runningStyle;     // "toggle" or "singleDir" (or future styles)
-    uint32_t    pauseTime;        // only used if runningStyle == "singleDir"
-} ComponentInput;
-
-typedef struct {
-    const char*     name;
-    uint32_t        startTime;   // ms delay from “0” (or from last phase) to start this phase
-    ComponentInput* components;
-    int             num_components;
-} Phase;
-
-Phase* program_phases = NULL;
-int NUM_PHASES = 0;
+#include "checkpoint.h"
+#include "components.h"
+#include "control.h"
+#include "diag.h"
+#include "outputs.h"
+#include "power.h"
+#include "program.h"
+#include "program_bin.h"
+#include "program_check.h"
+#include "program_flash.h"
+#include "program_http.h"
+#include "program_json.h"
+#include "program_slot.h"
+#include "scheduler.h"
+#include "sensor_upload.h"
+#include "sensors.h"
+#include "telemetry.h"
+
+#define CYCLE_START_LEAD_MS  10   // epoch slightly ahead so t=0 edges fire from the timer too
+#define FOLLOW_POLL_MS       100  // how often the cycle loop looks for the scheduler going idle
+
+Program program;
 
 uint32_t get_millis() {
     return (uint32_t)(esp_timer_get_time() / 1000ULL);
 }
 
-typedef struct {
-    const char* compId;
-    gpio_num_t  pin;
-    uint32_t    start;
-    uint32_t    duration;
-} ComponentTaskArg;
-
-
-
-// --------------------------------------------------
-// New function: all motor‐running logic goes here
-// --------------------------------------------------
-static void run_motor_task(const ComponentTaskArg* c) {
-    ESP_LOGI("COMPONENT_TASK", "Running motor task for %s", c->compId);
-
-    // Motor control logic goes here
+// Microseconds since *t, and *t moves on to now.
+static uint32_t lap(int64_t* t) {
+    int64_t now = esp_timer_get_time();
+    uint32_t us = (uint32_t)(now - *t);
+    *t = now;
+    return us;
 }
-static void component_task(void* arg) {
-    ComponentTaskArg* c = (ComponentTaskArg*)arg;
-
-    // 1) Wait until it’s time to start
-    if (c->start > 0) {
-        vTaskDelay(pdMS_TO_TICKS(c->start));
-    }
 
-    // if (c->isMotor) {
-    //     // Delegate all motor logic to run_motor_task()
-    //     run_motor_task(c);
-    // }
-    else {
-        // Non‐motor: simple ON for duration, then OFF
-        gpio_set_level(c->pin, 0);  // ON
-        ESP_LOGI("COMPONENT_TASK",
-                 "Component %s ON at %lu ms for %lu ms",
-                 c->compId, (unsigned long)get_millis(), (unsigned long)c->duration);
-        vTaskDelay(pdMS_TO_TICKS(c->duration));
-        gpio_set_level(c->pin, 1);  // OFF
-        ESP_LOGI("COMPONENT_TASK",
-                 "Component %s OFF at %lu ms",
-                 c->compId, (unsigned long)get_millis());
+// Load the precompiled program if it is current, otherwise compile
+// input.json into the edge timeline. `load` gets where the time went.
+static bool load_from_spiffs(Program* prog, DiagLoad* load) {
+    // 7a) Mount SPIFFS
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = "/spiffs",
+        .partition_label = NULL,
+        .max_files = 5,
+        .format_if_mount_failed = true
+    };
+    int64_t t = esp_timer_get_time();
+    ESP_ERROR_CHECK(esp_vfs_spiffs_register(&conf));
+    load->mount_us = lap(&t);
+
+    esp_err_t err = load_binary_program("/spiffs/input.bin", "/spiffs/input.json", prog);
+    load->read_us = lap(&t);
+    if (err == ESP_OK) {
+        load->source = DIAG_LOAD_BINARY;
+#if CONFIG_CYCLE_PROGRAM_PARTITION
+        // Next boot can run it in place without touching SPIFFS.
+        program_flash_install("/spiffs/input.bin");
+        load->save_us = lap(&t);
+#endif
+        return true;
     }
-
-    // Clean up and delete this task
-    free(c);
-    vTaskDelete(NULL);
-}
-
-static void run_phase(const Phase* phase) {
-    // 5a) Compute each component’s absolute (relative to phase) start and end:
-    uint32_t phase_duration = 0;
-    for (int i = 0; i < phase->num_components; i++) {
-        const ComponentInput* comp = &phase->components[i];
-        uint32_t finish_time = comp->start + comp->duration;
-        if (finish_time > phase_duration) {
-            phase_duration = finish_time;
-        }
-
-        // Build argument struct for the component task
-        ComponentTaskArg* arg = malloc(sizeof(ComponentTaskArg));
-        *arg = (ComponentTaskArg){
-            .compId         = comp->compId,
-            .pin            = comp->pin,
-            .start  = comp->start,
-            .duration       = comp->duration,
-        };
-
-        // Name each task after the component for easier debugging:
-        char task_name[MAX_TASK_NAME_LEN];
-        snprintf(task_name, MAX_TASK_NAME_LEN, "comp_%s", comp->compId);
-
-        // Create the FreeRTOS task:
-        xTaskCreate(
-            component_task,
-            task_name,
-            4096,        // stack size; 
-            arg,
-            tskIDLE_PRIORITY + 1,
-            NULL
-        );
+    if (err != ESP_ERR_NOT_FOUND) {
+        ESP_LOGW("APP", "Ignoring input.bin (%s)", esp_err_to_name(err));
     }
-
-    // 5b) Wait until the longest component in this phase is done:
-    //     Since each task self‐deletes exactly when its work is done,
-    //     we simply delay for the full phase duration plus a small buffer.
-    vTaskDelay(pdMS_TO_TICKS(phase_duration + 50));
-}
-
-static bool load_json_config(const char* path) {
-    FILE* file = fopen(path, "r");
-    if (!file) {
-        ESP_LOGE("CONFIG", "Failed to open %s", path);
+    load->source = DIAG_LOAD_JSON;
+    bool parsed = load_json_config("/spiffs/input.json", prog);
+    JsonLoadStats js;
+    load_json_stats(&js);
+    load->read_us += js.read_us;
+    load->parse_us = js.parse_us;
+    load->json_bytes = js.bytes;
+    lap(&t);
+    if (!parsed) {
         return false;
     }
-
-    fseek(file, 0, SEEK_END);
-    long len = ftell(file);
-    rewind(file);
-
-    char* content = malloc(len + 1);
-    fread(content, 1, len, file);
-    content[len] = '\0';
-    fclose(file);
-
-    cJSON* root = cJSON_Parse(content);
-    if (!root) {
-        ESP_LOGE("CONFIG", "Failed to parse JSON");
-        free(content);
+    if (program_compile(prog) != ESP_OK) {
+        program_free(prog);
         return false;
     }
+    load->compile_us = lap(&t);
+    // Keep the compiled form, keyed by the JSON it came from, so the next
+    // boot of the same input.json skips parsing and compiling.
+    uint32_t json_crc;
+    if (program_file_crc("/spiffs/input.json", &json_crc) &&
+        save_binary_program("/spiffs/input.bin", prog, json_crc) == ESP_OK) {
+#if CONFIG_CYCLE_PROGRAM_PARTITION
+        program_flash_install("/spiffs/input.bin");
+#endif
+    }
+    load->save_us = lap(&t);
+    return true;
+}
 
-    NUM_PHASES = cJSON_GetArraySize(root);
-    program_phases = calloc(NUM_PHASES, sizeof(Phase));
-
-    for (int i = 0; i < NUM_PHASES; i++) {
-        cJSON* phaseObj = cJSON_GetArrayItem(root, i);
-        program_phases[i].name = strdup(cJSON_GetObjectItem(phaseObj, "name")->valuestring);
-        program_phases[i].startTime = cJSON_GetObjectItem(phaseObj, "startTime")->valueint;
-
-        cJSON* comps = cJSON_GetObjectItem(phaseObj, "components");
-        int num_comps = cJSON_GetArraySize(comps);
-        program_phases[i].components = calloc(num_comps, sizeof(ComponentInput));
-        program_phases[i].num_components = num_comps;
-
-        // Track the maximum (start + duration) so we know phase duration:
-        uint32_t max_phase_dur = 0;
-
-        for (int j = 0; j < num_comps; j++) {
-            cJSON* compObj = cJSON_GetArrayItem(comps, j);
-            ComponentInput* dst = &program_phases[i].components[j];
-
-            const char* name = cJSON_GetObjectItem(compObj, "compId")->valuestring;
-            dst->compId = strdup(name);
-            dst->pin    = map_name_to_pin(name);
-            dst->start = cJSON_GetObjectItem(compObj, "start")->valueint;
-            dst->duration      = cJSON_GetObjectItem(compObj, "duration")->valueint;
+// Start a cycle of `prog`, `from_ms` into it (0 for all of it).
+static void start_cycle(const Program* prog, uint32_t from_ms) {
+    // 7b) One epoch anchors the whole cycle: every edge and every phase
+    //     deadline is epoch + its compiled time, never "now + delay".
+    // Waits out a bench or an upload still holding the scheduler.
+    scheduler_claim(portMAX_DELAY);
+    int64_t epoch_us = esp_timer_get_time() + CYCLE_START_LEAD_MS * 1000 - (int64_t)from_ms * 1000;
+#if CONFIG_CYCLE_CHECKPOINT
+    checkpoint_begin(prog);
+#endif
+    ESP_ERROR_CHECK(scheduler_start(prog, epoch_us, from_ms));
+}
 
-            uint32_t finish_time = dst->start + dst->duration;
-            if (finish_time > max_phase_dur) {
-                max_phase_dur = finish_time;
-            }
+typedef struct {
+    int32_t  worst_us;
+    uint32_t paused_ms;
+    uint32_t saved_ms;
+    bool     aborted;
+} CycleTotals;
+
+static void log_report(const Program* prog, const PhaseReport* r, CycleTotals* t) {
+    t->aborted |= r->aborted;
+    ESP_LOGI("APP", "%s phase %d (scheduled at %lu ms): %lu edges, drift start %+ld us, end %+ld us, "
+             "worst %+ld us, paused %lu ms",
+             r->aborted ? "Aborted" : "Completed", r->phase,
+             (unsigned long)prog->phases[r->phase].start_ms, (unsigned long)r->edges,
+             (long)r->start_late_us, (long)r->end_late_us, (long)r->max_late_us,
+             (unsigned long)r->paused_ms);
+    if (r->max_late_us > t->worst_us) {
+        t->worst_us = r->max_late_us;
+    }
+    if (r->max_stagger_us) {
+        ESP_LOGI("APP", "Phase %d staggered outputs for inrush by up to %lu us",
+                 r->phase, (unsigned long)r->max_stagger_us);
+    }
+    if (r->saved_ms) {
+        ESP_LOGI("APP", "Phase %d ended on its sensor %lu ms before the timeout",
+                 r->phase, (unsigned long)r->saved_ms);
+    }
+    t->paused_ms += r->paused_ms;
+    t->saved_ms += r->saved_ms;
+}
 
-            ESP_LOGI("CONFIG",
-                     "[LOADED] %s (phase: %s)  start=%u  dur=%u",
-                     name,
-                     program_phases[i].name,
-                     (unsigned int)dst->start,
-                     (unsigned int)dst->duration);
+// Follow the cycle started by start_cycle() to its end and log how it went.
+static void follow_cycle(const Program* prog) {
+    // A pause can hold a phase for any length of time, so there is no
+    // deadline; the cycle is over when the scheduler goes idle, and every
+    // report it made is queued by then. Reports only feed the log.
+    CycleTotals t = { 0 };
+    PhaseReport r;
+    bool idle = false;
+    while (!idle) {
+        if (scheduler_wait_report(&r, pdMS_TO_TICKS(FOLLOW_POLL_MS))) {
+            log_report(prog, &r, &t);
+        } else {
+            idle = scheduler_wait_idle(0);
         }
-
+    }
+    while (scheduler_wait_report(&r, 0)) {
+        log_report(prog, &r, &t);
     }
 
-    cJSON_Delete(root);
-    free(content);
-    return true;
+#if CONFIG_CYCLE_CHECKPOINT
+    checkpoint_end();
+#endif
+    scheduler_release();
+    ESP_LOGI("APP", "Cycle of %lu ms %s, worst edge drift %+ld us, paused %lu ms, %lu ms saved on sensors",
+             (unsigned long)prog->total_ms, t.aborted ? "aborted" : "done",
+             (long)t.worst_us, (unsigned long)t.paused_ms, (unsigned long)t.saved_ms);
 }
-void app_main(void) {
-    // 7a) Mount SPIFFS
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = "/spiffs",
-        .partition_label = NULL,
-        .max_files = 5,
-        .format_if_mount_failed = true
-    };
-    ESP_ERROR_CHECK(esp_vfs_spiffs_register(&conf));
 
-    // Load JSON config
-    if (!load_json_config("/spiffs/input.json")) {
+void app_main(void) {
+    program_init(&program);
+
+    DiagLoad load = { 0 };
+    diag_heap(&load.heap_before, &load.largest_before);
+    int64_t load_start = esp_timer_get_time();
+    bool loaded = false;
+    uint32_t image_crc = 0;   // of the image it was mapped from
+#if CONFIG_CYCLE_PROGRAM_PARTITION
+    esp_err_t err = program_flash_map(&program);
+    loaded = err == ESP_OK;
+    if (loaded) {
+        image_crc    = program_flash_mapped_crc();
+        load.source  = DIAG_LOAD_PARTITION;
+        load.read_us = (uint32_t)(esp_timer_get_time() - load_start);
+    } else {
+        ESP_LOGW("APP", "No usable program partition (%s); using SPIFFS", esp_err_to_name(err));
+    }
+#endif
+    if (!loaded && !load_from_spiffs(&program, &load)) {
         ESP_LOGE("APP", "Could not load configuration");
         return;
     }
+    load.total_us = (uint32_t)(esp_timer_get_time() - load_start);
+    diag_heap(&load.heap_after, &load.largest_after);
+#if CONFIG_CYCLE_DIAGNOSTICS
+    diag_set_load(&load);
+#endif
+    if (program_check(&program, NULL) != ESP_OK) {
+        ESP_LOGE("APP", "Not running a program with conflicting outputs");
+        return;
+    }
 
     // Initialize all GPIO pins to OFF (1)
-    for (int i = 0; i < NUM_COMPONENTS; i++) {
-        gpio_reset_pin(component_states[i].pin);
-        gpio_set_direction(component_states[i].pin, GPIO_MODE_OUTPUT);
-        gpio_set_level(component_states[i].pin, 1);
+    if (outputs_init() != ESP_OK) {
+        ESP_LOGE("APP", "Could not configure outputs");
+        return;
     }
 
-    // 7b) Run phases in order. We assume sorted by JSON order.
-    uint32_t last_phase_start = 0;
-    for (int i = 0; i < NUM_PHASES; i++) {
-        Phase* p = &program_phases[i];
+#if CONFIG_CYCLE_LIGHT_SLEEP
+    // Before the buttons and the console register their wake-ups.
+    if (power_init() != ESP_OK) {
+        ESP_LOGW("APP", "Light sleep unavailable; staying awake");
+    }
+#endif
 
-        // Compute how long to wait relative to previous phase start
-        uint32_t this_delay = 0;
-        if (p->startTime > last_phase_start) {
-            this_delay = p->startTime - last_phase_start;
-        }
+    // Before the scheduler, its only producer, can record anything.
+    if (telemetry_init() != ESP_OK) {
+        ESP_LOGW("APP", "Telemetry unavailable");
+    }
 
-        if (this_delay > 0) {
-            vTaskDelay(pdMS_TO_TICKS(this_delay));
-        }
-        ESP_LOGI("APP", "Starting phase \"%s\" at t=%lu ms (delay=%lu)",
-                 p->name, get_millis(), this_delay);
+    if (scheduler_init() != ESP_OK) {
+        ESP_LOGE("APP", "Could not start the scheduler");
+        return;
+    }
 
-        // Run the phase (spawn component tasks & wait until all finish)
-        run_phase(p);
+#if CONFIG_CYCLE_SENSORS
+    // Without them every phase simply runs to its timeout.
+    if (sensors_init() != ESP_OK) {
+        ESP_LOGW("APP", "Sensors unavailable; phases run their full duration");
+    }
+#endif
+
+    // Cycles run from the slot so a program uploaded meanwhile
+    // (control.c "load") only takes over between cycles.
+    program_slot_init(&program, image_crc);
+    const Program* prog = program_slot_acquire();
+
+    // 7c) Straight after the program and the scheduler, before anything
+    //     slow such as Wi-Fi: a cycle cut short by a power loss carries on
+    //     from its last checkpoint.
+    bool started = false;
+#if CONFIG_CYCLE_CHECKPOINT
+    Checkpoint cp;
+    if (checkpoint_init() != ESP_OK) {
+        ESP_LOGW("APP", "Checkpoints unavailable; a power loss restarts the cycle");
+    } else if (checkpoint_pending(prog, &cp)) {
+        ESP_LOGI("APP", "Resuming the interrupted cycle at %lu ms (phase %u)%s",
+                 (unsigned long)cp.elapsed_ms, (unsigned int)cp.phase, cp.paused ? ", paused" : "");
+        start_cycle(prog, cp.elapsed_ms);
+        if (cp.paused) {
+            // Lands before the first output comes back (CYCLE_START_LEAD_MS).
+            scheduler_command(SCHED_CMD_PAUSE);
+        }
+        started = true;
+    }
+#endif
 
-        ESP_LOGI("APP", "Completed phase \"%s\" at t=%lu ms",
-                 p->name, get_millis());
+    // The cycle still runs without pause/abort, e.g. if the console UART is taken.
+    if (control_init() != ESP_OK) {
+        ESP_LOGW("APP", "Cycle control unavailable");
+    }
 
-        // Update last_phase_start so the next phase’s delay is relative to this one
-        last_phase_start = p->startTime;
+#if CONFIG_CYCLE_HTTP_UPLOAD
+    // Uploads are optional; without Wi-Fi the board still runs its program.
+    if (program_http_start() != ESP_OK) {
+        ESP_LOGW("APP", "Program upload over Wi-Fi unavailable");
+    }
+#endif
+#if CONFIG_CYCLE_SENSOR_UPLOAD
+    if (sensor_upload_start() != ESP_OK) {
+        ESP_LOGW("APP", "Sensor upload unavailable");
     }
+#endif
 
-    ESP_LOGI("APP", "All phases complete. Entering idle.");
     while (1) {
-        vTaskDelay(pdMS_TO_TICKS(1000));  // keep the app alive
+        if (!started) {
+            start_cycle(prog, 0);
+        }
+        follow_cycle(prog);
+        started = false;
+
+        ESP_LOGI("APP", "All phases complete. Waiting for start or a new program.");
+        while (!control_wait_start(portMAX_DELAY)) {
+            vTaskDelay(pdMS_TO_TICKS(1000));  // no control path; keep the app alive
+        }
+#if CONFIG_CYCLE_HTTP_UPLOAD
+        if (program_http_restart_pending()) {
+            ESP_LOGI("APP", "Restarting into the uploaded program");
+            esp_restart();
+        }
+#endif
+        prog = program_slot_acquire();
     }
-}
\ No newline at end of file
+}
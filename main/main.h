@@ -1,3 +1,5 @@
+#pragma once
+
 // ------------------------- PIN MAPPINGS -------------------------
 #define RETRACTOR_PIN        7
 #define DETERGENT_VALVE_PIN  8
@@ -8,4 +10,54 @@
 #define MOTOR_ON_PIN         4
 #define MOTOR_DIRECTION_PIN  10
 #define PAUSE_PIN            0
-#define NUM_COMPONENTS       8
\ No newline at end of file
+
+// ------------------------- SENSOR INPUTS -------------------------
+#define WATER_LEVEL_PIN      6    // level switch to GND, closed when the tub is full
+#define PRESSURE_ADC_CH      2    // ADC1 channel 2 (GPIO2)
+#define TEMPERATURE_ADC_CH   3    // ADC1 channel 3 (GPIO3)
+
+// ------------------------- COMPONENTS -------------------------
+// X(id, name programs use, pin, inrush mA) for every output. The inrush is
+// what switching the output ON draws from the controller's supply for the
+// first few milliseconds (relay coil plus whatever the contact starts);
+// CONFIG_CYCLE_INRUSH_CAP_MA limits how much of it may start at once. The
+// position is the component index in input.bin and lib/program-binary.js:
+// append only.
+#define CYCLE_COMPONENTS(X)                                         \
+    X(RETRACTOR,       "Retractor",       RETRACTOR_PIN,       400) \
+    X(DETERGENT_VALVE, "Detergent Valve", DETERGENT_VALVE_PIN, 300) \
+    X(COLD_VALVE,      "Cold Valve",      COLD_VALVE_PIN,      300) \
+    X(DRAIN_PUMP,      "Drain Pump",      DRAIN_PUMP_PIN,      600) \
+    X(HOT_VALVE,       "Hot Valve",       HOT_VALVE_PIN,       300) \
+    X(SOFTENER_VALVE,  "Softener Valve",  SOFT_VALVE_PIN,      300) \
+    X(MOTOR,           "Motor",           MOTOR_ON_PIN,        800) \
+    X(MOTOR_DIRECTION, "Motor Direction", MOTOR_DIRECTION_PIN, 100)
+
+typedef enum {
+#define COMPONENT_ID(id, name, pin, inrush)  COMP_##id,
+    CYCLE_COMPONENTS(COMPONENT_ID)
+#undef COMPONENT_ID
+    NUM_COMPONENTS
+} ComponentId;
+
+// ------------------------- SENSORS -------------------------
+// X(id, name programs use, kind, source) for every input a phase can end
+// on. A SENSOR_SWITCH reads GPIO `source` as 1 when closed, a SENSOR_ADC
+// reads ADC1 channel `source` in millivolts. The position is the sensor
+// index in input.bin: append only.
+#define CYCLE_SENSORS(X)                                        \
+    X(WATER_LEVEL, "Water Level", SENSOR_SWITCH, WATER_LEVEL_PIN) \
+    X(PRESSURE,    "Pressure",    SENSOR_ADC,    PRESSURE_ADC_CH) \
+    X(TEMPERATURE, "Temperature", SENSOR_ADC,    TEMPERATURE_ADC_CH)
+
+typedef enum {
+    SENSOR_SWITCH,
+    SENSOR_ADC,
+} SensorKind;
+
+typedef enum {
+#define SENSOR_ID(id, name, kind, source)  SENS_##id,
+    CYCLE_SENSORS(SENSOR_ID)
+#undef SENSOR_ID
+    NUM_SENSORS
+} SensorId;
@@ -0,0 +1,289 @@
+#include "motor.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gptimer.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "main.h"
+#include "outputs.h"
+
+static const char* TAG = "MOTOR";
+
+#define MOTOR_TIMER_HZ   1000000        // 1 us ticks
+#define MOTOR_ON_MASK    (1u << MOTOR_ON_PIN)
+#define MOTOR_DIR_MASK   (1u << MOTOR_DIRECTION_PIN)
+#define DEADTIME_US      ((uint64_t)CONFIG_CYCLE_MOTOR_DEADTIME_MS * 1000)
+
+typedef enum {
+    EV_DIR,        // set the direction for the current step
+    EV_ON,
+    EV_OFF,        // end of a step's run time
+    EV_END,        // end of the segment: motor OFF
+    EV_REST,       // direction relay back to rest once the motor has stopped
+    EV_IDLE,       // nothing left to do
+} MotorEvent;
+
+typedef struct {
+    MotorSegment seg;
+    MotorStep    steps[MOTOR_MAX_PATTERN_STEPS];
+    uint32_t     step;         // steps started since the segment began
+    bool         ccw;          // direction relay energized
+    bool         on;           // motor relay energized
+    MotorEvent   next;
+    uint64_t     next_us;      // segment time of `next`
+    uint64_t     on_us;        // EV_ON that follows a pending EV_DIR
+    uint64_t     end_us;
+} MotorState;
+
+static gptimer_handle_t s_timer   = NULL;
+static MotorState       s_state;
+static volatile bool    s_running = false;     // timer armed
+static portMUX_TYPE     s_lock    = portMUX_INITIALIZER_UNLOCKED;
+
+// Run time, pause and direction of step `k` of the current segment.
+static void IRAM_ATTR get_step(const MotorState* s, uint32_t k, MotorStep* out) {
+    switch (s->seg.style) {
+        case RUNNING_STYLE_TOGGLE:
+            *out = (MotorStep){ .on_ms = s->seg.step_ms, .off_ms = s->seg.pause_ms, .ccw = k & 1 };
+            break;
+        case RUNNING_STYLE_PATTERN:
+            *out = s->steps[k % s->seg.num_steps];
+            break;
+        default:
+            *out = (MotorStep){ .on_ms = s->seg.step_ms, .off_ms = s->seg.pause_ms, .ccw = s->seg.ccw };
+            break;
+    }
+}
+
+static void IRAM_ATTR drive(const MotorState* s) {
+    uint32_t set   = (s->on ? 0 : MOTOR_ON_MASK) | (s->ccw ? 0 : MOTOR_DIR_MASK);
+    uint32_t clear = (s->on ? MOTOR_ON_MASK : 0) | (s->ccw ? MOTOR_DIR_MASK : 0);
+    outputs_apply(set, clear);
+}
+
+// Motor OFF at `t`; the direction relay follows half a dead time later.
+static void IRAM_ATTR wind_down(MotorState* s, uint64_t t) {
+    s->on      = false;
+    s->next    = s->ccw ? EV_REST : EV_IDLE;
+    s->next_us = t + DEADTIME_US / 2;
+}
+
+// Apply the event at s->next_us and schedule the one after it. With
+// `output` false only the state advances (used to seek on resume).
+static void IRAM_ATTR handle_event(MotorState* s, bool output) {
+    uint64_t t = s->next_us;
+    MotorStep st;
+    get_step(s, s->step, &st);
+
+    switch (s->next) {
+        case EV_DIR:
+            s->ccw     = st.ccw;
+            s->next    = EV_ON;
+            s->next_us = s->on_us;
+            break;
+
+        case EV_ON:
+            s->on      = true;
+            s->next    = EV_OFF;
+            s->next_us = t + (uint64_t)(st.on_ms ? st.on_ms : 1) * 1000;
+            break;
+
+        case EV_OFF: {
+            MotorStep nx;
+            get_step(s, ++s->step, &nx);
+            uint64_t gap = (uint64_t)st.off_ms * 1000;
+            if (nx.ccw != s->ccw) {
+                // Reverse only with the motor stopped, half-way through the pause.
+                if (gap < DEADTIME_US) {
+                    gap = DEADTIME_US;
+                }
+                s->on      = false;
+                s->next    = EV_DIR;
+                s->next_us = t + gap / 2;
+                s->on_us   = t + gap;
+            } else if (gap > 0) {
+                s->on      = false;
+                s->next    = EV_ON;
+                s->next_us = t + gap;
+            } else {
+                // Same direction, no pause: keep running into the next step.
+                s->next_us = t + (uint64_t)(nx.on_ms ? nx.on_ms : 1) * 1000;
+            }
+            break;
+        }
+
+        case EV_END:
+            wind_down(s, t);
+            break;
+
+        case EV_REST:
+            s->ccw  = false;
+            s->next = EV_IDLE;
+            break;
+
+        case EV_IDLE:
+            return;
+    }
+
+    if (output) {
+        drive(s);
+    }
+    if (s->next < EV_END && s->next_us >= s->end_us) {
+        s->next    = EV_END;
+        s->next_us = s->end_us;
+    }
+}
+
+static bool IRAM_ATTR motor_alarm_cb(gptimer_handle_t timer, const gptimer_alarm_event_data_t* edata, void* ctx) {
+    MotorState* s = &s_state;
+    portENTER_CRITICAL_ISR(&s_lock);
+    if (s_running) {
+        // Everything due by now, so events closer together than the
+        // interrupt latency still come out in order.
+        while (s->next != EV_IDLE && s->next_us <= edata->count_value) {
+            handle_event(s, true);
+        }
+        if (s->next == EV_IDLE) {
+            s_running = false;
+            gptimer_stop(timer);
+        } else {
+            gptimer_alarm_config_t alarm = { .alarm_count = s->next_us };
+            gptimer_set_alarm_action(timer, &alarm);
+        }
+    }
+    portEXIT_CRITICAL_ISR(&s_lock);
+    return false;
+}
+
+// Stop the timer and the motor right now and return whether the direction
+// relay is still energized. halt() and run() also serve motor_stop() from
+// an interrupt, so they only use ISR-safe GPTimer calls.
+static bool halt(void) {
+    portENTER_CRITICAL_SAFE(&s_lock);
+    if (s_running) {
+        s_running = false;
+        gptimer_stop(s_timer);
+    }
+    s_state.on = false;
+    drive(&s_state);
+    bool ccw = s_state.ccw;
+    portEXIT_CRITICAL_SAFE(&s_lock);
+    return ccw;
+}
+
+// Arm the timer for `s`, whose clock currently reads `now_us`.
+static esp_err_t run(const MotorState* s, uint64_t now_us) {
+    gptimer_alarm_config_t alarm = { .alarm_count = s->next_us };
+    esp_err_t err;
+
+    portENTER_CRITICAL_SAFE(&s_lock);
+    s_state = *s;
+    drive(&s_state);
+    err = gptimer_set_raw_count(s_timer, now_us);
+    if (err == ESP_OK) {
+        err = gptimer_set_alarm_action(s_timer, &alarm);
+    }
+    if (err == ESP_OK) {
+        err = gptimer_start(s_timer);
+    }
+    s_running = err == ESP_OK;
+    portEXIT_CRITICAL_SAFE(&s_lock);
+    return err;
+}
+
+esp_err_t motor_init(void) {
+    if (s_timer) {
+        return ESP_OK;
+    }
+
+    const gptimer_config_t cfg = {
+        .clk_src       = GPTIMER_CLK_SRC_DEFAULT,
+        .direction     = GPTIMER_COUNT_UP,
+        .resolution_hz = MOTOR_TIMER_HZ,
+    };
+    esp_err_t err = gptimer_new_timer(&cfg, &s_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create timer: %s", esp_err_to_name(err));
+        return err;
+    }
+    const gptimer_event_callbacks_t cbs = { .on_alarm = motor_alarm_cb };
+    err = gptimer_register_event_callbacks(s_timer, &cbs, NULL);
+    if (err == ESP_OK) {
+        err = gptimer_enable(s_timer);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up timer: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t motor_start(const Program* prog, const MotorSegment* seg, uint32_t elapsed_ms) {
+    if (!s_timer) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (seg->style == RUNNING_STYLE_PATTERN &&
+        (seg->num_steps == 0 || seg->num_steps > MOTOR_MAX_PATTERN_STEPS ||
+         (int)seg->first_step + seg->num_steps > prog->num_steps)) {
+        ESP_LOGE(TAG, "Pattern at %lu ms has a bad step table", (unsigned long)seg->start_ms);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // The direction relay stays where the previous segment left it; the
+    // first step leaves that position like any other reversal.
+    MotorState s;
+    memset(&s, 0, sizeof(s));
+    bool ccw = halt();
+    s.ccw    = ccw;
+    s.seg    = *seg;
+    s.end_us = (uint64_t)(seg->end_ms - seg->start_ms) * 1000;
+    if (seg->style == RUNNING_STYLE_PATTERN) {
+        memcpy(s.steps, &prog->steps[seg->first_step], seg->num_steps * sizeof(MotorStep));
+    }
+    MotorStep first;
+    get_step(&s, 0, &first);
+    if (first.ccw != s.ccw) {
+        s.next    = EV_DIR;
+        s.next_us = DEADTIME_US / 2;
+        s.on_us   = DEADTIME_US;
+    } else {
+        s.next    = EV_ON;
+    }
+
+    // Catch up with where the pattern should be by now, without output.
+    uint64_t now_us = (uint64_t)elapsed_ms * 1000;
+    while (s.next < EV_END && s.next_us <= now_us) {
+        handle_event(&s, false);
+    }
+    if (s.next == EV_END && s.next_us <= now_us) {
+        wind_down(&s, now_us);
+    }
+    if (s.on && s.ccw != ccw) {
+        // Joining mid-step in the other direction: never energize both
+        // relays at once, sit out the rest of this step instead.
+        s.on = false;
+    }
+
+    esp_err_t err = run(&s, now_us);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start pattern: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+void motor_stop(void) {
+    if (!s_timer) {
+        return;
+    }
+    MotorState s = { .ccw = halt() };
+    wind_down(&s, 0);
+    if (s.next != EV_IDLE && run(&s, 0) != ESP_OK) {
+        outputs_apply(MOTOR_ON_MASK | MOTOR_DIR_MASK, 0);
+    }
+}
+
+bool motor_running(void) {
+    return s_running && s_state.next < EV_END;
+}
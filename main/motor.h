@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "program.h"
+
+// ------------------------- MOTOR ENGINE -------------------------
+// Runs one MotorSegment at a time on MOTOR_ON_PIN / MOTOR_DIRECTION_PIN.
+// Every on/off/reverse instant is a GPTimer alarm handled in the ISR, so
+// the rhythm does not depend on task scheduling. Direction only changes
+// while the motor is stopped: half-way through a pause that is at least
+// CONFIG_CYCLE_MOTOR_DEADTIME_MS long. After a segment the direction relay
+// returns to rest (clockwise) half a dead time after the motor stopped.
+
+esp_err_t motor_init(void);
+
+// Start `seg` as if it had been running for `elapsed_ms`. Pattern steps
+// are copied, so `prog` may be unmapped while the segment runs. A segment
+// still running is cut off first. The engine stops by itself at the end
+// of the segment.
+esp_err_t motor_start(const Program* prog, const MotorSegment* seg, uint32_t elapsed_ms);
+
+// Motor OFF now; the direction relay follows as after a segment. Safe to
+// call from an interrupt handler.
+void motor_stop(void);
+
+// A segment is in progress (not counting the direction relay settling).
+bool motor_running(void);
@@ -0,0 +1,42 @@
+#include "outputs.h"
+
+#include "driver/gpio.h"
+#include "soc/soc.h"
+#include "soc/gpio_reg.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "components.h"
+
+static const char* TAG = "OUTPUTS";
+
+static uint32_t s_output_mask = 0;
+
+esp_err_t outputs_init(void) {
+    s_output_mask = 0;
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        gpio_num_t pin = component_states[i].pin;    // GPIO0..31, checked in components.c
+        gpio_reset_pin(pin);
+        gpio_set_level(pin, 1);   // latch OFF before the driver is enabled
+        gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+        gpio_set_level(pin, 1);
+        s_output_mask |= 1u << pin;
+    }
+    return ESP_OK;
+}
+
+void IRAM_ATTR outputs_apply(uint32_t set_mask, uint32_t clear_mask) {
+    REG_WRITE(GPIO_OUT_W1TS_REG, set_mask & s_output_mask);
+    REG_WRITE(GPIO_OUT_W1TC_REG, clear_mask & s_output_mask);
+}
+
+void outputs_all_off(void) {
+    REG_WRITE(GPIO_OUT_W1TS_REG, s_output_mask);
+}
+
+uint32_t outputs_mask(void) {
+    return s_output_mask;
+}
+
+uint32_t outputs_on(void) {
+    return ~REG_READ(GPIO_OUT_REG) & s_output_mask;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// ------------------------- BATCHED OUTPUTS -------------------------
+// All component outputs live in GPIO0..31, so one write to the W1TS/W1TC
+// registers switches every relay that shares a timestamp at once.
+
+// Configure every pin in component_states as an output, all OFF (high).
+esp_err_t outputs_init(void);
+
+// Drive `set_mask` high (OFF) and `clear_mask` low (ON). Bits that are not
+// component outputs are ignored. OFF is written before ON so a relay pair
+// never overlaps, e.g. motor direction against motor on.
+void outputs_apply(uint32_t set_mask, uint32_t clear_mask);
+
+// Every component output OFF.
+void outputs_all_off(void);
+
+// Mask of all pins owned by the component table.
+uint32_t outputs_mask(void);
+
+// Pins that are ON (driven low) right now, whoever switched them.
+uint32_t outputs_on(void);
@@ -0,0 +1,88 @@
+#include "power.h"
+
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "components.h"
+
+static const char* TAG = "POWER";
+
+#define UART_WAKE_EDGES  3    // RX edges that wake the chip; the least the UART accepts
+
+static const char* const s_names[NUM_POWER_HOLDERS] = {
+    [POWER_SCHEDULER] = "sched",
+    [POWER_CONSOLE]   = "console",
+};
+
+static esp_pm_lock_handle_t s_locks[NUM_POWER_HOLDERS];
+static bool                 s_held[NUM_POWER_HOLDERS];
+static bool                 s_enabled = false;
+
+esp_err_t power_init(void) {
+#if CONFIG_CYCLE_LIGHT_SLEEP
+    if (s_enabled) {
+        return ESP_OK;
+    }
+    // Drive the relays through sleep instead of switching the pins to
+    // their sleep configuration.
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        gpio_sleep_sel_dis(component_states[i].pin);
+    }
+    for (int i = 0; i < NUM_POWER_HOLDERS; i++) {
+        esp_err_t err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, s_names[i], &s_locks[i]);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create the %s lock: %s", s_names[i], esp_err_to_name(err));
+            return err;
+        }
+    }
+    esp_err_t err = esp_sleep_enable_gpio_wakeup();
+    if (err != ESP_OK) {
+        return err;
+    }
+    // One clock while awake: frequency scaling would change how long the
+    // edges take, and the sleep is where the current goes down.
+    const esp_pm_config_t cfg = {
+        .max_freq_mhz       = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz       = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+    err = esp_pm_configure(&cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to enable light sleep: %s", esp_err_to_name(err));
+        return err;
+    }
+    s_enabled = true;
+    ESP_LOGI(TAG, "Light sleep when idle, awake from %d ms before each edge", CONFIG_CYCLE_SLEEP_GUARD_MS);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void power_hold(PowerHolder who, bool awake) {
+    if (!s_enabled || s_held[who] == awake) {
+        return;
+    }
+    s_held[who] = awake;
+    if (awake) {
+        esp_pm_lock_acquire(s_locks[who]);
+    } else {
+        esp_pm_lock_release(s_locks[who]);
+    }
+}
+
+esp_err_t power_wake_on_low(gpio_num_t pin) {
+    return s_enabled ? gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL) : ESP_OK;
+}
+
+esp_err_t power_wake_on_uart(uart_port_t port) {
+    if (!s_enabled) {
+        return ESP_OK;
+    }
+    esp_err_t err = uart_set_wakeup_threshold(port, UART_WAKE_EDGES);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return esp_sleep_enable_uart_wakeup(port);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+
+// ------------------------- LOW-POWER IDLE -------------------------
+// With CONFIG_CYCLE_LIGHT_SLEEP the chip enters automatic light sleep
+// (tickless idle) whenever no task has anything to do before the next
+// timer: between cycles, and between far-apart edges of a running one.
+// The outputs keep driving their relays while it sleeps. It wakes on
+// esp_timer, on a button pressed (power_wake_on_low) and on the console
+// UART (power_wake_on_uart).
+//
+// A holder that needs the chip awake, such as the scheduler from just
+// before an edge until it has fired, takes its hold with power_hold(); the
+// chip only sleeps while no one holds it. One task per holder.
+
+typedef enum {
+    POWER_SCHEDULER,      // an edge is close
+    POWER_CONSOLE,        // a command or upload is coming in
+    NUM_POWER_HOLDERS
+} PowerHolder;
+
+// Configure power management. ESP_ERR_NOT_SUPPORTED without
+// CONFIG_CYCLE_LIGHT_SLEEP; the calls below then do nothing.
+esp_err_t power_init(void);
+
+void      power_hold(PowerHolder who, bool awake);
+
+// Wake from light sleep while `pin` is low. The pin's interrupt becomes
+// GPIO_INTR_LOW_LEVEL: an edge interrupt cannot wake the chip.
+esp_err_t power_wake_on_low(gpio_num_t pin);
+
+// Wake on activity on `port`. The characters that wake the chip are lost.
+esp_err_t power_wake_on_uart(uart_port_t port);
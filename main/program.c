@@ -0,0 +1,407 @@
+#include "program.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "components.h"
+#include "crc32.h"
+
+static const char* TAG = "PROGRAM";
+
+#define MAX_OUTPUT_PINS 32     // one bit per GPIO in the set/clear masks
+
+typedef struct {
+    uint32_t time_ms;
+    int8_t   pin;
+    int8_t   delta;            // +1 = component ON, -1 = component OFF
+} RawEdge;
+
+// ------------------------- STATIC POOL -------------------------
+// Every table of the one program that owns memory comes from here, sized
+// by Kconfig, so loading and reloading never touch the heap. The pool
+// is claimed by the first table write and released by program_free().
+
+#define MAX_EDGES  (2 * CONFIG_CYCLE_MAX_COMPONENTS)   // one ON and one OFF per component
+
+static Phase          s_phases[CONFIG_CYCLE_MAX_PHASES];
+static ComponentInput s_components[CONFIG_CYCLE_MAX_COMPONENTS];
+static TimelineEdge   s_edges[MAX_EDGES];
+static MotorStep      s_steps[CONFIG_CYCLE_MAX_MOTOR_STEPS];
+static MotorSegment   s_segments[CONFIG_CYCLE_MAX_MOTOR_SEGMENTS];
+static PhaseTrigger   s_triggers[CONFIG_CYCLE_MAX_TRIGGERS];
+static RawEdge        s_raw[MAX_EDGES];                 // program_compile scratch
+static bool           s_pool_busy = false;
+
+// A program owns the pool if its tables point into it; a struct copy does
+// too, which is how program_slot takes over the boot program.
+static bool owns_pool(const Program* prog) {
+    return !prog->mapped && prog->phases == s_phases;
+}
+
+static esp_err_t claim_pool(Program* prog) {
+    if (owns_pool(prog)) {
+        return ESP_OK;
+    }
+    if (s_pool_busy || prog->mapped) {
+        ESP_LOGE(TAG, "Program pool already in use");
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_pool_busy          = true;
+    prog->phases         = s_phases;
+    prog->cap_phases     = CONFIG_CYCLE_MAX_PHASES;
+    prog->components     = s_components;
+    prog->cap_components = CONFIG_CYCLE_MAX_COMPONENTS;
+    prog->edges          = s_edges;
+    prog->steps          = s_steps;
+    prog->cap_steps      = CONFIG_CYCLE_MAX_MOTOR_STEPS;
+    prog->segments       = s_segments;
+    prog->triggers       = s_triggers;
+    prog->cap_triggers   = CONFIG_CYCLE_MAX_TRIGGERS;
+    return ESP_OK;
+}
+
+static esp_err_t check_room(int count, int cap, const char* what, const char* option) {
+    if (count > cap) {
+        ESP_LOGE(TAG, "More than %d %s (CONFIG_%s)", cap, what, option);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void program_init(Program* prog) {
+    memset(prog, 0, sizeof(*prog));
+}
+
+void program_free(Program* prog) {
+    if (owns_pool(prog)) {
+        s_pool_busy = false;
+    }
+    program_init(prog);
+}
+
+esp_err_t program_reserve(Program* prog, int num_phases, int num_components, int num_edges,
+                          int num_steps, int num_segments, int num_triggers) {
+    program_free(prog);
+    esp_err_t err = check_room(num_phases, CONFIG_CYCLE_MAX_PHASES, "phases", "CYCLE_MAX_PHASES");
+    if (err == ESP_OK) {
+        err = check_room(num_components, CONFIG_CYCLE_MAX_COMPONENTS, "components", "CYCLE_MAX_COMPONENTS");
+    }
+    if (err == ESP_OK) {
+        err = check_room(num_edges, MAX_EDGES, "edges", "CYCLE_MAX_COMPONENTS");
+    }
+    if (err == ESP_OK) {
+        err = check_room(num_steps, CONFIG_CYCLE_MAX_MOTOR_STEPS, "motor steps", "CYCLE_MAX_MOTOR_STEPS");
+    }
+    if (err == ESP_OK) {
+        err = check_room(num_segments, CONFIG_CYCLE_MAX_MOTOR_SEGMENTS, "motor patterns",
+                         "CYCLE_MAX_MOTOR_SEGMENTS");
+    }
+    if (err == ESP_OK) {
+        err = check_room(num_triggers, CONFIG_CYCLE_MAX_TRIGGERS, "sensor triggers", "CYCLE_MAX_TRIGGERS");
+    }
+    return err == ESP_OK ? claim_pool(prog) : err;
+}
+
+esp_err_t program_add_phase(Program* prog, uint32_t startTime) {
+    esp_err_t err = claim_pool(prog);
+    if (err == ESP_OK) {
+        err = check_room(prog->num_phases + 1, prog->cap_phases, "phases", "CYCLE_MAX_PHASES");
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    prog->phases[prog->num_phases++] = (Phase){
+        .startTime       = startTime,
+        .first_component = (uint16_t)prog->num_components,
+    };
+    return ESP_OK;
+}
+
+esp_err_t program_add_component(Program* prog, const ComponentInput* comp) {
+    if (prog->num_phases == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (comp->component >= NUM_COMPONENTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (prog->num_components >= UINT16_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (comp->runningStyle == RUNNING_STYLE_PATTERN &&
+        (comp->num_steps == 0 || (int)comp->first_step + comp->num_steps > prog->num_steps)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = check_room(prog->num_components + 1, prog->cap_components,
+                               "components", "CYCLE_MAX_COMPONENTS");
+    if (err != ESP_OK) {
+        return err;
+    }
+    prog->components[prog->num_components++] = *comp;
+    prog->phases[prog->num_phases - 1].num_components++;
+    return ESP_OK;
+}
+
+esp_err_t program_add_step(Program* prog, const MotorStep* step) {
+    if (prog->num_steps >= UINT16_MAX) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = claim_pool(prog);
+    if (err == ESP_OK) {
+        err = check_room(prog->num_steps + 1, prog->cap_steps, "motor steps", "CYCLE_MAX_MOTOR_STEPS");
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    prog->steps[prog->num_steps++] = *step;
+    return ESP_OK;
+}
+
+esp_err_t program_add_trigger(Program* prog, const PhaseTrigger* trigger) {
+    if (prog->num_phases == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (trigger->sensor >= NUM_SENSORS || trigger->op > TRIGGER_BELOW ||
+        (trigger->component != COMPONENT_NONE && trigger->component >= NUM_COMPONENTS)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = claim_pool(prog);
+    if (err == ESP_OK) {
+        err = check_room(prog->num_triggers + 1, prog->cap_triggers, "sensor triggers", "CYCLE_MAX_TRIGGERS");
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    PhaseTrigger* t = &prog->triggers[prog->num_triggers++];
+    *t = *trigger;
+    t->phase = (uint16_t)(prog->num_phases - 1);
+    return ESP_OK;
+}
+
+// By time; at the same instant ON sorts before OFF so a holder count
+// never drops below zero during the sweep.
+static int raw_edge_cmp(const void* a, const void* b) {
+    const RawEdge* ea = a;
+    const RawEdge* eb = b;
+    if (ea->time_ms != eb->time_ms) {
+        return (ea->time_ms > eb->time_ms) - (ea->time_ms < eb->time_ms);
+    }
+    return eb->delta - ea->delta;
+}
+
+static int segment_cmp(const void* a, const void* b) {
+    const MotorSegment* sa = a;
+    const MotorSegment* sb = b;
+    return (sa->start_ms > sb->start_ms) - (sa->start_ms < sb->start_ms);
+}
+
+esp_err_t program_place_phases(Phase* phases, int num_phases, const ComponentInput* components) {
+    // In 64 bits, so a program too long for the uint32_t cycle clock is
+    // refused instead of wrapping into a short one.
+    uint64_t t = 0;
+    uint32_t prev_startTime = 0;
+    for (int i = 0; i < num_phases; i++) {
+        Phase* ph = &phases[i];
+
+        uint64_t duration = 0;
+        for (int j = 0; j < ph->num_components; j++) {
+            const ComponentInput* c = &components[ph->first_component + j];
+            uint64_t finish_time = (uint64_t)c->start + c->duration;
+            if (finish_time > duration) {
+                duration = finish_time;
+            }
+        }
+
+        if (i > 0) {
+            const Phase* prev = &phases[i - 1];
+            t = (uint64_t)prev->start_ms + prev->duration_ms + PHASE_GAP_MS;
+        }
+        if (ph->startTime > prev_startTime) {
+            t += ph->startTime - prev_startTime;
+        }
+        if (t + duration > UINT32_MAX) {
+            ESP_LOGE(TAG, "Phase %d ends past %lu ms, beyond the cycle clock", i, (unsigned long)UINT32_MAX);
+            return ESP_ERR_INVALID_ARG;
+        }
+        ph->duration_ms = (uint32_t)duration;
+        ph->start_ms    = (uint32_t)t;
+        prev_startTime  = ph->startTime;
+    }
+    return ESP_OK;
+}
+
+// Motor components with a running style are driven by motor.c, not by the
+// edge timeline. There is one motor, so their windows must not overlap;
+// windows of different phases cannot.
+int program_phase_segments(const Phase* ph, const ComponentInput* components, MotorSegment* out) {
+    int k = 0;
+    for (int j = 0; j < ph->num_components; j++) {
+        const ComponentInput* c = &components[ph->first_component + j];
+        if (c->runningStyle == RUNNING_STYLE_NONE || c->duration == 0) {
+            continue;
+        }
+        uint32_t on_ms = ph->start_ms + c->start;
+        out[k++] = (MotorSegment){
+            .start_ms   = on_ms,
+            .end_ms     = on_ms + c->duration,
+            .step_ms    = c->stepTime,
+            .pause_ms   = c->pauseTime,
+            .style      = c->runningStyle,
+            .ccw        = c->ccw,
+            .first_step = c->first_step,
+            .num_steps  = c->num_steps,
+        };
+    }
+    qsort(out, k, sizeof(MotorSegment), segment_cmp);
+    for (int i = 1; i < k; i++) {
+        if (out[i].start_ms < out[i - 1].end_ms) {
+            ESP_LOGE(TAG, "Motor patterns overlap at %lu ms", (unsigned long)out[i].start_ms);
+            return -1;
+        }
+    }
+    return k;
+}
+
+static esp_err_t compile_segments(Program* prog) {
+    int n = 0;
+    for (int i = 0; i < prog->num_components; i++) {
+        n += prog->components[i].runningStyle != RUNNING_STYLE_NONE;
+    }
+    esp_err_t err = check_room(n, CONFIG_CYCLE_MAX_MOTOR_SEGMENTS, "motor patterns", "CYCLE_MAX_MOTOR_SEGMENTS");
+    if (err != ESP_OK) {
+        return err;
+    }
+    int k = 0;
+    for (int i = 0; i < prog->num_phases; i++) {
+        int added = program_phase_segments(&prog->phases[i], prog->components, prog->segments + k);
+        if (added < 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        k += added;
+    }
+    prog->num_segments = k;
+    return ESP_OK;
+}
+
+// Two raw edges per plain component of one phase, sorted, swept into one
+// record per instant. A pin is ON while at least one component holding it
+// is ON; everything that happens at one instant collapses into one record,
+// and only real level changes are kept. `overlaps` (may be NULL) counts
+// components switched ON while already ON, for program_check().
+static int sweep_phase(const Phase* ph, const ComponentInput* components, TimelineEdge* edges,
+                       uint16_t* overlaps) {
+    RawEdge* raw = s_raw;
+    int num_raw = 0;
+    for (int j = 0; j < ph->num_components; j++) {
+        const ComponentInput* c = &components[ph->first_component + j];
+        if (c->runningStyle != RUNNING_STYLE_NONE) {
+            continue;
+        }
+        uint32_t on_ms = ph->start_ms + c->start;
+        int8_t pin = (int8_t)component_states[c->component].pin;
+        raw[num_raw++] = (RawEdge){ .time_ms = on_ms,               .pin = pin, .delta = +1 };
+        raw[num_raw++] = (RawEdge){ .time_ms = on_ms + c->duration, .pin = pin, .delta = -1 };
+    }
+    qsort(raw, num_raw, sizeof(RawEdge), raw_edge_cmp);
+
+    uint16_t holders[MAX_OUTPUT_PINS] = {0};
+    uint32_t on_mask = 0;
+    uint32_t shared_mask = 0;       // pins held by two or more components
+    int num_edges = 0;
+    for (int i = 0; i < num_raw; ) {
+        uint32_t now = raw[i].time_ms;
+        uint32_t before = on_mask;
+        uint32_t shared_before = shared_mask;
+        for (; i < num_raw && raw[i].time_ms == now; i++) {
+            int pin = raw[i].pin;
+            if (raw[i].delta > 0) {
+                if (holders[pin]++ == 0) {
+                    on_mask |= 1u << pin;
+                } else if (holders[pin] == 2) {
+                    shared_mask |= 1u << pin;
+                }
+            } else if (--holders[pin] == 0) {
+                on_mask &= ~(1u << pin);
+            } else if (holders[pin] == 1) {
+                shared_mask &= ~(1u << pin);
+            }
+        }
+        // Overlapping entries of one component merge into one ON stretch.
+        // One ending where the next starts is not an overlap.
+        for (uint32_t m = shared_mask & ~shared_before; overlaps && m; m &= m - 1) {
+            overlaps[component_at_pin(__builtin_ctz(m))]++;
+        }
+
+        uint32_t turned_on  = on_mask & ~before;
+        uint32_t turned_off = before & ~on_mask;
+        if (turned_on || turned_off) {
+            edges[num_edges++] = (TimelineEdge){
+                .abs_time_ms     = now,
+                .gpio_mask_set   = turned_off,
+                .gpio_mask_clear = turned_on,
+            };
+        }
+    }
+    return num_edges;
+}
+
+int program_phase_edges(const Phase* ph, const ComponentInput* components, TimelineEdge* out) {
+    return sweep_phase(ph, components, out, NULL);
+}
+
+esp_err_t program_compile(Program* prog) {
+    esp_err_t err = claim_pool(prog);    // mapped images come compiled
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // 1) Place every phase on the cycle clock. Every time below then fits
+    //    in 32 bits: no component ends after its phase.
+    err = program_place_phases(prog->phases, prog->num_phases, prog->components);
+    if (err != ESP_OK) {
+        return err;
+    }
+    prog->total_ms = prog->num_phases
+        ? prog->phases[prog->num_phases - 1].start_ms + prog->phases[prog->num_phases - 1].duration_ms
+        : 0;
+
+    err = compile_segments(prog);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // 2) Edges phase by phase. Every phase begins and ends with its outputs
+    //    OFF and phases never touch (PHASE_GAP_MS), so this is the same as
+    //    one sweep over the whole cycle. At most two edges per component,
+    //    so they fit s_raw and s_edges.
+    memset(prog->overlaps, 0, sizeof(prog->overlaps));
+    int num_edges = 0;
+    for (int i = 0; i < prog->num_phases; i++) {
+        num_edges += sweep_phase(&prog->phases[i], prog->components, prog->edges + num_edges, prog->overlaps);
+    }
+    prog->num_edges = num_edges;
+
+    ESP_LOGI(TAG, "Compiled %d phases / %d components into %d edges + %d motor patterns, cycle %lu ms",
+             prog->num_phases, prog->num_components, num_edges, prog->num_segments,
+             (unsigned long)prog->total_ms);
+    return ESP_OK;
+}
+
+uint32_t program_hash(const Program* prog) {
+    uint32_t crc = crc32_update(0, &prog->total_ms, sizeof(prog->total_ms));
+    crc = crc32_update(crc, prog->phases, (size_t)prog->num_phases * sizeof(Phase));
+    crc = crc32_update(crc, prog->edges, (size_t)prog->num_edges * sizeof(TimelineEdge));
+    crc = crc32_update(crc, prog->segments, (size_t)prog->num_segments * sizeof(MotorSegment));
+    crc = crc32_update(crc, prog->steps, (size_t)prog->num_steps * sizeof(MotorStep));
+    return crc32_update(crc, prog->triggers, (size_t)prog->num_triggers * sizeof(PhaseTrigger));
+}
+
+int program_phase_at(const Program* prog, uint32_t at_ms) {
+    int phase = 0;
+    while (phase < prog->num_phases &&
+           prog->phases[phase].start_ms + prog->phases[phase].duration_ms <= at_ms) {
+        phase++;
+    }
+    return phase;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "main.h"
+
+#define PHASE_GAP_MS   50     // settle time between the end of one phase and the next
+
+// ------------------------- PROGRAM MODEL -------------------------
+// A program is loaded into flat phase/component tables and then compiled
+// into one time-sorted array of output edges. Nothing in here keeps the
+// name strings from input.json; those are only needed while loading.
+//
+// The tables live in a static pool sized by CONFIG_CYCLE_MAX_* (one
+// program owns it at a time) or, for program_bin_view(), in an image owned
+// elsewhere. Nothing is allocated from the heap.
+
+typedef enum {
+    RUNNING_STYLE_NONE = 0,
+    RUNNING_STYLE_TOGGLE,
+    RUNNING_STYLE_SINGLE_DIR,
+    RUNNING_STYLE_PATTERN,        // explicit reversal sequence (MotorStep list)
+} RunningStyle;
+
+#define MOTOR_MAX_PATTERN_STEPS  16
+
+typedef struct {
+    uint8_t     component;        // ComponentId (components.h)
+    uint8_t     runningStyle;     // RunningStyle
+    uint8_t     ccw;              // RUNNING_STYLE_SINGLE_DIR: run counter-clockwise
+    uint8_t     reserved;
+    uint32_t    start;            // ms delay from phase start before running
+    uint32_t    duration;         // how long (ms) to run this component
+    uint32_t    stepTime;         // used for motor styles
+    uint32_t    pauseTime;        // only used if runningStyle == RUNNING_STYLE_SINGLE_DIR
+    uint16_t    first_step;       // RUNNING_STYLE_PATTERN: slice of Program.steps
+    uint16_t    num_steps;
+} ComponentInput;
+
+// One step of a motor reversal sequence: run for on_ms in the given
+// direction, then stop for off_ms. The sequence repeats for the whole
+// component duration.
+typedef struct {
+    uint32_t    on_ms;
+    uint32_t    off_ms;
+    uint8_t     ccw;
+    uint8_t     reserved[3];
+} MotorStep;
+
+// A motor component with a running style, compiled. The timeline does not
+// carry its MOTOR_ON/MOTOR_DIRECTION edges; motor.c generates them from a
+// hardware timer between start_ms and end_ms.
+typedef struct {
+    uint32_t    start_ms;         // from cycle start
+    uint32_t    end_ms;
+    uint32_t    step_ms;          // TOGGLE / SINGLE_DIR
+    uint32_t    pause_ms;
+    uint8_t     style;            // RunningStyle, never RUNNING_STYLE_NONE
+    uint8_t     ccw;              // SINGLE_DIR
+    uint16_t    first_step;       // PATTERN: slice of Program.steps
+    uint16_t    num_steps;
+    uint16_t    reserved;
+} MotorSegment;
+
+typedef struct {
+    uint32_t    startTime;        // as given in input.json (see program_compile)
+    uint32_t    start_ms;         // compiled: absolute start from cycle start
+    uint32_t    duration_ms;      // compiled: latest component finish in this phase
+    uint16_t    first_component;
+    uint16_t    num_components;
+} Phase;
+
+typedef enum {
+    TRIGGER_ABOVE = 0,            // met once the value is over the threshold
+    TRIGGER_BELOW,                // met once the value is under it
+} TriggerOp;
+
+// Ends a phase, or one component in it, as soon as a sensor crosses a
+// threshold. The compiled timeline is untouched: the phase's duration is
+// the timeout if the condition never comes (timeline.h).
+typedef struct {
+    uint16_t    phase;
+    uint8_t     component;        // ComponentId, or COMPONENT_NONE for the whole phase
+    uint8_t     sensor;           // SensorId
+    uint8_t     op;               // TriggerOp
+    uint8_t     reserved[3];
+    int32_t     threshold;        // 0/1 for a switch, mV for an ADC sensor
+} PhaseTrigger;
+
+// One record per instant at which any output changes. Relays are active
+// low, so pins switching ON appear in gpio_mask_clear and pins switching
+// OFF in gpio_mask_set.
+typedef struct {
+    uint32_t    abs_time_ms;      // from cycle start
+    uint32_t    gpio_mask_set;    // pins driven high (OFF)
+    uint32_t    gpio_mask_clear;  // pins driven low (ON)
+} TimelineEdge;
+
+typedef struct {
+    Phase*          phases;
+    int             num_phases;
+    int             cap_phases;
+    ComponentInput* components;
+    int             num_components;
+    int             cap_components;
+    TimelineEdge*   edges;
+    int             num_edges;
+    MotorStep*      steps;
+    int             num_steps;
+    int             cap_steps;
+    MotorSegment*   segments;     // sorted by start_ms, never overlapping
+    int             num_segments;
+    PhaseTrigger*   triggers;     // sorted by phase
+    int             num_triggers;
+    int             cap_triggers;
+    uint32_t        total_ms;     // end of the last phase
+    uint16_t        overlaps[NUM_COMPONENTS];  // compile: switched ON while already ON (0 for images)
+    bool            mapped;       // tables point into an image owned elsewhere (program_bin_view)
+} Program;
+
+void      program_init(Program* prog);
+// Give the pool back (a single reset; nothing to free piecemeal).
+void      program_free(Program* prog);
+
+// Claim the pool for this many records, e.g. before filling the tables
+// from a precompiled file. ESP_ERR_NO_MEM if a count is over its Kconfig
+// limit, ESP_ERR_INVALID_STATE if another program holds the pool. Counts
+// are left at zero.
+esp_err_t program_reserve(Program* prog, int num_phases, int num_components, int num_edges,
+                          int num_steps, int num_segments, int num_triggers);
+
+// Start a new phase; following components are added to it.
+esp_err_t program_add_phase(Program* prog, uint32_t startTime);
+esp_err_t program_add_component(Program* prog, const ComponentInput* comp);
+
+// Append one reversal step; the loader points the next component's
+// first_step/num_steps at the steps it added.
+esp_err_t program_add_step(Program* prog, const MotorStep* step);
+
+// Append a sensor condition to the current (last) phase; trigger->phase
+// is filled in here.
+esp_err_t program_add_trigger(Program* prog, const PhaseTrigger* trigger);
+
+// Lay the phases out on one cycle clock and build the edge timeline.
+// Phase i starts PHASE_GAP_MS after phase i-1 ends, plus any increase of
+// startTime over the previous phase, which matches how the phase loop
+// has always spaced phases. Motor components with a running style become
+// MotorSegments instead of edges; overlapping motor patterns are rejected.
+esp_err_t program_compile(Program* prog);
+
+// The steps of program_compile(), for recompiling single phases
+// (program_patch.h). Place `phases` on the cycle clock from their
+// startTime and components. Then the motor windows and the edges of one
+// placed phase: a phase begins and ends with its outputs OFF, so neither
+// depends on any other phase. `out` needs room for one segment, or two
+// edges, per component of the phase. They return how many they wrote;
+// program_phase_segments() returns -1 if motor patterns overlap;
+// program_place_phases() ESP_ERR_INVALID_ARG if a phase would end after
+// UINT32_MAX ms.
+// program_phase_edges() shares program_compile()'s scratch: one caller
+// at a time.
+esp_err_t program_place_phases(Phase* phases, int num_phases, const ComponentInput* components);
+int       program_phase_segments(const Phase* ph, const ComponentInput* components, MotorSegment* out);
+int       program_phase_edges(const Phase* ph, const ComponentInput* components, TimelineEdge* out);
+
+// CRC-32 of what a cycle runs (phases, edges, motor patterns and steps,
+// sensor triggers): the same program gives the same value however it was
+// loaded, compiled from input.json or read from an image.
+uint32_t  program_hash(const Program* prog);
+
+// Phase in progress `at_ms` into the cycle: the first one that has not
+// ended by then, or num_phases past the end.
+int       program_phase_at(const Program* prog, uint32_t at_ms);
@@ -0,0 +1,437 @@
+#include "program_bin.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "components.h"
+#include "crc32.h"
+
+static const char* TAG = "CONFIG";
+
+// The file sections are read straight into these structures.
+_Static_assert(sizeof(ProgramBinHeader) == 40, "ProgramBinHeader layout");
+_Static_assert(sizeof(ProgramBinComponent) == 24, "ProgramBinComponent layout");
+_Static_assert(sizeof(Phase) == 16, "Phase must match the on-disk phase record");
+_Static_assert(sizeof(TimelineEdge) == 12, "TimelineEdge must match the on-disk edge record");
+_Static_assert(sizeof(MotorSegment) == 24, "MotorSegment must match the on-disk segment record");
+_Static_assert(sizeof(MotorStep) == 12, "MotorStep must match the on-disk step record");
+_Static_assert(sizeof(PhaseTrigger) == 12, "PhaseTrigger must match the on-disk trigger record");
+// An image's component table is used in place as ComponentInput.
+_Static_assert(sizeof(ComponentInput) == sizeof(ProgramBinComponent) &&
+               offsetof(ComponentInput, start) == offsetof(ProgramBinComponent, start) &&
+               offsetof(ComponentInput, pauseTime) == offsetof(ProgramBinComponent, pauseTime) &&
+               offsetof(ComponentInput, num_steps) == offsetof(ProgramBinComponent, num_steps),
+               "ComponentInput must match the on-disk component record");
+
+#define PIN_TABLE_MAX  32
+
+bool program_file_crc(const char* path, uint32_t* crc) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    uint8_t buf[128];
+    uint32_t c = 0;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        c = crc32_update(c, buf, n);
+    }
+    fclose(f);
+    *crc = c;
+    return true;
+}
+
+// fread exactly `len` bytes and fold them into the running CRC.
+static bool read_section(FILE* f, void* dst, size_t len, uint32_t* crc) {
+    if (len == 0) {
+        return true;
+    }
+    if (fread(dst, 1, len, f) != len) {
+        return false;
+    }
+    *crc = crc32_update(*crc, dst, len);
+    return true;
+}
+
+static size_t pin_table_bytes(const ProgramBinHeader* hdr) {
+    return (hdr->num_pins + 3u) & ~3u;
+}
+
+static esp_err_t check_header(const ProgramBinHeader* hdr) {
+    if (hdr->magic != PROGRAM_BIN_MAGIC || hdr->header_size != sizeof(*hdr)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (hdr->version != PROGRAM_BIN_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    if (hdr->num_pins != NUM_COMPONENTS || pin_table_bytes(hdr) > PIN_TABLE_MAX) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+// The firmware's pin table must match the one the image was built against.
+static esp_err_t check_pins(const uint8_t* pins, const char* name) {
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        if (pins[i] != component_states[i].pin) {
+            ESP_LOGW(TAG, "%s: pin table differs from firmware (%s)", name, component_states[i].name);
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t check_phases(const Phase* phases, int num_phases, uint32_t num_components) {
+    for (int i = 0; i < num_phases; i++) {
+        if ((uint32_t)phases[i].first_component + phases[i].num_components > num_components) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+// The compiler and a patch index component_states[] and Program.steps
+// with these, so the CRC alone is not enough.
+static esp_err_t check_components(const ComponentInput* comps, uint32_t num_components, int num_steps) {
+    for (uint32_t i = 0; i < num_components; i++) {
+        const ComponentInput* c = &comps[i];
+        if (c->component >= NUM_COMPONENTS || c->runningStyle > RUNNING_STYLE_PATTERN ||
+            (int)c->first_step + c->num_steps > num_steps) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t check_segments(const MotorSegment* segs, int num_segments, int num_steps) {
+    for (int i = 0; i < num_segments; i++) {
+        const MotorSegment* m = &segs[i];
+        if (m->end_ms < m->start_ms || (i > 0 && m->start_ms < segs[i - 1].end_ms)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (m->style == RUNNING_STYLE_PATTERN &&
+            (m->num_steps == 0 || m->num_steps > MOTOR_MAX_PATTERN_STEPS ||
+             (int)m->first_step + m->num_steps > num_steps)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t check_triggers(const PhaseTrigger* triggers, int num_triggers, int num_phases) {
+    for (int i = 0; i < num_triggers; i++) {
+        const PhaseTrigger* k = &triggers[i];
+        if (k->phase >= num_phases || (i > 0 && k->phase < triggers[i - 1].phase)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        if (k->sensor >= NUM_SENSORS || k->op > TRIGGER_BELOW ||
+            (k->component != COMPONENT_NONE && k->component >= NUM_COMPONENTS)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t read_program(FILE* f, const char* bin_path, const char* json_path, Program* prog) {
+    ProgramBinHeader hdr;
+    uint32_t crc = 0;
+
+    // 1) Header: format, version and the firmware's pin table must match.
+    if (fread(&hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = check_header(&hdr);
+    if (err != ESP_OK) {
+        return err;
+    }
+    crc = crc32_update(crc, &hdr, offsetof(ProgramBinHeader, crc));
+
+    uint8_t pins[PIN_TABLE_MAX];
+    if (!read_section(f, pins, pin_table_bytes(&hdr), &crc)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    err = check_pins(pins, bin_path);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // 2) Source check: the binary must have been built from this input.json.
+    uint32_t json_crc;
+    if (json_path && program_file_crc(json_path, &json_crc) && json_crc != hdr.source_crc) {
+        ESP_LOGW(TAG, "%s is older than %s", bin_path, json_path);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // 3) Sections go straight into the program tables.
+    err = program_reserve(prog, hdr.num_phases, hdr.num_components, hdr.num_edges,
+                          hdr.num_steps, hdr.num_segments, hdr.num_triggers);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (!read_section(f, prog->phases, (size_t)hdr.num_phases * sizeof(Phase), &crc)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    for (uint32_t i = 0; i < hdr.num_components; i++) {
+        ProgramBinComponent rec;
+        if (!read_section(f, &rec, sizeof(rec), &crc)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        prog->components[i] = (ComponentInput){
+            .component    = rec.component,
+            .start        = rec.start,
+            .duration     = rec.duration,
+            .stepTime     = rec.stepTime,
+            .pauseTime    = rec.pauseTime,
+            .runningStyle = rec.runningStyle,
+            .ccw          = rec.ccw,
+            .first_step   = rec.first_step,
+            .num_steps    = rec.num_steps,
+        };
+    }
+    if (!read_section(f, prog->edges, (size_t)hdr.num_edges * sizeof(TimelineEdge), &crc) ||
+        !read_section(f, prog->segments, (size_t)hdr.num_segments * sizeof(MotorSegment), &crc) ||
+        !read_section(f, prog->steps, (size_t)hdr.num_steps * sizeof(MotorStep), &crc) ||
+        !read_section(f, prog->triggers, (size_t)hdr.num_triggers * sizeof(PhaseTrigger), &crc)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (crc != hdr.crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    err = check_phases(prog->phases, hdr.num_phases, hdr.num_components);
+    if (err == ESP_OK) {
+        err = check_components(prog->components, hdr.num_components, hdr.num_steps);
+    }
+    if (err == ESP_OK) {
+        err = check_segments(prog->segments, hdr.num_segments, hdr.num_steps);
+    }
+    if (err == ESP_OK) {
+        err = check_triggers(prog->triggers, hdr.num_triggers, hdr.num_phases);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    prog->num_phases     = hdr.num_phases;
+    prog->num_components = (int)hdr.num_components;
+    prog->num_edges      = (int)hdr.num_edges;
+    prog->num_segments   = hdr.num_segments;
+    prog->num_steps      = hdr.num_steps;
+    prog->num_triggers   = hdr.num_triggers;
+    prog->total_ms       = hdr.total_ms;
+    return ESP_OK;
+}
+
+esp_err_t load_binary_program(const char* bin_path, const char* json_path, Program* prog) {
+    FILE* f = fopen(bin_path, "rb");
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = read_program(f, bin_path, json_path, prog);
+    fclose(f);
+
+    if (err != ESP_OK) {
+        program_free(prog);
+        return err;
+    }
+    ESP_LOGI(TAG, "Loaded %s: %d phases, %d edges, cycle %lu ms",
+             bin_path, prog->num_phases, prog->num_edges, (unsigned long)prog->total_ms);
+    return ESP_OK;
+}
+
+// fwrite `len` bytes and fold them into the running CRC; with `f` NULL
+// only the CRC.
+static bool write_section(FILE* f, const void* src, size_t len, uint32_t* crc) {
+    if (len == 0) {
+        return true;
+    }
+    *crc = crc32_update(*crc, src, len);
+    return !f || fwrite(src, 1, len, f) == len;
+}
+
+// Everything after the header. Run once for the CRC, then to write.
+static bool write_sections(FILE* f, const Program* prog, const ProgramBinHeader* hdr, uint32_t* crc) {
+    uint8_t pins[PIN_TABLE_MAX] = { 0 };
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        pins[i] = component_states[i].pin;
+    }
+    if (!write_section(f, pins, pin_table_bytes(hdr), crc) ||
+        !write_section(f, prog->phases, (size_t)prog->num_phases * sizeof(Phase), crc)) {
+        return false;
+    }
+    for (int i = 0; i < prog->num_components; i++) {
+        const ComponentInput* c = &prog->components[i];
+        const ProgramBinComponent rec = {
+            .component    = c->component,
+            .runningStyle = c->runningStyle,
+            .ccw          = c->ccw,
+            .start        = c->start,
+            .duration     = c->duration,
+            .stepTime     = c->stepTime,
+            .pauseTime    = c->pauseTime,
+            .first_step   = c->first_step,
+            .num_steps    = c->num_steps,
+        };
+        if (!write_section(f, &rec, sizeof(rec), crc)) {
+            return false;
+        }
+    }
+    return write_section(f, prog->edges, (size_t)prog->num_edges * sizeof(TimelineEdge), crc) &&
+           write_section(f, prog->segments, (size_t)prog->num_segments * sizeof(MotorSegment), crc) &&
+           write_section(f, prog->steps, (size_t)prog->num_steps * sizeof(MotorStep), crc) &&
+           write_section(f, prog->triggers, (size_t)prog->num_triggers * sizeof(PhaseTrigger), crc);
+}
+
+static ProgramBinHeader make_header(const Program* prog, uint32_t source_crc) {
+    return (ProgramBinHeader){
+        .magic          = PROGRAM_BIN_MAGIC,
+        .version        = PROGRAM_BIN_VERSION,
+        .header_size    = sizeof(ProgramBinHeader),
+        .num_pins       = NUM_COMPONENTS,
+        .num_phases     = (uint16_t)prog->num_phases,
+        .num_components = (uint32_t)prog->num_components,
+        .num_edges      = (uint32_t)prog->num_edges,
+        .total_ms       = prog->total_ms,
+        .source_crc     = source_crc,
+        .num_segments   = (uint16_t)prog->num_segments,
+        .num_steps      = (uint16_t)prog->num_steps,
+        .num_triggers   = (uint16_t)prog->num_triggers,
+    };
+}
+
+esp_err_t save_binary_program(const char* bin_path, const Program* prog, uint32_t source_crc) {
+    ProgramBinHeader hdr = make_header(prog, source_crc);
+    uint32_t crc = crc32_update(0, &hdr, offsetof(ProgramBinHeader, crc));
+    write_sections(NULL, prog, &hdr, &crc);
+    hdr.crc = crc;
+
+    char tmp_path[64];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", bin_path);
+    FILE* f = fopen(tmp_path, "wb");
+    if (!f) {
+        return ESP_FAIL;
+    }
+    crc = 0;
+    bool ok = fwrite(&hdr, 1, sizeof(hdr), f) == sizeof(hdr) && write_sections(f, prog, &hdr, &crc);
+    ok = fclose(f) == 0 && ok;
+    if (ok) {
+        // SPIFFS rename does not replace an existing file.
+        remove(bin_path);
+        ok = rename(tmp_path, bin_path) == 0;
+    }
+    if (!ok) {
+        remove(tmp_path);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Saved %s: %d phases, %d edges", bin_path, prog->num_phases, prog->num_edges);
+    return ESP_OK;
+}
+
+esp_err_t program_bin_view(const void* image, size_t size, Program* prog) {
+    const uint8_t* base = image;
+    const ProgramBinHeader* hdr = image;
+    if (size < sizeof(*hdr)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = check_header(hdr);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    size_t off_pins       = sizeof(*hdr);
+    size_t off_phases     = off_pins + pin_table_bytes(hdr);
+    size_t off_components = off_phases + (size_t)hdr->num_phases * sizeof(Phase);
+    size_t off_edges      = off_components + (size_t)hdr->num_components * sizeof(ProgramBinComponent);
+    size_t off_segments   = off_edges + (size_t)hdr->num_edges * sizeof(TimelineEdge);
+    size_t off_steps      = off_segments + (size_t)hdr->num_segments * sizeof(MotorSegment);
+    size_t off_triggers   = off_steps + (size_t)hdr->num_steps * sizeof(MotorStep);
+    size_t total          = off_triggers + (size_t)hdr->num_triggers * sizeof(PhaseTrigger);
+    if (total > size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    err = check_pins(base + off_pins, "program image");
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint32_t crc = crc32_update(0, hdr, offsetof(ProgramBinHeader, crc));
+    crc = crc32_update(crc, base + off_pins, total - off_pins);
+    if (crc != hdr->crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    const Phase* phases = (const Phase*)(base + off_phases);
+    const MotorSegment* segments = (const MotorSegment*)(base + off_segments);
+    const ComponentInput* components = (const ComponentInput*)(base + off_components);
+    err = check_phases(phases, hdr->num_phases, hdr->num_components);
+    if (err == ESP_OK) {
+        err = check_components(components, hdr->num_components, hdr->num_steps);
+    }
+    if (err == ESP_OK) {
+        err = check_segments(segments, hdr->num_segments, hdr->num_steps);
+    }
+    if (err == ESP_OK) {
+        err = check_triggers((const PhaseTrigger*)(base + off_triggers), hdr->num_triggers, hdr->num_phases);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    program_free(prog);
+    prog->phases       = (Phase*)phases;
+    prog->num_phases   = hdr->num_phases;
+    prog->components     = (ComponentInput*)components;
+    prog->num_components = (int)hdr->num_components;
+    prog->edges        = (TimelineEdge*)(base + off_edges);
+    prog->num_edges    = (int)hdr->num_edges;
+    prog->segments     = (MotorSegment*)segments;
+    prog->num_segments = hdr->num_segments;
+    prog->steps        = (MotorStep*)(base + off_steps);
+    prog->num_steps    = hdr->num_steps;
+    prog->triggers     = (PhaseTrigger*)(base + off_triggers);
+    prog->num_triggers = hdr->num_triggers;
+    prog->total_ms     = hdr->total_ms;
+    prog->mapped       = true;
+    return ESP_OK;
+}
+
+// Copy one table to its place in the image, unless it is already there.
+static uint8_t* put_section(uint8_t* p, const void* src, size_t len) {
+    if (len && p != src) {
+        memmove(p, src, len);
+    }
+    return p + len;
+}
+
+esp_err_t program_bin_write(const Program* prog, uint32_t source_crc, void* dst, size_t cap, size_t* size) {
+    ProgramBinHeader hdr = make_header(prog, source_crc);
+    size_t total = PROGRAM_BIN_PHASES_OFFSET
+        + (size_t)prog->num_phases * sizeof(Phase)
+        + (size_t)prog->num_components * sizeof(ProgramBinComponent)
+        + (size_t)prog->num_edges * sizeof(TimelineEdge)
+        + (size_t)prog->num_segments * sizeof(MotorSegment)
+        + (size_t)prog->num_steps * sizeof(MotorStep)
+        + (size_t)prog->num_triggers * sizeof(PhaseTrigger);
+    if (total > cap) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint8_t* base = dst;
+    uint8_t* pins = base + sizeof(hdr);
+    memset(pins, 0, pin_table_bytes(&hdr));
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        pins[i] = component_states[i].pin;
+    }
+    uint8_t* p = pins + pin_table_bytes(&hdr);
+    p = put_section(p, prog->phases, (size_t)prog->num_phases * sizeof(Phase));
+    p = put_section(p, prog->components, (size_t)prog->num_components * sizeof(ProgramBinComponent));
+    p = put_section(p, prog->edges, (size_t)prog->num_edges * sizeof(TimelineEdge));
+    p = put_section(p, prog->segments, (size_t)prog->num_segments * sizeof(MotorSegment));
+    p = put_section(p, prog->steps, (size_t)prog->num_steps * sizeof(MotorStep));
+    put_section(p, prog->triggers, (size_t)prog->num_triggers * sizeof(PhaseTrigger));
+
+    hdr.crc = crc32_update(crc32_update(0, &hdr, offsetof(ProgramBinHeader, crc)), pins, total - sizeof(hdr));
+    memcpy(base, &hdr, sizeof(hdr));
+    *size = total;
+    return ESP_OK;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "program.h"
+
+// ------------------------- BINARY PROGRAM FORMAT -------------------------
+// input.bin is a precompiled program, generated next to input.json by the
+// Node server (lib/program-binary.js). All fields are little endian.
+//
+//   ProgramBinHeader                       40 bytes
+//   pin table                              num_pins x u8 GPIO, padded to 4
+//   phases                                 num_phases x Phase (16 bytes)
+//   components                             num_components x ProgramBinComponent
+//   edges                                  num_edges x TimelineEdge (12 bytes)
+//   motor segments                         num_segments x MotorSegment (24 bytes)
+//   motor steps                            num_steps x MotorStep (12 bytes)
+//   sensor triggers                        num_triggers x PhaseTrigger (12 bytes)
+//
+// Version 2 added the motor sections and version 3 the sensor triggers;
+// older files are rebuilt from input.json.
+//
+// `crc` covers the header up to the crc field and everything after the
+// header. The pin table lists the GPIO of each entry of component_states,
+// in order; a file built against a different table is stale.
+
+#define PROGRAM_BIN_MAGIC    0x504F5943u   // "CYOP"
+#define PROGRAM_BIN_VERSION  3
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint16_t num_pins;
+    uint16_t num_phases;
+    uint32_t num_components;
+    uint32_t num_edges;
+    uint32_t total_ms;
+    uint32_t source_crc;     // CRC-32 of the input.json it was compiled from
+    uint16_t num_segments;
+    uint16_t num_steps;
+    uint16_t num_triggers;
+    uint16_t reserved;
+    uint32_t crc;
+} ProgramBinHeader;
+
+typedef struct {
+    uint8_t  component;      // index into the pin table
+    uint8_t  runningStyle;
+    uint8_t  ccw;
+    uint8_t  reserved;
+    uint32_t start;
+    uint32_t duration;
+    uint32_t stepTime;
+    uint32_t pauseTime;
+    uint16_t first_step;
+    uint16_t num_steps;
+} ProgramBinComponent;
+
+// Load `bin_path` into `prog`, already compiled. If `json_path` exists, the
+// binary is only accepted when it was generated from that exact file.
+// Returns ESP_ERR_NOT_FOUND when there is no binary, and ESP_ERR_INVALID_*
+// when it is corrupt or stale; the caller then falls back to JSON.
+esp_err_t load_binary_program(const char* bin_path, const char* json_path, Program* prog);
+
+// Write a compiled program to `bin_path` in the same format, tagged with
+// `source_crc` (program_file_crc() of the input.json it came from), so the
+// next boot loads it with load_binary_program() instead of parsing JSON
+// again. Written to a temporary file first; an interrupted write leaves
+// the previous file, or none.
+esp_err_t save_binary_program(const char* bin_path, const Program* prog, uint32_t source_crc);
+
+// Point `prog` at a program image that is already in memory, e.g. mapped
+// from flash, after validating it like load_binary_program(). Nothing is
+// copied: every table is used in place and the image must outlive `prog`.
+esp_err_t program_bin_view(const void* image, size_t size, Program* prog);
+
+// Where the phase table of an image starts: after the header and the
+// padded pin table. The other tables follow it in the order above.
+#define PROGRAM_BIN_PHASES_OFFSET  (sizeof(ProgramBinHeader) + ((NUM_COMPONENTS + 3u) & ~3u))
+
+// Write `prog` as an image into `dst` (`cap` bytes), tagged with
+// `source_crc` like save_binary_program(). Tables that already sit at
+// their place in `dst` are not copied, so a caller may build them there
+// first. ESP_ERR_INVALID_SIZE if the image does not fit.
+esp_err_t program_bin_write(const Program* prog, uint32_t source_crc, void* dst, size_t cap, size_t* size);
+
+// CRC-32 of a whole file, read in small chunks. Returns false if missing.
+bool program_file_crc(const char* path, uint32_t* crc);
@@ -0,0 +1,169 @@
+#include "program_check.h"
+
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "CHECK";
+
+#define PIN_BIT(pin)  (1u << (pin))
+#define MOTOR_BIT     PIN_BIT(MOTOR_ON_PIN)
+#define DIR_BIT       PIN_BIT(MOTOR_DIRECTION_PIN)
+
+// Outputs that must never all be ON at the same time. The server's cycle
+// optimizer checks against a copy (lib/program-check.js); keep them in sync.
+typedef struct {
+    uint32_t    mask;
+    const char* what;
+} ForbiddenState;
+
+static const ForbiddenState s_forbidden[] = {
+    { PIN_BIT(HOT_VALVE_PIN)  | PIN_BIT(DRAIN_PUMP_PIN), "Hot Valve open while the Drain Pump runs" },
+    { PIN_BIT(COLD_VALVE_PIN) | PIN_BIT(DRAIN_PUMP_PIN), "Cold Valve open while the Drain Pump runs" },
+};
+
+static void add_conflict(ProgramCheck* c, uint32_t time_ms, int phase, const char* what) {
+    if (c->num_conflicts < PROGRAM_CHECK_MAX_CONFLICTS) {
+        c->conflicts[c->num_conflicts] = (ProgramConflict){
+            .time_ms = time_ms,
+            .phase   = (uint16_t)phase,
+            .what    = what,
+        };
+    }
+    c->num_conflicts++;
+}
+
+static void add_on_time(ProgramCheck* c, uint32_t on, uint32_t ms) {
+    for (uint32_t m = on; m; m &= m - 1) {
+        uint8_t id = component_at_pin(__builtin_ctz(m));
+        if (id != COMPONENT_NONE) {
+            c->on_ms[id] += ms;
+        }
+    }
+}
+
+// Cycle time of the next edge or motor segment boundary, or UINT32_MAX.
+static uint32_t next_instant(const Program* prog, int e, int s, bool seg_on) {
+    uint32_t at = UINT32_MAX;
+    if (e < prog->num_edges) {
+        at = prog->edges[e].abs_time_ms;
+    }
+    if (s < prog->num_segments) {
+        const MotorSegment* m = &prog->segments[s];
+        uint32_t bound = seg_on ? m->end_ms : m->start_ms;
+        if (bound < at) {
+            at = bound;
+        }
+    }
+    return at;
+}
+
+static void analyze(const Program* prog, ProgramCheck* c) {
+    *c = (ProgramCheck){ .total_ms = prog->total_ms };
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        c->overlaps += prog->overlaps[i];
+    }
+
+    // Sweep the instants at which anything changes. A motor pattern counts
+    // as the motor ON for its whole window.
+    uint32_t on = 0;              // outputs the timeline holds ON
+    bool     seg_on = false;      // a motor pattern is running
+    uint32_t last_ms = 0;
+    int      phase = 0;
+    int      e = 0;
+    int      s = 0;
+    uint32_t now;
+    while ((now = next_instant(prog, e, s, seg_on)) != UINT32_MAX) {
+        uint32_t on_before = on;
+        bool     seg_before = seg_on;
+        uint32_t before = on | (seg_on ? MOTOR_BIT : 0);
+        add_on_time(c, before, now - last_ms);
+        last_ms = now;
+        while (phase + 1 < prog->num_phases && prog->phases[phase + 1].start_ms <= now) {
+            phase++;
+        }
+
+        uint32_t switched = 0;
+        for (; e < prog->num_edges && prog->edges[e].abs_time_ms == now; e++) {
+            const TimelineEdge* edge = &prog->edges[e];
+            on = (on & ~edge->gpio_mask_set) | edge->gpio_mask_clear;
+            switched |= edge->gpio_mask_set | edge->gpio_mask_clear;
+        }
+        // Segments never overlap, but one may start where the last one ends.
+        while (s < prog->num_segments) {
+            const MotorSegment* m = &prog->segments[s];
+            if (seg_on && m->end_ms == now) {
+                seg_on = false;
+                s++;
+            } else if (!seg_on && m->start_ms == now) {
+                seg_on = true;
+            } else {
+                break;
+            }
+        }
+        uint32_t after = on | (seg_on ? MOTOR_BIT : 0);
+
+        if ((switched & DIR_BIT) && (before & MOTOR_BIT) && (after & MOTOR_BIT)) {
+            add_conflict(c, now, phase, "Motor Direction switched while the motor runs");
+        }
+        // A running pattern drives both motor pins itself.
+        uint32_t clash   = seg_on ? on & (MOTOR_BIT | DIR_BIT) : 0;
+        uint32_t clashed = seg_before ? on_before & (MOTOR_BIT | DIR_BIT) : 0;
+        if (clash & ~clashed & MOTOR_BIT) {
+            add_conflict(c, now, phase, "Motor held ON by the program during a motor pattern");
+        }
+        if (clash & ~clashed & DIR_BIT) {
+            add_conflict(c, now, phase, "Motor Direction held ON by the program during a motor pattern");
+        }
+        for (size_t i = 0; i < sizeof(s_forbidden) / sizeof(s_forbidden[0]); i++) {
+            uint32_t mask = s_forbidden[i].mask;
+            if ((after & mask) == mask && (before & mask) != mask) {
+                add_conflict(c, now, phase, s_forbidden[i].what);
+            }
+        }
+    }
+    if (prog->total_ms > last_ms) {
+        add_on_time(c, on | (seg_on ? MOTOR_BIT : 0), prog->total_ms - last_ms);
+    }
+}
+
+static void log_check(const Program* prog, const ProgramCheck* c) {
+    ESP_LOGI(TAG, "Cycle %lu ms, %d conflicts, %lu overlapping entries",
+             (unsigned long)c->total_ms, c->num_conflicts, (unsigned long)c->overlaps);
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        if (c->on_ms[i] == 0) {
+            continue;
+        }
+        unsigned int duty = c->total_ms ? (unsigned int)((uint64_t)c->on_ms[i] * 100 / c->total_ms) : 0;
+        ESP_LOGI(TAG, "  %-16s ON %lu ms (%u%%)", component_states[i].name, (unsigned long)c->on_ms[i], duty);
+    }
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        if (prog->overlaps[i]) {
+            ESP_LOGW(TAG, "%s: %u overlapping entries, run as one",
+                     component_states[i].name, (unsigned int)prog->overlaps[i]);
+        }
+    }
+    int shown = c->num_conflicts < PROGRAM_CHECK_MAX_CONFLICTS ? c->num_conflicts : PROGRAM_CHECK_MAX_CONFLICTS;
+    for (int i = 0; i < shown; i++) {
+        const ProgramConflict* k = &c->conflicts[i];
+        ESP_LOGW(TAG, "At %lu ms (phase %u): %s", (unsigned long)k->time_ms, (unsigned int)k->phase, k->what);
+    }
+    if (c->num_conflicts > shown) {
+        ESP_LOGW(TAG, "... and %d more conflicts", c->num_conflicts - shown);
+    }
+}
+
+esp_err_t program_check(const Program* prog, ProgramCheck* out) {
+    ProgramCheck local;
+    ProgramCheck* c = out ? out : &local;
+    analyze(prog, c);
+    log_check(prog, c);
+#if CONFIG_CYCLE_REJECT_CONFLICTS
+    if (c->num_conflicts) {
+        ESP_LOGE(TAG, "Program rejected: %d conflicts", c->num_conflicts);
+        return ESP_ERR_INVALID_ARG;
+    }
+#endif
+    return ESP_OK;
+}
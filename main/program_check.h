@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "components.h"
+#include "program.h"
+
+// ------------------------- PROGRAM CHECK -------------------------
+// One sweep over a compiled program (edges and motor segments, both
+// already time-sorted) before it is allowed to run. It flags:
+//   - forbidden combinations of outputs ON together (rules in
+//     program_check.c), e.g. a fill valve open while the drain pump runs
+//   - MOTOR_DIRECTION_PIN switching while the motor is energized, or held
+//     by the program while a motor pattern drives it
+//   - components whose entries overlap in time (Program.overlaps)
+// and works out the cycle length and how long each output is ON.
+//
+// Works on mapped images too, except for the overlap counts, which only
+// the compile step sees.
+
+#define PROGRAM_CHECK_MAX_CONFLICTS  8    // kept in detail; all are counted
+
+typedef struct {
+    uint32_t    time_ms;          // from cycle start
+    uint16_t    phase;
+    const char* what;
+} ProgramConflict;
+
+typedef struct {
+    uint32_t        total_ms;
+    uint32_t        on_ms[NUM_COMPONENTS];     // time ON; the motor counts its pattern windows
+    uint32_t        overlaps;                  // sum of Program.overlaps
+    int             num_conflicts;
+    ProgramConflict conflicts[PROGRAM_CHECK_MAX_CONFLICTS];
+} ProgramCheck;
+
+// Analyze `prog` into `out` (may be NULL) and log the result. Returns
+// ESP_ERR_INVALID_ARG if a conflict was found and
+// CONFIG_CYCLE_REJECT_CONFLICTS is set, ESP_OK otherwise.
+esp_err_t program_check(const Program* prog, ProgramCheck* out);
@@ -0,0 +1,348 @@
+#include "program_flash.h"
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "esp_log.h"
+#include "crc32.h"
+#include "program_check.h"
+#include "program_library.h"
+
+static const char* TAG = "PROGRAM_FLASH";
+
+#define SLOT_TRAILER_MAGIC  0x4E474359u   // "CYGN"
+#define NO_IMAGE_CRC        0xFFFFFFFFu
+
+typedef struct {
+    uint32_t magic;
+    uint32_t replaces;       // header CRC of the other slot's image when written
+} SlotTrailer;
+
+static esp_partition_mmap_handle_t s_handle;
+static bool                        s_mapped = false;
+static int                         s_slot   = -1;    // slot mapped at boot
+static const void*                 s_image  = NULL;  // its image, program or library
+static size_t                      s_image_size = 0;
+static int                         s_selected = 0;   // library: program running from it
+
+static const esp_partition_t* find_partition(void) {
+    const esp_partition_t* part = esp_partition_find_first(
+        ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)PROGRAM_PARTITION_SUBTYPE,
+        PROGRAM_PARTITION_LABEL);
+    if (!part) {
+        ESP_LOGW(TAG, "No \"%s\" partition in the partition table", PROGRAM_PARTITION_LABEL);
+    }
+    return part;
+}
+
+static size_t slot_size(const esp_partition_t* part) {
+    return part->size / 2 / part->erase_size * part->erase_size;
+}
+
+static size_t slot_base(const esp_partition_t* part, int slot) {
+    return slot * slot_size(part);
+}
+
+// Images may use every sector of the slot except the trailer's.
+static size_t slot_capacity(const esp_partition_t* part) {
+    return slot_size(part) - part->erase_size;
+}
+
+static size_t trailer_offset(const esp_partition_t* part, int slot) {
+    return slot_base(part, slot) + slot_capacity(part);
+}
+
+// Header CRC of the image in `slot`, as a cheap identity; not validated.
+static uint32_t slot_image_crc(const esp_partition_t* part, int slot) {
+    union {
+        ProgramBinHeader     bin;
+        ProgramLibraryHeader lib;
+    } hdr;
+    if (esp_partition_read(part, slot_base(part, slot), &hdr, sizeof(hdr)) != ESP_OK) {
+        return NO_IMAGE_CRC;
+    }
+    if (hdr.bin.magic == PROGRAM_BIN_MAGIC) {
+        return hdr.bin.crc;
+    }
+    return hdr.lib.magic == PROGRAM_LIBRARY_MAGIC ? hdr.lib.crc : NO_IMAGE_CRC;
+}
+
+// A single program, or program `id` of a library.
+static esp_err_t view_image(const void* image, size_t size, int id, Program* prog) {
+    if (program_library_is(image, size)) {
+        return program_library_view(image, size, id, prog);
+    }
+    return id == 0 ? program_bin_view(image, size, prog) : ESP_ERR_NOT_FOUND;
+}
+
+// Slot 1 first only if its trailer says it replaced what slot 0 holds now.
+static int preferred_slot(const esp_partition_t* part) {
+    SlotTrailer t;
+    if (esp_partition_read(part, trailer_offset(part, 1), &t, sizeof(t)) == ESP_OK &&
+        t.magic == SLOT_TRAILER_MAGIC && t.replaces == slot_image_crc(part, 0)) {
+        return 1;
+    }
+    return 0;
+}
+
+static esp_err_t map_slot(const esp_partition_t* part, int slot, Program* prog) {
+    const void* image;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(part, slot_base(part, slot), slot_capacity(part),
+                                       ESP_PARTITION_MMAP_DATA, &image, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "mmap failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    // A library boots its first program; program_flash_select() switches.
+    err = view_image(image, slot_capacity(part), 0, prog);
+    if (err != ESP_OK) {
+        esp_partition_munmap(handle);
+        return err;
+    }
+    s_handle     = handle;
+    s_mapped     = true;
+    s_slot       = slot;
+    s_image      = image;
+    s_image_size = slot_capacity(part);
+    s_selected   = 0;
+    return ESP_OK;
+}
+
+esp_err_t program_flash_map(Program* prog) {
+    const esp_partition_t* part = find_partition();
+    if (!part) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int slot = preferred_slot(part);
+    esp_err_t err = map_slot(part, slot, prog);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Slot %d unusable (%s), trying slot %d", slot, esp_err_to_name(err), 1 - slot);
+        slot = 1 - slot;
+        err = map_slot(part, slot, prog);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(TAG, "Mapped program 0 of %d from slot %d: %d phases, %d edges, cycle %lu ms",
+             program_flash_count(), slot, prog->num_phases, prog->num_edges, (unsigned long)prog->total_ms);
+    return ESP_OK;
+}
+
+int program_flash_count(void) {
+    if (!s_mapped) {
+        return 0;
+    }
+    return program_library_is(s_image, s_image_size) ? program_library_count(s_image, s_image_size) : 1;
+}
+
+const char* program_flash_name(int id) {
+    const ProgramLibraryEntry* e = s_mapped ? program_library_entry(s_image, s_image_size, id) : NULL;
+    return e ? e->name : NULL;
+}
+
+int program_flash_selected(void) {
+    return s_selected;
+}
+
+uint32_t program_flash_next_crc(void) {
+    const esp_partition_t* part = find_partition();
+    uint32_t crc = part ? slot_image_crc(part, preferred_slot(part)) : NO_IMAGE_CRC;
+    return crc == NO_IMAGE_CRC ? 0 : crc;
+}
+
+uint32_t program_flash_mapped_crc(void) {
+    if (!s_mapped) {
+        return 0;
+    }
+    if (program_library_is(s_image, s_image_size)) {
+        return ((const ProgramLibraryHeader*)s_image)->crc;
+    }
+    return ((const ProgramBinHeader*)s_image)->crc;
+}
+
+esp_err_t program_flash_select(int id, Program* prog) {
+    if (!s_mapped) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    Program view;
+    program_init(&view);
+    esp_err_t err = view_image(s_image, s_image_size, id, &view);
+    if (err == ESP_OK) {
+        // Flashed over USB, a library was never checked as a whole.
+        err = program_check(&view, NULL);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    *prog      = view;
+    s_selected = id;
+    ESP_LOGI(TAG, "Selected program %d \"%s\": %d phases, cycle %lu ms", id,
+             program_flash_name(id) ? program_flash_name(id) : "", view.num_phases, (unsigned long)view.total_ms);
+    return ESP_OK;
+}
+
+void program_flash_unmap(Program* prog) {
+    program_free(prog);
+    if (s_mapped) {
+        esp_partition_munmap(s_handle);
+        s_mapped = false;
+        s_slot   = -1;
+        s_image  = NULL;
+    }
+}
+
+// CRC-32 of the first `len` bytes of `slot`.
+static uint32_t partition_crc(const esp_partition_t* part, int slot, size_t len) {
+    uint8_t buf[128];
+    uint32_t crc = 0;
+    size_t base = slot_base(part, slot);
+    for (size_t off = 0; off < len; off += sizeof(buf)) {
+        size_t n = len - off < sizeof(buf) ? len - off : sizeof(buf);
+        if (esp_partition_read(part, base + off, buf, n) != ESP_OK) {
+            return ~crc;    // never matches a real file
+        }
+        crc = crc32_update(crc, buf, n);
+    }
+    return crc;
+}
+
+esp_err_t program_flash_begin(ProgramFlashWriter* w, size_t size) {
+    const esp_partition_t* part = find_partition();
+    if (!part) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (size == 0 || size > slot_capacity(part)) {
+        ESP_LOGE(TAG, "Image of %u bytes does not fit a %u byte slot",
+                 (unsigned int)size, (unsigned int)slot_capacity(part));
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Never the mapped slot; without one, the slot boot would not pick.
+    int slot = s_slot >= 0 ? 1 - s_slot : 1 - preferred_slot(part);
+    *w = (ProgramFlashWriter){
+        .part     = part,
+        .base     = slot_base(part, slot),
+        .size     = size,
+        .replaces = slot_image_crc(part, 1 - slot),
+    };
+
+    // Drop the old trailer first, so a half-written slot is never preferred.
+    size_t erase_len = (size + part->erase_size - 1) / part->erase_size * part->erase_size;
+    esp_err_t err = esp_partition_erase_range(part, trailer_offset(part, slot), part->erase_size);
+    if (err == ESP_OK) {
+        err = esp_partition_erase_range(part, w->base, erase_len);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erasing slot %d failed: %s", slot, esp_err_to_name(err));
+    }
+    return err;
+}
+
+esp_err_t program_flash_write(ProgramFlashWriter* w, const void* data, size_t len) {
+    if (len > w->size - w->written) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    esp_err_t err = esp_partition_write(w->part, w->base + w->written, data, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Writing program partition failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    w->written += len;
+    return ESP_OK;
+}
+
+esp_err_t program_flash_finish(ProgramFlashWriter* w, ProgramBinHeader* hdr, int* programs) {
+    if (w->written != w->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Check what actually landed in flash, not what was sent.
+    const void* image;
+    esp_partition_mmap_handle_t handle;
+    esp_err_t err = esp_partition_mmap(w->part, w->base, w->size, ESP_PARTITION_MMAP_DATA, &image, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // A library is checked whole here, so selecting from it later only
+    // validates the one image it switches to.
+    bool library = program_library_is(image, w->size);
+    int count = library ? program_library_count(image, w->size) : 1;
+    if (library) {
+        err = program_library_check(image, w->size);
+    }
+    for (int id = 0; err == ESP_OK && id < count; id++) {
+        Program view;
+        program_init(&view);
+        err = view_image(image, w->size, id, &view);
+        if (err == ESP_OK) {
+            err = program_check(&view, NULL);
+        }
+        if (err != ESP_OK && library) {
+            ESP_LOGW(TAG, "Program %d of the library: %s", id, esp_err_to_name(err));
+        }
+    }
+    if (err == ESP_OK) {
+        const ProgramLibraryEntry* first = library ? program_library_entry(image, w->size, 0) : NULL;
+        *hdr = *(const ProgramBinHeader*)((const uint8_t*)image + (first ? first->offset : 0));
+        if (programs) {
+            *programs = count;
+        }
+    }
+    esp_partition_munmap(handle);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Rejected uploaded image: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    const SlotTrailer t = { .magic = SLOT_TRAILER_MAGIC, .replaces = w->replaces };
+    err = esp_partition_write(w->part, w->base + slot_capacity(w->part), &t, sizeof(t));
+    if (err != ESP_OK) {
+        return err;
+    }
+    ESP_LOGI(TAG, "Installed program at 0x%x of \"%s\" (%u bytes)",
+             (unsigned int)w->base, PROGRAM_PARTITION_LABEL, (unsigned int)w->size);
+    return ESP_OK;
+}
+
+esp_err_t program_flash_install(const char* bin_path) {
+    const esp_partition_t* part = find_partition();
+    if (!part) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    FILE* f = fopen(bin_path, "rb");
+    if (!f) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    rewind(f);
+
+    uint32_t file_crc;
+    if (len > 0 && program_file_crc(bin_path, &file_crc) &&
+        file_crc == partition_crc(part, preferred_slot(part), (size_t)len)) {
+        fclose(f);
+        return ESP_OK;
+    }
+
+    ProgramFlashWriter w;
+    esp_err_t err = len > 0 ? program_flash_begin(&w, (size_t)len) : ESP_ERR_INVALID_SIZE;
+    uint8_t buf[256];
+    size_t n;
+    while (err == ESP_OK && (n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        err = program_flash_write(&w, buf, n);
+    }
+    fclose(f);
+
+    ProgramBinHeader hdr;
+    if (err == ESP_OK) {
+        err = program_flash_finish(&w, &hdr, NULL);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Could not install %s: %s", bin_path, esp_err_to_name(err));
+    }
+    return err;
+}
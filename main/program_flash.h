@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "program.h"
+#include "program_bin.h"
+
+// ------------------------- PROGRAM PARTITION -------------------------
+// With CONFIG_CYCLE_PROGRAM_PARTITION the compiled program (input.bin
+// format) lives in the raw "program" data partition and is executed in
+// place through esp_partition_mmap: no copy, no SPIFFS mount, and RAM use
+// that does not grow with program length.
+//
+// Instead of one program, a slot may hold a library of them
+// (program_library.h); boot runs its program 0 and program_flash_select()
+// switches between cycles without touching flash.
+//
+// The partition holds two image slots of half its size. The build flashes
+// slot 0; uploads go to the slot that is not running, so an interrupted
+// upload leaves the old program intact. The last sector of a slot holds a
+// trailer naming the image it replaced (by header CRC). Boot prefers slot 1
+// only while slot 0 still holds exactly that image, so re-flashing slot 0
+// over USB wins over an older upload.
+
+#define PROGRAM_PARTITION_LABEL    "program"
+#define PROGRAM_PARTITION_SUBTYPE  0x40
+
+// Map the newest intact slot and point `prog` at it. Fails if the partition
+// is missing or neither slot holds a usable image.
+esp_err_t program_flash_map(Program* prog);
+
+// Release the mapping made by program_flash_map().
+void program_flash_unmap(Program* prog);
+
+// Programs in the mapped image: a library's count, 1 for a single program,
+// 0 when nothing is mapped.
+int program_flash_count(void);
+
+// Name of program `id` of a mapped library, or NULL.
+const char* program_flash_name(int id);
+
+// Program last mapped or selected.
+int program_flash_selected(void);
+
+// Point `prog` at program `id` of the mapped image and check it
+// (program_check.h). One index lookup; the other programs are not read.
+esp_err_t program_flash_select(int id, Program* prog);
+
+// Identity of an image: the header CRC of a program, or of a library,
+// which covers all of it (program_bin.h, program_library.h). The image the
+// next boot maps, which an upload has replaced until the restart, and the
+// one mapped now. 0 when there is none.
+uint32_t  program_flash_next_crc(void);
+uint32_t  program_flash_mapped_crc(void);
+
+// Copy a binary program file into the partition so the next boot can map
+// it. Skipped when the partition already holds the same image.
+esp_err_t program_flash_install(const char* bin_path);
+
+// Streaming write of one image into the slot that is not mapped. Only one
+// writer may be open at a time; nothing is buffered beyond the caller's
+// chunks.
+typedef struct {
+    const esp_partition_t* part;
+    size_t   base;           // slot offset in the partition
+    size_t   size;           // image bytes announced to program_flash_begin
+    size_t   written;
+    uint32_t replaces;       // header CRC of the image in the other slot
+} ProgramFlashWriter;
+
+// Erase room for `size` bytes. ESP_ERR_INVALID_SIZE if it does not fit a slot.
+esp_err_t program_flash_begin(ProgramFlashWriter* w, size_t size);
+esp_err_t program_flash_write(ProgramFlashWriter* w, const void* data, size_t len);
+
+// Validate the image as it reads back from flash (layout, pin table, CRC,
+// program_check(); every program of a library) and only then write the
+// trailer that makes the next boot pick it. `hdr` receives the header of
+// the program boot will run, `programs` (may be NULL) how many there are.
+esp_err_t program_flash_finish(ProgramFlashWriter* w, ProgramBinHeader* hdr, int* programs);
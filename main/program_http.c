@@ -0,0 +1,428 @@
+#include "program_http.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include "sdkconfig.h"
+#include "components.h"
+#include "control.h"
+#include "diag.h"
+#include "jitter.h"
+#include "live_status.h"
+#include "program_flash.h"
+#include "program_patch.h"
+#include "program_slot.h"
+#include "scheduler.h"
+#include "tasks.h"
+
+static const char* TAG = "HTTP";
+
+#define UPLOAD_CHUNK         1024   // flash write size; the body is never held whole
+#define UPLOAD_MAX_TIMEOUTS  3      // receive timeouts in a row before giving up
+
+static httpd_handle_t s_server  = NULL;
+static volatile bool  s_restart = false;
+
+static void wifi_event(void* arg, esp_event_base_t base, int32_t id, void* data) {
+    if (base == WIFI_EVENT && id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        ESP_LOGW(TAG, "Wi-Fi disconnected, retrying");
+        esp_wifi_connect();
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        const ip_event_got_ip_t* ev = data;
+        ESP_LOGI(TAG, "Program upload at http://" IPSTR ":%d/program",
+                 IP2STR(&ev->ip_info.ip), CONFIG_CYCLE_HTTP_PORT);
+    }
+}
+
+static esp_err_t wifi_start(void) {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    if (err == ESP_OK) {
+        err = esp_netif_init();
+    }
+    if (err == ESP_OK) {
+        err = esp_event_loop_create_default();
+        if (err == ESP_ERR_INVALID_STATE) {
+            err = ESP_OK;     // someone else created it
+        }
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t init = WIFI_INIT_CONFIG_DEFAULT();
+    err = esp_wifi_init(&init);
+    if (err == ESP_OK) {
+        err = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event, NULL);
+    }
+    if (err == ESP_OK) {
+        err = esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event, NULL);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    wifi_config_t cfg = { 0 };
+    strlcpy((char*)cfg.sta.ssid, CONFIG_CYCLE_WIFI_SSID, sizeof(cfg.sta.ssid));
+    strlcpy((char*)cfg.sta.password, CONFIG_CYCLE_WIFI_PASSWORD, sizeof(cfg.sta.password));
+    err = esp_wifi_set_mode(WIFI_MODE_STA);
+    if (err == ESP_OK) {
+        err = esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    }
+    if (err == ESP_OK) {
+        err = esp_wifi_start();
+    }
+    return err;
+}
+
+static esp_err_t reply(httpd_req_t* req, const char* status, const char* body) {
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, body);
+}
+
+static esp_err_t reply_error(httpd_req_t* req, const char* status, esp_err_t err) {
+    char body[64];
+    snprintf(body, sizeof(body), "{\"error\":\"%s\"}", esp_err_to_name(err));
+    return reply(req, status, body);
+}
+
+// Requests that change the board bring CONFIG_CYCLE_HTTP_TOKEN as
+// "Authorization: Bearer <token>". Without a token configured, none does.
+static bool authorized(httpd_req_t* req) {
+    static const char prefix[] = "Bearer ";
+    const char* token = CONFIG_CYCLE_HTTP_TOKEN;
+    size_t len = strlen(token);
+    char value[sizeof(prefix) + sizeof(CONFIG_CYCLE_HTTP_TOKEN)];
+    if (len == 0 || httpd_req_get_hdr_value_str(req, "Authorization", value, sizeof(value)) != ESP_OK ||
+        strlen(value) != sizeof(prefix) - 1 + len || strncmp(value, prefix, sizeof(prefix) - 1) != 0) {
+        return false;
+    }
+    // Every byte is compared, so the time taken tells nothing about the token.
+    unsigned char diff = 0;
+    for (size_t i = 0; i < len; i++) {
+        diff |= (unsigned char)(value[sizeof(prefix) - 1 + i] ^ token[i]);
+    }
+    return diff == 0;
+}
+
+static esp_err_t reply_unauthorized(httpd_req_t* req) {
+    httpd_resp_set_hdr(req, "WWW-Authenticate", "Bearer");
+    return reply(req, "401 Unauthorized", "{\"error\":\"unauthorized\"}");
+}
+
+static esp_err_t install_program(httpd_req_t* req) {
+    // Handlers run one at a time on the server task.
+    static uint8_t buf[UPLOAD_CHUNK];
+
+    ProgramFlashWriter w;
+    esp_err_t err = program_flash_begin(&w, req->content_len);
+    if (err != ESP_OK) {
+        return reply_error(req, err == ESP_ERR_INVALID_SIZE ? "413 Payload Too Large" : HTTPD_500, err);
+    }
+
+    size_t left = req->content_len;
+    int timeouts = 0;
+    while (left > 0) {
+        int n = httpd_req_recv(req, (char*)buf, left < sizeof(buf) ? left : sizeof(buf));
+        if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < UPLOAD_MAX_TIMEOUTS) {
+            continue;
+        }
+        if (n <= 0) {
+            ESP_LOGW(TAG, "Upload cut off with %u bytes to go", (unsigned int)left);
+            return ESP_FAIL;     // closes the connection; the old program stays
+        }
+        timeouts = 0;
+        err = program_flash_write(&w, buf, n);
+        if (err != ESP_OK) {
+            return reply_error(req, HTTPD_500, err);
+        }
+        left -= n;
+    }
+
+    ProgramBinHeader hdr;
+    int programs = 0;
+    err = program_flash_finish(&w, &hdr, &programs);
+    if (err != ESP_OK) {
+        return reply_error(req, HTTPD_400, err);
+    }
+
+    char body[128];
+    snprintf(body, sizeof(body),
+             "{\"status\":\"installed\",\"bytes\":%u,\"programs\":%d,\"phases\":%u,\"edges\":%lu,\"totalMs\":%lu}",
+             (unsigned int)w.size, programs, (unsigned int)hdr.num_phases,
+             (unsigned long)hdr.num_edges, (unsigned long)hdr.total_ms);
+    reply(req, HTTPD_200, body);
+
+    // app_main restarts as soon as it next gets to start a cycle.
+    s_restart = true;
+    control_request_start();
+    return ESP_OK;
+}
+
+// Erasing and writing flash stops the cache, and with it the scheduler
+// reading its edges and the motor timer, for up to a block erase at a
+// time: an upload only goes in between cycles, and a cycle started
+// meanwhile waits for it.
+static esp_err_t put_program(httpd_req_t* req) {
+    if (!authorized(req)) {
+        return reply_unauthorized(req);
+    }
+    if (!scheduler_claim(0)) {
+        return reply_error(req, "409 Conflict", ESP_ERR_INVALID_STATE);
+    }
+    esp_err_t err = install_program(req);
+    scheduler_release();
+    return err;
+}
+
+// A patch of the running program (program_patch.h): small, so it is
+// received whole, then applied and staged for the next cycle like a
+// console "load". Nothing is written to flash; the partition keeps the
+// image it had until the next PUT.
+static esp_err_t patch_program(httpd_req_t* req) {
+    static uint8_t patch[PROGRAM_PATCH_MAX_SIZE];   // handlers run one at a time
+
+    if (!authorized(req)) {
+        return reply_unauthorized(req);
+    }
+    if (req->content_len == 0 || req->content_len > sizeof(patch)) {
+        return reply_error(req, "413 Payload Too Large", ESP_ERR_INVALID_SIZE);
+    }
+    size_t got = 0;
+    int timeouts = 0;
+    while (got < req->content_len) {
+        int n = httpd_req_recv(req, (char*)patch + got, req->content_len - got);
+        if (n == HTTPD_SOCK_ERR_TIMEOUT && ++timeouts < UPLOAD_MAX_TIMEOUTS) {
+            continue;
+        }
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        timeouts = 0;
+        got += n;
+    }
+
+    const Program* staged = NULL;
+    uint32_t image_crc = 0;
+    esp_err_t err = program_slot_patch(patch, got, &staged, &image_crc);
+    if (err != ESP_OK) {
+        // A patch made for another program needs a full upload instead;
+        // one racing the console "load" can simply be sent again.
+        return reply_error(req, err == ESP_ERR_INVALID_STATE ? "409 Conflict"
+                                : err == ESP_ERR_NOT_FINISHED ? "503 Service Unavailable" : HTTPD_400, err);
+    }
+
+    char body[128];
+    snprintf(body, sizeof(body),
+             "{\"status\":\"staged\",\"phases\":%d,\"edges\":%d,\"totalMs\":%lu,\"image\":\"%08lx\"}",
+             staged->num_phases, staged->num_edges, (unsigned long)staged->total_ms,
+             (unsigned long)image_crc);
+    reply(req, HTTPD_200, body);
+    control_request_start();
+    return ESP_OK;
+}
+
+// Which image the board holds, so an uploader can skip sending it again:
+// "image" is what runs after the next restart, "running" what runs now.
+static esp_err_t get_program(httpd_req_t* req) {
+    // "running" is what cycles run from the slot, which a patch, a console
+    // load or a library selection changes without touching the partition.
+    bool staged;
+    uint32_t running = program_slot_running_crc(&staged);
+    char body[112];
+    snprintf(body, sizeof(body),
+             "{\"image\":\"%08lx\",\"running\":\"%08lx\",\"staged\":%s,\"restartPending\":%s}",
+             (unsigned long)program_flash_next_crc(), (unsigned long)running,
+             staged ? "true" : "false", s_restart ? "true" : "false");
+    return reply(req, HTTPD_200, body);
+}
+
+// Same numbers as the console "status" command, as JSON.
+static esp_err_t get_status(httpd_req_t* req) {
+    static JitterStats stats[NUM_COMPONENTS];   // handlers run one at a time
+    jitter_snapshot(stats);
+
+    char chunk[192];
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, "{\"components\":[");
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        const JitterStats* s = &stats[i];
+        snprintf(chunk, sizeof(chunk),
+                 "%s{\"name\":\"%s\",\"edges\":%lu,\"minUs\":%lu,\"avgUs\":%lu,\"p99Us\":%lu,\"maxUs\":%lu}",
+                 i ? "," : "", component_states[i].name, (unsigned long)s->count,
+                 (unsigned long)(s->count ? s->min_us : 0),
+                 (unsigned long)(s->count ? s->sum_us / s->count : 0),
+                 (unsigned long)jitter_percentile(s, 99), (unsigned long)s->max_us);
+        httpd_resp_sendstr_chunk(req, chunk);
+    }
+    httpd_resp_sendstr_chunk(req, "]}");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+#if CONFIG_CYCLE_DIAGNOSTICS
+static const char* const s_load_sources[] = { "none", "partition", "binary", "json" };
+
+// "<key>":{"count":..,"minUs":..,"avgUs":..,"p50Us":..,"p99Us":..,"maxUs":..,
+// "buckets":[..]}; bucket b counts latencies under 2^b us (jitter.h).
+static void send_latency(httpd_req_t* req, const char* key, const JitterStats* s) {
+    char chunk[192];
+    snprintf(chunk, sizeof(chunk),
+             "\"%s\":{\"count\":%lu,\"minUs\":%lu,\"avgUs\":%lu,\"p50Us\":%lu,\"p99Us\":%lu,"
+             "\"maxUs\":%lu,\"buckets\":[",
+             key, (unsigned long)s->count, (unsigned long)(s->count ? s->min_us : 0),
+             (unsigned long)(s->count ? s->sum_us / s->count : 0),
+             (unsigned long)jitter_percentile(s, 50), (unsigned long)jitter_percentile(s, 99),
+             (unsigned long)s->max_us);
+    httpd_resp_sendstr_chunk(req, chunk);
+    for (int b = 0; b < JITTER_BUCKETS; b++) {
+        snprintf(chunk, sizeof(chunk), "%s%lu", b ? "," : "", (unsigned long)s->buckets[b]);
+        httpd_resp_sendstr_chunk(req, chunk);
+    }
+    httpd_resp_sendstr_chunk(req, "]}");
+}
+
+// Same numbers as the console "diag" command, as JSON.
+static esp_err_t get_diag(httpd_req_t* req) {
+    static DiagReport d;   // handlers run one at a time
+    diag_report(&d);
+    const DiagLoad* l = &d.load;
+
+    char chunk[320];
+    httpd_resp_set_type(req, "application/json");
+    snprintf(chunk, sizeof(chunk),
+             "{\"build\":{\"version\":\"%s\",\"idf\":\"%s\",\"date\":\"%s\"},"
+             "\"load\":{\"source\":\"%s\",\"mountUs\":%lu,\"readUs\":%lu,\"parseUs\":%lu,"
+             "\"compileUs\":%lu,\"saveUs\":%lu,\"totalUs\":%lu,\"jsonBytes\":%lu},",
+             d.version, d.idf_version, d.built, s_load_sources[l->source],
+             (unsigned long)l->mount_us, (unsigned long)l->read_us, (unsigned long)l->parse_us,
+             (unsigned long)l->compile_us, (unsigned long)l->save_us, (unsigned long)l->total_us,
+             (unsigned long)l->json_bytes);
+    httpd_resp_sendstr_chunk(req, chunk);
+    snprintf(chunk, sizeof(chunk),
+             "\"heap\":{\"free\":%lu,\"largest\":%lu,\"min\":%lu,\"beforeLoad\":%lu,"
+             "\"largestBeforeLoad\":%lu,\"afterLoad\":%lu,\"largestAfterLoad\":%lu},\"stacks\":[",
+             (unsigned long)d.heap_free, (unsigned long)d.heap_largest, (unsigned long)d.heap_min,
+             (unsigned long)l->heap_before, (unsigned long)l->largest_before,
+             (unsigned long)l->heap_after, (unsigned long)l->largest_after);
+    httpd_resp_sendstr_chunk(req, chunk);
+    for (int i = 0; i < d.num_stacks; i++) {
+        snprintf(chunk, sizeof(chunk), "%s{\"task\":\"%s\",\"freeMin\":%lu}", i ? "," : "",
+                 d.stacks[i].name, (unsigned long)d.stacks[i].free_min);
+        httpd_resp_sendstr_chunk(req, chunk);
+    }
+    httpd_resp_sendstr_chunk(req, "],");
+    send_latency(req, "dispatch", &d.dispatch);
+    snprintf(chunk, sizeof(chunk),
+             ",\"scheduler\":{\"cpuPermille\":%lu,\"busyUs\":%llu,\"windowUs\":%llu,\"wakeups\":%lu}}",
+             (unsigned long)d.cpu_permille, (unsigned long long)d.busy_us,
+             (unsigned long long)d.window_us, (unsigned long)d.wakeups);
+    httpd_resp_sendstr_chunk(req, chunk);
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
+static unsigned long query_ulong(const char* query, const char* key) {
+    char value[16];
+    if (!query || httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return 0;
+    }
+    return strtoul(value, NULL, 10);
+}
+
+// POST /diag/bench?edges=<n>&spacingMs=<ms>, both optional: the console
+// "diag bench" as JSON. Answers once the run is over.
+static esp_err_t post_bench(httpd_req_t* req) {
+    if (!authorized(req)) {
+        return reply_unauthorized(req);
+    }
+    char query[64];
+    bool has_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    static DiagBench b;   // handlers run one at a time
+    esp_err_t err = diag_bench(query_ulong(has_query ? query : NULL, "edges"),
+                               query_ulong(has_query ? query : NULL, "spacingMs"), &b);
+    if (err != ESP_OK) {
+        return reply_error(req, err == ESP_ERR_INVALID_STATE ? "409 Conflict"
+                                : err == ESP_ERR_INVALID_ARG ? HTTPD_400 : HTTPD_500, err);
+    }
+
+    char chunk[192];
+    httpd_resp_set_type(req, "application/json");
+    snprintf(chunk, sizeof(chunk),
+             "{\"edges\":%lu,\"spacingMs\":%lu,\"outputs\":%lu,\"runUs\":%lu,\"cpuPermille\":%lu,"
+             "\"stackFree\":%lu,\"heapFree\":%lu,",
+             (unsigned long)b.edges, (unsigned long)b.spacing_ms, (unsigned long)b.outputs,
+             (unsigned long)b.run_us, (unsigned long)b.cpu_permille, (unsigned long)b.stack_free,
+             (unsigned long)b.heap_free);
+    httpd_resp_sendstr_chunk(req, chunk);
+    send_latency(req, "late", &b.late);
+    httpd_resp_sendstr_chunk(req, ",");
+    send_latency(req, "dispatch", &b.dispatch);
+    httpd_resp_sendstr_chunk(req, "}");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+#endif
+
+esp_err_t program_http_start(void) {
+    esp_err_t err = wifi_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Wi-Fi setup failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    httpd_config_t cfg = HTTPD_DEFAULT_CONFIG();
+    cfg.server_port   = CONFIG_CYCLE_HTTP_PORT;
+    cfg.task_priority = TASK_PRIO_HTTPD;
+    cfg.core_id       = TASK_CORE_BG;
+    err = httpd_start(&s_server, &cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "HTTP server failed to start: %s", esp_err_to_name(err));
+        return err;
+    }
+    const httpd_uri_t put    = { .uri = "/program", .method = HTTP_PUT, .handler = put_program };
+    const httpd_uri_t get    = { .uri = "/program", .method = HTTP_GET, .handler = get_program };
+    const httpd_uri_t patch  = { .uri = "/program", .method = HTTP_PATCH, .handler = patch_program };
+    const httpd_uri_t status = { .uri = "/status",  .method = HTTP_GET, .handler = get_status };
+    err = httpd_register_uri_handler(s_server, &put);
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(s_server, &get);
+    }
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(s_server, &patch);
+    }
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(s_server, &status);
+    }
+#if CONFIG_CYCLE_DIAGNOSTICS
+    const httpd_uri_t diag  = { .uri = "/diag",       .method = HTTP_GET,  .handler = get_diag };
+    const httpd_uri_t bench = { .uri = "/diag/bench", .method = HTTP_POST, .handler = post_bench };
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(s_server, &diag);
+    }
+    if (err == ESP_OK) {
+        err = httpd_register_uri_handler(s_server, &bench);
+    }
+#endif
+#if CONFIG_CYCLE_LIVE_STATUS
+    if (err == ESP_OK) {
+        err = live_status_start(s_server);
+    }
+#endif
+    return err;
+}
+
+bool program_http_restart_pending(void) {
+    return s_restart;
+}
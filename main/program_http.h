@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+// ------------------------- PROGRAM UPLOAD OVER WI-FI -------------------------
+// With CONFIG_CYCLE_HTTP_UPLOAD the board joins CONFIG_CYCLE_WIFI_SSID and
+// accepts
+//   PUT /program    body: input.bin, or a library.bin of several programs
+//   GET /program    header CRC of the installed image and of the program
+//                   cycles run now (0 if unknown), and whether another
+//                   one is staged for the next cycle
+//   PATCH /program  body: a patch of the running program (program_patch.h),
+//                   run from the next cycle without a restart
+//   GET /status     per-component edge jitter (jitter.h) as JSON
+//   GET /live       WebSocket of status frames (live_status.h)
+//   GET /diag       performance counters (diag.h) as JSON
+//   POST /diag/bench?edges=&spacingMs=
+//                   run the scheduler bench and answer with its numbers
+// The body is streamed chunk by chunk into the spare slot of the program
+// partition (program_flash.h) and validated there, so a failed or
+// interrupted upload leaves the running program alone. PUT is refused with
+// 409 while a cycle runs, since flash erases would hold its edges back;
+// once installed, the board restarts into the new program.
+// PUT, PATCH and POST need "Authorization: Bearer <CONFIG_CYCLE_HTTP_TOKEN>"
+// and answer 401 otherwise.
+
+esp_err_t program_http_start(void);
+
+// An upload was installed and the app should restart between cycles.
+bool program_http_restart_pending(void);
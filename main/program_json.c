@@ -0,0 +1,453 @@
+#include "program_json.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "main.h"
+#include "components.h"
+#include "json_stream.h"
+
+static const char* TAG = "CONFIG";
+
+// Event depths of the input.json schema:
+//   [ { "startTime": .., "components": [ { "compId": .., "start": .. } ] } ]
+//     ^ phase       ^ phase field      ^ component  ^ component field
+// and inside a component:
+//   "motorConfig": { "runningStyle": .., "pattern": [ { "stepTime": .. } ] }
+//                    ^ motor field                   ^ step  ^ step field
+// "endOn": { "sensor": .., "above": .. } is a phase or component field;
+// its own fields are one level deeper.
+#define LEVEL_PHASE            1
+#define LEVEL_PHASE_FIELD      2
+#define LEVEL_COMPONENT        3
+#define LEVEL_COMPONENT_FIELD  4
+#define LEVEL_MOTOR_FIELD      5
+#define LEVEL_STEP             6
+#define LEVEL_STEP_FIELD       7
+
+typedef enum {
+    KEY_OTHER = 0,
+    KEY_NAME,
+    KEY_START_TIME,
+    KEY_COMPONENTS,
+    KEY_COMP_ID,
+    KEY_START,
+    KEY_DURATION,
+    KEY_MOTOR_CONFIG,
+    KEY_RUNNING_STYLE,
+    KEY_STEP_TIME,
+    KEY_PAUSE_TIME,
+    KEY_DIRECTION,
+    KEY_PATTERN,
+    KEY_END_ON,
+    KEY_SENSOR,
+    KEY_ABOVE,
+    KEY_BELOW,
+} Key;
+
+static const char* const style_names[] = { "none", "toggle", "singleDir", "pattern" };
+
+typedef struct {
+    Program*       prog;
+    Key            phase_key;       // last key seen in the current phase
+    Key            comp_key;        // last key seen in the current component
+    Key            motor_key;       // last key in motorConfig or one of its steps
+    bool           in_components;
+    bool           in_component;
+    bool           in_motor;
+    bool           in_pattern;
+    bool           in_step;
+    MotorStep      step;
+    int            trigger_depth;   // depth of the endOn fields, 0 outside endOn
+    Key            trigger_key;
+    PhaseTrigger   trigger;         // endOn being parsed
+    bool           trigger_has_sensor;
+    PhaseTrigger   comp_trigger;    // a component's endOn, added with the component
+    bool           comp_has_trigger;
+    char           phase_name[32];  // for log messages only
+    char           comp_name[32];
+    ComponentInput comp;
+    bool           comp_has_id;
+    const char*    error;
+} LoadCtx;
+
+static Key phase_key(const char* k) {
+    if (strcmp(k, "name") == 0)       return KEY_NAME;
+    if (strcmp(k, "startTime") == 0)  return KEY_START_TIME;
+    if (strcmp(k, "components") == 0) return KEY_COMPONENTS;
+    if (strcmp(k, "endOn") == 0)      return KEY_END_ON;
+    return KEY_OTHER;
+}
+
+static Key component_key(const char* k) {
+    if (strcmp(k, "compId") == 0)     return KEY_COMP_ID;
+    if (strcmp(k, "start") == 0)      return KEY_START;
+    if (strcmp(k, "duration") == 0)   return KEY_DURATION;
+    if (strcmp(k, "motorConfig") == 0) return KEY_MOTOR_CONFIG;
+    if (strcmp(k, "endOn") == 0)      return KEY_END_ON;
+    return KEY_OTHER;
+}
+
+static Key motor_key(const char* k) {
+    if (strcmp(k, "runningStyle") == 0) return KEY_RUNNING_STYLE;
+    if (strcmp(k, "stepTime") == 0)     return KEY_STEP_TIME;
+    if (strcmp(k, "pauseTime") == 0)    return KEY_PAUSE_TIME;
+    if (strcmp(k, "direction") == 0)    return KEY_DIRECTION;
+    if (strcmp(k, "pattern") == 0)      return KEY_PATTERN;
+    return KEY_OTHER;
+}
+
+static Key trigger_key(const char* k) {
+    if (strcmp(k, "sensor") == 0) return KEY_SENSOR;
+    if (strcmp(k, "above") == 0)  return KEY_ABOVE;
+    if (strcmp(k, "below") == 0)  return KEY_BELOW;
+    return KEY_OTHER;
+}
+
+static int parse_style(const char* text) {
+    for (int i = RUNNING_STYLE_TOGGLE; i <= RUNNING_STYLE_PATTERN; i++) {
+        if (strcmp(text, style_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint8_t parse_ccw(const char* text) {
+    return strcmp(text, "ccw") == 0;
+}
+
+static uint32_t parse_ms(const char* text) {
+    double v = strtod(text, NULL);
+    return v > 0 ? (uint32_t)v : 0;
+}
+
+static int32_t parse_threshold(const char* text) {
+    double v = strtod(text, NULL);
+    return v >= INT32_MAX ? INT32_MAX : v <= INT32_MIN ? INT32_MIN : (int32_t)v;
+}
+
+static void copy_name(char* dst, size_t size, const char* src) {
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
+
+// A motorConfig that cannot run falls back to plain ON for the duration.
+static const char* check_motor(const ComponentInput* comp, const Program* prog) {
+    if (comp->component != COMP_MOTOR) {
+        return "motorConfig on a component that is not the motor";
+    }
+    if (comp->runningStyle == RUNNING_STYLE_PATTERN) {
+        if (comp->num_steps == 0) {
+            return "empty pattern";
+        }
+        for (int i = 0; i < comp->num_steps; i++) {
+            if (prog->steps[comp->first_step + i].on_ms == 0) {
+                return "pattern step without stepTime";
+            }
+        }
+    } else if (comp->stepTime == 0) {
+        return "no stepTime";
+    }
+    return NULL;
+}
+
+static void begin_trigger(LoadCtx* c, int depth) {
+    c->trigger_depth      = depth + 1;
+    c->trigger_key        = KEY_OTHER;
+    // Without a threshold: a switch that has closed.
+    c->trigger            = (PhaseTrigger){ .component = COMPONENT_NONE, .sensor = SENSOR_NONE,
+                                            .op = TRIGGER_ABOVE, .threshold = 0 };
+    c->trigger_has_sensor = false;
+}
+
+// A phase's endOn is added right away; a component's waits for the
+// component, whose compId may come later.
+static bool end_trigger(LoadCtx* c) {
+    c->trigger_depth = 0;
+    if (!c->trigger_has_sensor) {
+        c->error = "endOn without sensor";
+        return false;
+    }
+    if (c->in_component) {
+        c->comp_trigger     = c->trigger;
+        c->comp_has_trigger = true;
+        return true;
+    }
+    if (program_add_trigger(c->prog, &c->trigger) != ESP_OK) {
+        c->error = "program too large";
+        return false;
+    }
+    return true;
+}
+
+static bool commit_component(LoadCtx* c) {
+    if (!c->comp_has_id) {
+        c->error = "component without compId";
+        return false;
+    }
+    if (c->comp.component == COMPONENT_NONE) {
+        ESP_LOGE(TAG, "Unknown component \"%s\" (phase: %s)", c->comp_name, c->phase_name);
+        c->error = "unknown component";
+        return false;
+    }
+    if (c->comp.num_steps > 0) {
+        c->comp.runningStyle = RUNNING_STYLE_PATTERN;
+    }
+    if (c->comp.runningStyle != RUNNING_STYLE_NONE) {
+        const char* why = check_motor(&c->comp, c->prog);
+        if (why) {
+            ESP_LOGW(TAG, "[MOTOR] %s (phase: %s): %s, running it plain", c->comp_name, c->phase_name, why);
+            if (c->comp.num_steps) {
+                c->prog->num_steps = c->comp.first_step;
+            }
+            c->comp.runningStyle = RUNNING_STYLE_NONE;
+            c->comp.num_steps    = 0;
+        }
+    }
+    if (program_add_component(c->prog, &c->comp) != ESP_OK) {
+        c->error = "program too large";
+        return false;
+    }
+    if (c->comp_has_trigger) {
+        c->comp_trigger.component = c->comp.component;
+        if (program_add_trigger(c->prog, &c->comp_trigger) != ESP_OK) {
+            c->error = "program too large";
+            return false;
+        }
+    }
+    ESP_LOGD(TAG,
+             "[LOADED] %s (phase: %s)  start=%u  dur=%u",
+             c->comp_name,
+             c->phase_name,
+             (unsigned int)c->comp.start,
+             (unsigned int)c->comp.duration);
+    if (c->comp.runningStyle != RUNNING_STYLE_NONE) {
+        ESP_LOGD(TAG, "[MOTOR] %s  step=%u  pause=%u  steps=%u",
+                 style_names[c->comp.runningStyle],
+                 (unsigned int)c->comp.stepTime,
+                 (unsigned int)c->comp.pauseTime,
+                 (unsigned int)c->comp.num_steps);
+    }
+    return true;
+}
+
+static bool add_step(LoadCtx* c) {
+    if (c->comp.num_steps >= MOTOR_MAX_PATTERN_STEPS) {
+        c->error = "motor pattern has too many steps";
+        return false;
+    }
+    if (program_add_step(c->prog, &c->step) != ESP_OK) {
+        c->error = "program too large";
+        return false;
+    }
+    c->comp.num_steps++;
+    return true;
+}
+
+static bool on_event(void* ctx, const JsonStream* js, JsonEvent ev, const char* text, int depth) {
+    LoadCtx* c = ctx;
+
+    switch (ev) {
+        case JSON_EV_ARRAY_START:
+            if (depth == LEVEL_PHASE_FIELD && c->phase_key == KEY_COMPONENTS) {
+                c->in_components = true;
+            } else if (depth == LEVEL_MOTOR_FIELD && c->in_motor && c->motor_key == KEY_PATTERN) {
+                c->in_pattern      = true;
+                c->comp.first_step = (uint16_t)c->prog->num_steps;
+                c->comp.num_steps  = 0;
+            }
+            return true;
+
+        case JSON_EV_ARRAY_END:
+            if (depth == LEVEL_PHASE_FIELD) {
+                c->in_components = false;
+            } else if (depth == LEVEL_MOTOR_FIELD) {
+                c->in_pattern = false;
+            }
+            return true;
+
+        case JSON_EV_OBJECT_START:
+            if (depth == 0) {
+                c->error = "program must be an array of phases";
+                return false;
+            }
+            if ((depth == LEVEL_PHASE_FIELD && c->phase_key == KEY_END_ON) ||
+                (depth == LEVEL_COMPONENT_FIELD && c->in_component && c->comp_key == KEY_END_ON)) {
+                begin_trigger(c, depth);
+            } else if (depth == LEVEL_PHASE) {
+                c->phase_key = KEY_OTHER;
+                copy_name(c->phase_name, sizeof(c->phase_name), "?");
+                if (program_add_phase(c->prog, 0) != ESP_OK) {
+                    c->error = "program too large";
+                    return false;
+                }
+            } else if (depth == LEVEL_COMPONENT && c->in_components) {
+                c->in_component = true;
+                c->comp_key     = KEY_OTHER;
+                c->comp         = (ComponentInput){ .component = COMPONENT_NONE };
+                c->comp_has_id  = false;
+                c->comp_has_trigger = false;
+                copy_name(c->comp_name, sizeof(c->comp_name), "?");
+            } else if (depth == LEVEL_COMPONENT_FIELD && c->in_component && c->comp_key == KEY_MOTOR_CONFIG) {
+                c->in_motor  = true;
+                c->motor_key = KEY_OTHER;
+            } else if (depth == LEVEL_STEP && c->in_pattern) {
+                c->in_step   = true;
+                c->motor_key = KEY_OTHER;
+                c->step      = (MotorStep){ 0 };
+            }
+            return true;
+
+        case JSON_EV_OBJECT_END:
+            if (c->trigger_depth && depth == c->trigger_depth - 1) {
+                return end_trigger(c);
+            }
+            if (depth == LEVEL_COMPONENT && c->in_component) {
+                c->in_component = false;
+                return commit_component(c);
+            }
+            if (depth == LEVEL_COMPONENT_FIELD && c->in_motor) {
+                c->in_motor = false;
+            } else if (depth == LEVEL_STEP && c->in_step) {
+                c->in_step = false;
+                return add_step(c);
+            }
+            return true;
+
+        case JSON_EV_KEY:
+            if (c->trigger_depth) {
+                if (depth == c->trigger_depth) {
+                    c->trigger_key = trigger_key(text);
+                    if (c->trigger_key == KEY_ABOVE || c->trigger_key == KEY_BELOW) {
+                        c->trigger.op = c->trigger_key == KEY_ABOVE ? TRIGGER_ABOVE : TRIGGER_BELOW;
+                    }
+                }
+            } else if (depth == LEVEL_PHASE_FIELD) {
+                c->phase_key = phase_key(text);
+            } else if (depth == LEVEL_COMPONENT_FIELD && c->in_component) {
+                c->comp_key = component_key(text);
+            } else if ((depth == LEVEL_MOTOR_FIELD && c->in_motor) ||
+                       (depth == LEVEL_STEP_FIELD && c->in_step)) {
+                c->motor_key = motor_key(text);
+            }
+            return true;
+
+        case JSON_EV_STRING:
+            if (c->trigger_depth) {
+                if (depth == c->trigger_depth && c->trigger_key == KEY_SENSOR) {
+                    c->trigger.sensor     = js->truncated ? SENSOR_NONE : sensor_find(text);
+                    c->trigger_has_sensor = true;
+                    if (c->trigger.sensor == SENSOR_NONE) {
+                        ESP_LOGE(TAG, "Unknown sensor \"%s\" (phase: %s)", text, c->phase_name);
+                        c->error = "unknown sensor";
+                        return false;
+                    }
+                }
+            } else if (depth == LEVEL_PHASE_FIELD && c->phase_key == KEY_NAME) {
+                copy_name(c->phase_name, sizeof(c->phase_name), text);
+            } else if (depth == LEVEL_COMPONENT_FIELD && c->in_component && c->comp_key == KEY_COMP_ID) {
+                // Interned here; nothing downstream keeps the name.
+                copy_name(c->comp_name, sizeof(c->comp_name), text);
+                c->comp.component = js->truncated ? COMPONENT_NONE : component_find(text);
+                c->comp_has_id = true;
+            } else if (depth == LEVEL_MOTOR_FIELD && c->in_motor) {
+                if (c->motor_key == KEY_RUNNING_STYLE) {
+                    int style = parse_style(text);
+                    if (style < 0) {
+                        ESP_LOGW(TAG, "[MOTOR] unknown runningStyle \"%s\" (phase: %s)", text, c->phase_name);
+                    }
+                    c->comp.runningStyle = style < 0 ? RUNNING_STYLE_NONE : (uint8_t)style;
+                } else if (c->motor_key == KEY_DIRECTION) {
+                    c->comp.ccw = parse_ccw(text);
+                }
+            } else if (depth == LEVEL_STEP_FIELD && c->in_step && c->motor_key == KEY_DIRECTION) {
+                c->step.ccw = parse_ccw(text);
+            }
+            return true;
+
+        case JSON_EV_NUMBER:
+            if (c->trigger_depth) {
+                if (depth == c->trigger_depth && (c->trigger_key == KEY_ABOVE || c->trigger_key == KEY_BELOW)) {
+                    c->trigger.threshold = parse_threshold(text);
+                }
+            } else if (depth == LEVEL_PHASE_FIELD && c->phase_key == KEY_START_TIME) {
+                c->prog->phases[c->prog->num_phases - 1].startTime = parse_ms(text);
+            } else if (depth == LEVEL_COMPONENT_FIELD && c->in_component) {
+                if (c->comp_key == KEY_START) {
+                    c->comp.start = parse_ms(text);
+                } else if (c->comp_key == KEY_DURATION) {
+                    c->comp.duration = parse_ms(text);
+                }
+            } else if (depth == LEVEL_MOTOR_FIELD && c->in_motor) {
+                if (c->motor_key == KEY_STEP_TIME) {
+                    c->comp.stepTime = parse_ms(text);
+                } else if (c->motor_key == KEY_PAUSE_TIME) {
+                    c->comp.pauseTime = parse_ms(text);
+                }
+            } else if (depth == LEVEL_STEP_FIELD && c->in_step) {
+                if (c->motor_key == KEY_STEP_TIME) {
+                    c->step.on_ms = parse_ms(text);
+                } else if (c->motor_key == KEY_PAUSE_TIME) {
+                    c->step.off_ms = parse_ms(text);
+                }
+            }
+            return true;
+
+        default:
+            return true;
+    }
+}
+
+static JsonLoadStats s_stats;
+
+void load_json_stats(JsonLoadStats* out) {
+    *out = s_stats;
+}
+
+bool load_json_config(const char* path, Program* prog) {
+    s_stats = (JsonLoadStats){ 0 };
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return false;
+    }
+
+    static char chunk[CONFIG_CYCLE_JSON_CHUNK_SIZE];
+    LoadCtx ctx = { .prog = prog };
+    JsonStream js;
+    json_stream_init(&js, on_event, &ctx);
+
+    bool ok = true;
+    size_t n;
+    int64_t t = esp_timer_get_time();
+    while (ok) {
+        n = fread(chunk, 1, sizeof(chunk), file);
+        int64_t read = esp_timer_get_time();
+        s_stats.read_us += (uint32_t)(read - t);
+        if (n == 0) {
+            break;
+        }
+        ok = json_stream_feed(&js, chunk, n);
+        t = esp_timer_get_time();
+        s_stats.parse_us += (uint32_t)(t - read);
+        s_stats.bytes += n;
+    }
+    fclose(file);
+
+    if (ok && !json_stream_finish(&js)) {
+        ctx.error = ctx.error ? ctx.error : "unexpected end of file";
+        ok = false;
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to parse %s at byte %u: %s", path, (unsigned int)js.offset,
+                 ctx.error ? ctx.error : "syntax error");
+        program_free(prog);     // gives the pool back for the next load
+        return false;
+    }
+    return true;
+}
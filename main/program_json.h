@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "program.h"
+
+// Stream a JSON program (the input.json schema) from `path` into `prog`.
+// The file is read in CONFIG_CYCLE_JSON_CHUNK_SIZE chunks and never held
+// in RAM as a whole; the caller still runs program_compile() afterwards.
+// On failure `prog` is freed.
+bool load_json_config(const char* path, Program* prog);
+
+// Where the last load_json_config() spent its time: reading the file and
+// parsing what was read (diag.h).
+typedef struct {
+    uint32_t bytes;
+    uint32_t read_us;
+    uint32_t parse_us;
+} JsonLoadStats;
+
+void load_json_stats(JsonLoadStats* out);
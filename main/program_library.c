@@ -0,0 +1,75 @@
+#include "program_library.h"
+
+#include <stddef.h>
+
+#include "esp_log.h"
+#include "crc32.h"
+#include "program_bin.h"
+
+static const char* TAG = "LIBRARY";
+
+// The index is read in place from the image.
+_Static_assert(sizeof(ProgramLibraryHeader) == 16, "ProgramLibraryHeader layout");
+_Static_assert(sizeof(ProgramLibraryEntry) == 32, "ProgramLibraryEntry layout");
+
+// Header fields that must hold before the index can be trusted at all.
+static const ProgramLibraryHeader* header_of(const void* image, size_t size) {
+    const ProgramLibraryHeader* hdr = image;
+    if (size < sizeof(*hdr) || hdr->magic != PROGRAM_LIBRARY_MAGIC ||
+        hdr->version != PROGRAM_LIBRARY_VERSION || hdr->size > size ||
+        sizeof(*hdr) + (size_t)hdr->count * sizeof(ProgramLibraryEntry) > hdr->size) {
+        return NULL;
+    }
+    return hdr;
+}
+
+bool program_library_is(const void* image, size_t size) {
+    return size >= sizeof(uint32_t) && *(const uint32_t*)image == PROGRAM_LIBRARY_MAGIC;
+}
+
+int program_library_count(const void* image, size_t size) {
+    const ProgramLibraryHeader* hdr = header_of(image, size);
+    return hdr ? hdr->count : 0;
+}
+
+const ProgramLibraryEntry* program_library_entry(const void* image, size_t size, int id) {
+    const ProgramLibraryHeader* hdr = header_of(image, size);
+    if (!hdr || id < 0 || id >= hdr->count) {
+        return NULL;
+    }
+    const ProgramLibraryEntry* e = (const ProgramLibraryEntry*)(hdr + 1) + id;
+    if (e->offset % 4 != 0 || e->offset > hdr->size || e->size > hdr->size - e->offset) {
+        return NULL;
+    }
+    return e;
+}
+
+esp_err_t program_library_check(const void* image, size_t size) {
+    const ProgramLibraryHeader* hdr = header_of(image, size);
+    if (!hdr) {
+        return program_library_is(image, size) ? ESP_ERR_INVALID_VERSION : ESP_ERR_INVALID_SIZE;
+    }
+    if (hdr->count == 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    uint32_t crc = crc32_update(0, hdr, offsetof(ProgramLibraryHeader, crc));
+    crc = crc32_update(crc, hdr + 1, hdr->size - sizeof(*hdr));
+    if (crc != hdr->crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    for (int id = 0; id < hdr->count; id++) {
+        if (!program_library_entry(image, size, id)) {
+            ESP_LOGE(TAG, "Program %d lies outside the library", id);
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t program_library_view(const void* image, size_t size, int id, Program* prog) {
+    const ProgramLibraryEntry* e = program_library_entry(image, size, id);
+    if (!e) {
+        return header_of(image, size) ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_SIZE;
+    }
+    return program_bin_view((const uint8_t*)image + e->offset, e->size, prog);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "program.h"
+
+// ------------------------- PROGRAM LIBRARY -------------------------
+// library.bin holds several cycles (cotton, delicate, rinse-only, ...) as
+// complete input.bin images behind one index, generated by the Node server
+// (lib/program-library.js). All fields are little endian.
+//
+//   ProgramLibraryHeader                   16 bytes
+//   index                                  count x ProgramLibraryEntry (32 bytes)
+//   images                                 input.bin images, each 4-byte aligned
+//
+// A program's ID is its position in the index, so selecting one reads one
+// index entry and validates only that image; the others are not touched.
+// `crc` covers the header up to the crc field and everything after the
+// header, and doubles as the library's identity (program_flash.h).
+
+#define PROGRAM_LIBRARY_MAGIC     0x424C5943u   // "CYLB"
+#define PROGRAM_LIBRARY_VERSION   1
+#define PROGRAM_LIBRARY_NAME_LEN  24
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t size;           // whole library, header included
+    uint32_t crc;
+} ProgramLibraryHeader;
+
+typedef struct {
+    uint32_t offset;         // of the input.bin image, from the start of the library
+    uint32_t size;
+    char     name[PROGRAM_LIBRARY_NAME_LEN];   // NUL-terminated
+} ProgramLibraryEntry;
+
+// The image starts like a library (magic only; nothing validated).
+bool program_library_is(const void* image, size_t size);
+
+// Header, index and CRC of the whole library. Run once when a library is
+// installed; program_library_view() does not repeat it.
+esp_err_t program_library_check(const void* image, size_t size);
+
+// Number of programs, or 0 if `image` is not a library.
+int program_library_count(const void* image, size_t size);
+
+// Index entry of program `id`, bounds-checked against `size`, or NULL.
+const ProgramLibraryEntry* program_library_entry(const void* image, size_t size, int id);
+
+// program_bin_view() of program `id`. ESP_ERR_NOT_FOUND for an unknown ID.
+esp_err_t program_library_view(const void* image, size_t size, int id, Program* prog);
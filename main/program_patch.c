@@ -0,0 +1,250 @@
+#include "program_patch.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "crc32.h"
+#include "program_bin.h"
+
+static const char* TAG = "PATCH";
+
+_Static_assert(sizeof(ProgramPatchHeader) == 20, "ProgramPatchHeader layout");
+_Static_assert(sizeof(ProgramPatchPhase) == 8, "ProgramPatchPhase layout");
+_Static_assert(sizeof(ProgramPatchComponent) == 16, "ProgramPatchComponent layout");
+
+// The phase records of a patch, read one at a time. The patch may sit at
+// any alignment, so records are copied out.
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    int            left;
+} PatchCursor;
+
+// Next record into `pp`, its components left at c->p. False past the last.
+static bool next_phase(PatchCursor* c, ProgramPatchPhase* pp) {
+    if (c->left == 0 || (size_t)(c->end - c->p) < sizeof(*pp)) {
+        return false;
+    }
+    memcpy(pp, c->p, sizeof(*pp));
+    c->p += sizeof(*pp);
+    c->left--;
+    return true;
+}
+
+// Phase index of the next record, skipping its components; -1 past the last.
+static int next_patched(PatchCursor* c) {
+    ProgramPatchPhase pp;
+    if (!next_phase(c, &pp)) {
+        return -1;
+    }
+    c->p += (size_t)pp.num_components * sizeof(ProgramPatchComponent);
+    return pp.phase;
+}
+
+// Write the new timing of every record into the copied tables.
+static esp_err_t apply_timing(PatchCursor c, Phase* phases, int num_phases, ComponentInput* components) {
+    int count = c.left;
+    int prev = -1;
+    ProgramPatchPhase pp;
+    for (int i = 0; i < count; i++) {
+        if (!next_phase(&c, &pp)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        if ((int)pp.phase <= prev || pp.phase >= num_phases ||
+            pp.num_components != phases[pp.phase].num_components) {
+            ESP_LOGW(TAG, "Record %d does not match the program (phase %u)", i, (unsigned int)pp.phase);
+            return ESP_ERR_INVALID_ARG;
+        }
+        if ((size_t)(c.end - c.p) < (size_t)pp.num_components * sizeof(ProgramPatchComponent)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        prev = pp.phase;
+
+        Phase* ph = &phases[pp.phase];
+        ph->startTime = pp.startTime;
+        for (int j = 0; j < pp.num_components; j++) {
+            ProgramPatchComponent rec;
+            memcpy(&rec, c.p, sizeof(rec));
+            c.p += sizeof(rec);
+            if (rec.start > UINT32_MAX - rec.duration) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            ComponentInput* comp = &components[ph->first_component + j];
+            comp->start     = rec.start;
+            comp->duration  = rec.duration;
+            comp->stepTime  = rec.stepTime;
+            comp->pauseTime = rec.pauseTime;
+        }
+    }
+    return c.p == c.end ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+static bool fits(const void* p, size_t len, const uint8_t* limit) {
+    return (size_t)(limit - (const uint8_t*)p) >= len;
+}
+
+// Edges of the new program, phase by phase. A phase's edges all lie
+// within it, so the base edges of phase i are the next ones up to its
+// old end.
+static esp_err_t build_edges(const Program* base, Program* prog, PatchCursor c, const uint8_t* limit) {
+    int k = 0;
+    int e = 0;
+    int patched = next_patched(&c);
+    for (int i = 0; i < prog->num_phases; i++) {
+        const Phase* old = &base->phases[i];
+        const Phase* ph  = &prog->phases[i];
+        uint32_t old_end = old->start_ms + old->duration_ms;
+        int first = e;
+        while (e < base->num_edges && base->edges[e].abs_time_ms <= old_end) {
+            e++;
+        }
+
+        if (i == patched) {
+            if (!fits(prog->edges + k, 2 * (size_t)ph->num_components * sizeof(TimelineEdge), limit)) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            k += program_phase_edges(ph, prog->components, prog->edges + k);
+            patched = next_patched(&c);
+            continue;
+        }
+        if (!fits(prog->edges + k, (size_t)(e - first) * sizeof(TimelineEdge), limit)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        uint32_t shift = ph->start_ms - old->start_ms;    // wraps for a phase moved earlier
+        for (int j = first; j < e; j++) {
+            TimelineEdge edge = base->edges[j];
+            edge.abs_time_ms += shift;
+            prog->edges[k++] = edge;
+        }
+    }
+    prog->num_edges = k;
+    return ESP_OK;
+}
+
+// Same for the motor patterns.
+static esp_err_t build_segments(const Program* base, Program* prog, PatchCursor c, const uint8_t* limit) {
+    int k = 0;
+    int s = 0;
+    int patched = next_patched(&c);
+    for (int i = 0; i < prog->num_phases; i++) {
+        const Phase* old = &base->phases[i];
+        const Phase* ph  = &prog->phases[i];
+        uint32_t old_end = old->start_ms + old->duration_ms;
+        int first = s;
+        while (s < base->num_segments && base->segments[s].start_ms <= old_end) {
+            s++;
+        }
+
+        if (i == patched) {
+            if (!fits(prog->segments + k, (size_t)ph->num_components * sizeof(MotorSegment), limit)) {
+                return ESP_ERR_INVALID_SIZE;
+            }
+            int added = program_phase_segments(ph, prog->components, prog->segments + k);
+            if (added < 0) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            k += added;
+            patched = next_patched(&c);
+            continue;
+        }
+        if (!fits(prog->segments + k, (size_t)(s - first) * sizeof(MotorSegment), limit)) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        uint32_t shift = ph->start_ms - old->start_ms;
+        for (int j = first; j < s; j++) {
+            MotorSegment seg = base->segments[j];
+            seg.start_ms += shift;
+            seg.end_ms   += shift;
+            prog->segments[k++] = seg;
+        }
+    }
+    prog->num_segments = k;
+    return ESP_OK;
+}
+
+esp_err_t program_patch_apply(const Program* base, const void* patch, size_t size,
+                              void* dst, size_t cap, size_t* out_size) {
+    ProgramPatchHeader hdr;
+    if (size < sizeof(hdr)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&hdr, patch, sizeof(hdr));
+    if (hdr.magic != PROGRAM_PATCH_MAGIC) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (hdr.version != PROGRAM_PATCH_VERSION) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    const PatchCursor records = {
+        .p    = (const uint8_t*)patch + sizeof(hdr),
+        .end  = (const uint8_t*)patch + size,
+        .left = hdr.num_phases,
+    };
+    uint32_t crc = crc32_update(0, &hdr, offsetof(ProgramPatchHeader, crc));
+    if (crc32_update(crc, records.p, (size_t)(records.end - records.p)) != hdr.crc) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    uint32_t hash = program_hash(base);
+    if (hash != hdr.base_hash) {
+        ESP_LOGW(TAG, "Patch is for program %08lx, running %08lx",
+                 (unsigned long)hdr.base_hash, (unsigned long)hash);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The new tables are built where they go in the image; program_bin_write()
+    // then adds the header and pin table around them.
+    uint8_t* limit = (uint8_t*)dst + cap;
+    uint8_t* p = (uint8_t*)dst + PROGRAM_BIN_PHASES_OFFSET;
+    size_t phases_len     = (size_t)base->num_phases * sizeof(Phase);
+    size_t components_len = (size_t)base->num_components * sizeof(ComponentInput);
+    if (cap < PROGRAM_BIN_PHASES_OFFSET || !fits(p, phases_len + components_len, limit)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    Program prog;
+    program_init(&prog);
+    prog.phases         = (Phase*)p;
+    prog.num_phases     = base->num_phases;
+    prog.components     = (ComponentInput*)(p + phases_len);
+    prog.num_components = base->num_components;
+    memcpy(prog.phases, base->phases, phases_len);
+    memcpy(prog.components, base->components, components_len);
+    esp_err_t err = apply_timing(records, prog.phases, prog.num_phases, prog.components);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = program_place_phases(prog.phases, prog.num_phases, prog.components);
+    if (err != ESP_OK) {
+        return err;
+    }
+    prog.total_ms = prog.num_phases
+        ? prog.phases[prog.num_phases - 1].start_ms + prog.phases[prog.num_phases - 1].duration_ms
+        : 0;
+
+    prog.edges = (TimelineEdge*)(p + phases_len + components_len);
+    err = build_edges(base, &prog, records, limit);
+    if (err != ESP_OK) {
+        return err;
+    }
+    prog.segments = (MotorSegment*)(prog.edges + prog.num_edges);
+    err = build_segments(base, &prog, records, limit);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // Steps and sensor conditions do not change; program_bin_write()
+    // copies them after the segments.
+    prog.steps        = base->steps;
+    prog.num_steps    = base->num_steps;
+    prog.triggers     = base->triggers;
+    prog.num_triggers = base->num_triggers;
+    prog.mapped       = true;
+    err = program_bin_write(&prog, hdr.source_crc, dst, cap, out_size);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Patched %u phases: %d edges, %d motor patterns, cycle %lu ms",
+                 (unsigned int)hdr.num_phases, prog.num_edges, prog.num_segments,
+                 (unsigned long)prog.total_ms);
+    }
+    return err;
+}
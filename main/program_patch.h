@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "program.h"
+
+// ------------------------- PROGRAM PATCHES -------------------------
+// A patch retimes some phases of the program a board already runs, so an
+// edit made in the UI does not need the whole input.bin sent again. It
+// names phases by index and their components by position in the phase,
+// and carries their new timing only; the structure (components, running
+// styles, motor steps, sensor conditions) is the base program's. Built by
+// the Node server (lib/program-patch.js). All fields are little endian.
+//
+//   ProgramPatchHeader                    20 bytes
+//   per patched phase, ascending:
+//     ProgramPatchPhase                   8 bytes
+//     ProgramPatchComponent               16 bytes per component of the phase
+//
+// `crc` covers the header up to the crc field and everything after it.
+
+#define PROGRAM_PATCH_MAGIC     0x54505943u   // "CYPT"
+#define PROGRAM_PATCH_VERSION   1
+#define PROGRAM_PATCH_MAX_SIZE  2048
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t num_phases;     // patched phases that follow
+    uint32_t base_hash;      // program_hash() of the program it applies to
+    uint32_t source_crc;     // CRC-32 of the edited input.json
+    uint32_t crc;
+} ProgramPatchHeader;
+
+typedef struct {
+    uint16_t phase;
+    uint16_t num_components; // must be the phase's own count
+    uint32_t startTime;
+} ProgramPatchPhase;
+
+typedef struct {
+    uint32_t start;
+    uint32_t duration;
+    uint32_t stepTime;
+    uint32_t pauseTime;
+} ProgramPatchComponent;
+
+// Write the image (input.bin format) of `base` with `patch` applied into
+// `dst`. Only the patched phases are compiled again; every other phase
+// keeps its edges and motor patterns, moved by however far its start
+// moved. The result is the image a full compile of the edited input.json
+// gives. ESP_ERR_INVALID_CRC / _VERSION for a damaged patch,
+// ESP_ERR_INVALID_STATE if it was made for another program,
+// ESP_ERR_INVALID_ARG if it does not fit its structure or makes motor
+// patterns overlap, ESP_ERR_INVALID_SIZE if it is cut short or the image
+// exceeds `cap`. The base is only read and may keep running meanwhile.
+esp_err_t program_patch_apply(const Program* base, const void* patch, size_t size,
+                              void* dst, size_t cap, size_t* out_size);
@@ -0,0 +1,157 @@
+#include "program_slot.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "program_bin.h"
+#include "program_check.h"
+#include "program_patch.h"
+
+static const char* TAG = "SLOT";
+
+static Program           s_boot;
+static Program           s_progs[2];      // views into s_images
+static uint8_t           s_images[2][CONFIG_CYCLE_RELOAD_MAX_SIZE] __attribute__((aligned(4)));
+static const Program*    s_active  = &s_boot;
+static int               s_spare   = 0;   // buffer the next upload goes to
+static uint32_t          s_crcs[2];       // header CRC of each buffer's program, 0 if unknown
+static uint32_t          s_boot_crc = 0;
+static bool              s_pending = false;
+static bool              s_writing = false;   // begin() until commit() or abort()
+static SemaphoreHandle_t s_lock    = NULL;
+
+void program_slot_init(Program* boot, uint32_t image_crc) {
+    s_boot     = *boot;
+    s_boot_crc = image_crc;
+    program_init(boot);
+    s_active = &s_boot;
+    s_lock   = xSemaphoreCreateMutex();
+}
+
+esp_err_t program_slot_begin(size_t size, uint8_t** buf) {
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (size > CONFIG_CYCLE_RELOAD_MAX_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // The spare is never the active program, and its index only changes
+    // in program_slot_acquire() while something is pending.
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool busy = s_writing;
+    if (!busy) {
+        s_writing = true;
+        s_pending = false;
+    }
+    int i = s_spare;
+    xSemaphoreGive(s_lock);
+    if (busy) {
+        return ESP_ERR_NOT_FINISHED;
+    }
+    *buf = s_images[i];
+    return ESP_OK;
+}
+
+void program_slot_abort(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_writing = false;
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t program_slot_commit(size_t size, const Program** staged) {
+    // Only the writer that began holds s_writing, so the spare stays put.
+    int i = s_spare;
+    esp_err_t err = size > sizeof(s_images[i]) ? ESP_ERR_INVALID_SIZE
+                                                : program_bin_view(s_images[i], size, &s_progs[i]);
+    if (err == ESP_OK) {
+        err = program_check(&s_progs[i], NULL);
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (err == ESP_OK) {
+        s_crcs[i] = ((const ProgramBinHeader*)s_images[i])->crc;
+        s_pending = true;
+    }
+    s_writing = false;
+    xSemaphoreGive(s_lock);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Staged program: %d phases, %d edges, cycle %lu ms",
+             s_progs[i].num_phases, s_progs[i].num_edges, (unsigned long)s_progs[i].total_ms);
+    *staged = &s_progs[i];
+    return ESP_OK;
+}
+
+esp_err_t program_slot_patch(const void* patch, size_t size, const Program** staged, uint32_t* image_crc) {
+    uint8_t* dst;
+    esp_err_t err = program_slot_begin(sizeof(s_images[0]), &dst);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // Nothing is pending now, so the active program stays put.
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    const Program* base = s_active;
+    xSemaphoreGive(s_lock);
+
+    size_t image_size;
+    err = program_patch_apply(base, patch, size, dst, sizeof(s_images[0]), &image_size);
+    if (err != ESP_OK) {
+        program_slot_abort();
+        return err;
+    }
+    err = program_slot_commit(image_size, staged);
+    if (err == ESP_OK) {
+        *image_crc = ((const ProgramBinHeader*)dst)->crc;
+    }
+    return err;
+}
+
+esp_err_t program_slot_stage(const Program* view, uint32_t image_crc) {
+    if (!s_lock) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    bool busy = s_writing;   // an upload is filling the spare
+    if (!busy) {
+        s_progs[s_spare] = *view;
+        s_crcs[s_spare]  = image_crc;
+        s_pending = true;
+    }
+    xSemaphoreGive(s_lock);
+    return busy ? ESP_ERR_NOT_FINISHED : ESP_OK;
+}
+
+const Program* program_slot_acquire(void) {
+    if (!s_lock) {
+        return s_active;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_pending) {
+        if (s_active == &s_boot) {
+            program_free(&s_boot);
+        }
+        s_active  = &s_progs[s_spare];
+        s_spare   = 1 - s_spare;
+        s_pending = false;
+        ESP_LOGI(TAG, "Switched to the reloaded program");
+    }
+    const Program* active = s_active;
+    xSemaphoreGive(s_lock);
+    return active;
+}
+
+uint32_t program_slot_running_crc(bool* staged) {
+    if (!s_lock) {
+        *staged = false;
+        return s_boot_crc;
+    }
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t crc = s_active == &s_boot ? s_boot_crc : s_crcs[s_active - s_progs];
+    *staged = s_pending;
+    xSemaphoreGive(s_lock);
+    return crc;
+}
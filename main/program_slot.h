@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "program.h"
+
+// ------------------------- PROGRAM SLOTS -------------------------
+// Double-buffered programs for hot reload. A new program image (input.bin
+// format) is received into the spare of two static RAM buffers while the
+// current cycle keeps running from the active one, validated in place, and
+// only becomes active when program_slot_acquire() is called between cycles.
+
+// Adopt the program loaded at boot as the active one. The slot owns it
+// from here on and frees it once a reloaded program replaces it.
+// `image_crc` is its header CRC, 0 if it did not come from an image.
+void program_slot_init(Program* boot, uint32_t image_crc);
+
+// One writer at a time (the console "load", an HTTP PATCH) fills the spare
+// buffer: from program_slot_begin() to program_slot_commit() or
+// program_slot_abort(), anyone else writing gets ESP_ERR_NOT_FINISHED.
+
+// `*buf` gets the buffer for an incoming image of `size` bytes. Both
+// buffers are static. Any program staged earlier and not yet acquired is
+// discarded. ESP_ERR_INVALID_SIZE if it is larger than
+// CONFIG_CYCLE_RELOAD_MAX_SIZE, ESP_ERR_NOT_FINISHED while another writer
+// has begun.
+esp_err_t program_slot_begin(size_t size, uint8_t** buf);
+
+// Give up on an image begun with program_slot_begin(), e.g. one that did
+// not arrive in full.
+void program_slot_abort(void);
+
+// Validate the `size` bytes written to the buffer from program_slot_begin()
+// and stage them for the next cycle. On success `*staged` points at it.
+// Either way the writer is done.
+esp_err_t program_slot_commit(size_t size, const Program** staged);
+
+// Stage a program that is already validated and lives elsewhere, e.g. one
+// selected from the mapped library (program_flash_select()). It replaces
+// anything staged earlier; ESP_ERR_NOT_FINISHED while a writer is filling
+// the spare. `image_crc` identifies it like an image's
+// header CRC; 0 when nothing else carries it.
+esp_err_t program_slot_stage(const Program* view, uint32_t image_crc);
+
+// Apply a patch (program_patch.h) to the active program into the spare
+// buffer and stage the result like program_slot_commit(). `*image_crc`
+// gets the new image's header CRC, which a full upload of the same
+// program would carry. A staged program not yet acquired is discarded,
+// so a patch always applies to what runs now. ESP_ERR_NOT_FINISHED while
+// another writer has begun.
+esp_err_t program_slot_patch(const void* patch, size_t size, const Program** staged, uint32_t* image_crc);
+
+// Between cycles only: swap in the staged program, if any, and return the
+// program the next cycle should run.
+const Program* program_slot_acquire(void);
+
+// Header CRC of the program cycles run now (0 if unknown, e.g. a library
+// selection or a boot from SPIFFS), and in `*staged` whether another one
+// waits for the next cycle.
+uint32_t program_slot_running_crc(bool* staged);
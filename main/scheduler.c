@@ -0,0 +1,447 @@
+#include "scheduler.h"
+
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "diag.h"
+#include "main.h"
+#include "outputs.h"
+#include "motor.h"
+#include "power.h"
+#include "sensors.h"
+#include "tasks.h"
+#include "telemetry.h"
+#include "timeline.h"
+
+static const char* TAG = "SCHED";
+
+// Nothing on the timing path logs: events go to the telemetry ring, which
+// the scheduler task owns as its single producer.
+
+// One wake-up can finish every phase left that has no edge of its own
+// (timeline_finish(), or a run of edge-less phases in timeline_run()),
+// before the cycle loop gets to take a single report.
+#define REPORT_QUEUE_LEN  CONFIG_CYCLE_MAX_PHASES
+
+// Task notification bits
+#define NOTIFY_TIMER      (1u << 0)
+#define NOTIFY_PAUSE      (1u << 1)
+#define NOTIFY_RESUME     (1u << 2)
+#define NOTIFY_ABORT      (1u << 3)
+#define NOTIFY_SENSOR     (1u << 4)
+
+// Everything but the direction relay, which motor_stop() releases once
+// the motor has stopped.
+#define HOLD_OFF_MASK     (outputs_mask() & ~(1u << MOTOR_DIRECTION_PIN))
+
+static Timeline           s_tl;
+static volatile bool      s_busy = false;   // timeline started and not yet drained
+static bool               s_dry_run = false; // walk the timeline without driving any output
+static int64_t            s_armed_us = 0;   // clock time the timer is set for, 0 if not armed
+
+// Pause/abort: s_hold is raised by whoever asks, in their own context, and
+// keeps the scheduler from switching anything ON until a resume.
+static volatile bool      s_hold = false;
+static volatile int64_t   s_hold_at_us = 0;
+static bool               s_paused = false; // pause handled by the task
+static uint32_t           s_motor_elapsed_ms = 0;
+static portMUX_TYPE       s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Copy of the timeline's position for other tasks, under s_lock.
+static int                s_pub_phase = 0;
+static int64_t            s_pub_base_us = 0;
+static int64_t            s_pub_wake_us = 0;
+static uint32_t           s_pub_total_ms = 0;
+
+// Handed to the scheduler task while scheduler_init() waits for it.
+typedef struct {
+    SemaphoreHandle_t done;
+    esp_err_t         err;
+} SchedulerBoot;
+
+static TaskHandle_t       s_task  = NULL;
+static esp_timer_handle_t s_timer = NULL;
+static SemaphoreHandle_t  s_idle  = NULL;
+static SemaphoreHandle_t  s_claim = NULL;
+static QueueHandle_t      s_reports = NULL;
+
+// Just wake the scheduler so the actual GPIO work happens at its own
+// priority and on its own core. Where esp_timer can, this runs in the
+// timer interrupt itself instead of passing through the esp_timer task.
+#if CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+static void IRAM_ATTR scheduler_timer_cb(void* arg) {
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(s_task, NOTIFY_TIMER, eSetBits, &woken);
+    if (woken) {
+        esp_timer_isr_dispatch_need_yield();
+    }
+}
+#define SCHED_TIMER_DISPATCH  ESP_TIMER_ISR
+#else
+static void scheduler_timer_cb(void* arg) {
+    xTaskNotify(s_task, NOTIFY_TIMER, eSetBits);
+}
+#define SCHED_TIMER_DISPATCH  ESP_TIMER_TASK
+#endif
+
+// Hand a finished phase to whoever is following the cycle.
+static void send_report(const PhaseReport* r) {
+    if (xQueueSend(s_reports, r, 0) != pdTRUE) {
+        telemetry_record(TELEM_REPORT_DROPPED, TELEM_NO_COMPONENT, r->phase);
+    }
+}
+
+// Every output OFF at once. Runs in the caller's context, task or ISR,
+// so the machine is safe before the scheduler task even wakes up.
+static void hold_outputs(void) {
+    s_hold = true;
+    motor_stop();
+    outputs_apply(HOLD_OFF_MASK, 0);
+}
+
+// Apply one edge unless a pause or abort got in first.
+static bool apply_edge(const TimelineEdge* e) {
+    portENTER_CRITICAL(&s_lock);
+    bool held = s_hold;
+    if (!held && !s_dry_run) {
+        outputs_apply(e->gpio_mask_set, e->gpio_mask_clear);
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return !held;
+}
+
+static bool outputs_held(void) {
+    return s_hold;
+}
+
+static const TimelineHooks s_hooks = {
+    .apply  = apply_edge,
+    .held   = outputs_held,
+    .report = send_report,
+    .sense  = sensor_read,
+};
+
+static void publish(int64_t wake_us) {
+    portENTER_CRITICAL(&s_lock);
+    s_pub_phase   = s_tl.phase;
+    s_pub_base_us = s_tl.base_us;
+    s_pub_wake_us = wake_us;
+    s_pub_total_ms = s_tl.prog->total_ms;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+// Clock time to wake up for `due`. Further away than the guard, the chip
+// may light-sleep and the timer wakes it the guard early; from there it
+// stays awake, so the edge fires exactly as it would without sleep. A
+// phase that ends on a sensor is watched awake throughout.
+static int64_t wake_for(int64_t due, int64_t now) {
+#if CONFIG_CYCLE_LIGHT_SLEEP
+    const int64_t guard_us = (int64_t)CONFIG_CYCLE_SLEEP_GUARD_MS * 1000;
+    if (due - now > guard_us && !timeline_sensing(&s_tl, now)) {
+        power_hold(POWER_SCHEDULER, false);
+        return due - guard_us;
+    }
+#endif
+    power_hold(POWER_SCHEDULER, true);
+    return due;
+}
+
+// Fire everything that is due, then re-arm for the next edge or segment
+// boundary. Returns false once the timeline is drained.
+static bool run_timeline(void) {
+    int64_t now = esp_timer_get_time();
+    int64_t due = timeline_run(&s_tl, now);
+    if (due == TIMELINE_DONE) {
+        return false;
+    }
+    due = wake_for(due, now);
+    publish(due);
+    esp_timer_stop(s_timer);    // still armed after a sensor wake-up
+    esp_err_t err = esp_timer_start_once(s_timer, (uint64_t)(due > now ? due - now : 0));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to arm timer: %s", esp_err_to_name(err));
+    }
+    s_armed_us = err == ESP_OK ? (due > now ? due : now) : 0;
+    return true;
+}
+
+// Outputs are already safe (see hold_outputs); freeze the timeline clock.
+static void pause_cycle(void) {
+    esp_timer_stop(s_timer);
+    hold_outputs();
+    if (s_tl.seg_running) {
+        const MotorSegment* m = &s_tl.prog->segments[s_tl.seg];
+        int64_t into = s_hold_at_us - (s_tl.base_us + (int64_t)m->start_ms * 1000);
+        s_motor_elapsed_ms = into > 0 ? (uint32_t)(into / 1000) : 0;
+    }
+    s_paused = true;
+    power_hold(POWER_SCHEDULER, false);     // however long the pause
+    telemetry_record(TELEM_PAUSE, TELEM_NO_COMPONENT, 0);
+}
+
+// Shift the rest of the timeline by the time spent paused; the timeline
+// puts the outputs back the way it had them, in inrush groups like any
+// other edge, and then restarts the motor pattern.
+static void resume_cycle(void) {
+    int64_t now = esp_timer_get_time();
+    int64_t paused_us = now - s_hold_at_us;
+    s_tl.base_us += paused_us;
+    s_tl.report.paused_ms += (uint32_t)(paused_us / 1000);
+    publish(now);
+
+    portENTER_CRITICAL(&s_lock);
+    s_hold = false;
+    portEXIT_CRITICAL(&s_lock);
+    timeline_resume(&s_tl, now, s_motor_elapsed_ms);
+    s_paused = false;
+    telemetry_record(TELEM_RESUME, TELEM_NO_COMPONENT, (int32_t)(paused_us / 1000));
+}
+
+static void end_cycle(void) {
+    power_hold(POWER_SCHEDULER, false);
+    s_busy = false;
+    xSemaphoreGive(s_idle);
+}
+
+static void abort_cycle(void) {
+    esp_timer_stop(s_timer);
+    hold_outputs();
+    timeline_abort(&s_tl);
+    end_cycle();
+}
+
+// One wake-up of the scheduler task for the notification `bits`.
+static void scheduler_work(uint32_t bits) {
+    if (bits & NOTIFY_ABORT) {
+        abort_cycle();
+        return;
+    }
+    if ((bits & NOTIFY_PAUSE) && !s_paused) {
+        pause_cycle();
+    }
+    if ((bits & NOTIFY_RESUME) && s_paused) {
+        resume_cycle();
+    }
+    if (s_paused) {
+        return;
+    }
+
+    if (!run_timeline()) {
+        timeline_finish(&s_tl);
+        end_cycle();
+    }
+}
+
+static void scheduler_task(void* arg) {
+    // The motor timer's interrupt is allocated on the core that registers
+    // it, so this happens here, on the real-time core.
+    SchedulerBoot* boot = arg;
+    boot->err = motor_init();
+    xSemaphoreGive(boot->done);
+
+    while (1) {
+        uint32_t bits = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+        if (!s_busy) {
+            continue;
+        }
+#if CONFIG_CYCLE_DIAGNOSTICS
+        // From the time the timer was set for to this task running, then
+        // until it waits again.
+        int64_t woke = esp_timer_get_time();
+        if ((bits & NOTIFY_TIMER) && s_armed_us) {
+            diag_record_dispatch(woke - s_armed_us);
+        }
+#endif
+        s_armed_us = 0;
+        scheduler_work(bits);
+#if CONFIG_CYCLE_DIAGNOSTICS
+        diag_record_busy(esp_timer_get_time() - woke);
+#endif
+    }
+}
+
+esp_err_t scheduler_init(void) {
+    if (s_task) {
+        return ESP_OK;
+    }
+
+    s_idle    = xSemaphoreCreateBinary();
+    s_claim   = xSemaphoreCreateMutex();
+    s_reports = xQueueCreate(REPORT_QUEUE_LEN, sizeof(PhaseReport));
+    if (!s_idle || !s_claim || !s_reports) {
+        ESP_LOGE(TAG, "Failed to create scheduler queues");
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback        = scheduler_timer_cb,
+        .arg             = NULL,
+        .dispatch_method = SCHED_TIMER_DISPATCH,
+        .name            = "sched",
+    };
+    esp_err_t err = esp_timer_create(&timer_args, &s_timer);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create timer: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    SchedulerBoot boot = { .done = xSemaphoreCreateBinary(), .err = ESP_OK };
+    if (!boot.done) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(scheduler_task, "scheduler", CONFIG_CYCLE_SCHED_TASK_STACK,
+                                &boot, TASK_PRIO_SCHEDULER, &s_task, TASK_CORE_RT) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create scheduler task");
+        vSemaphoreDelete(boot.done);
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(boot.done, portMAX_DELAY);
+    vSemaphoreDelete(boot.done);
+    if (boot.err != ESP_OK) {
+        vTaskDelete(s_task);
+        s_task = NULL;
+        return boot.err;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t start(const Program* prog, int64_t epoch_us, uint32_t from_ms, bool dry_run) {
+    if (!s_task || s_busy) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Clear stale completions left over from an earlier run.
+    xSemaphoreTake(s_idle, 0);
+    PhaseReport stale;
+    while (xQueueReceive(s_reports, &stale, 0) == pdTRUE) {
+    }
+
+    timeline_begin(&s_tl, prog, epoch_us, &s_hooks);
+    if (from_ms) {
+        timeline_seek(&s_tl, from_ms);
+    }
+    publish(epoch_us + (int64_t)from_ms * 1000);
+    s_hold    = false;
+    s_paused  = false;
+    s_dry_run = dry_run;
+    s_busy    = true;
+    xTaskNotify(s_task, NOTIFY_TIMER, eSetBits);
+    return ESP_OK;
+}
+
+esp_err_t scheduler_start(const Program* prog, int64_t epoch_us, uint32_t from_ms) {
+    return start(prog, epoch_us, from_ms, false);
+}
+
+esp_err_t scheduler_start_dry_run(const Program* prog, int64_t epoch_us) {
+    return start(prog, epoch_us, 0, true);
+}
+
+// Outputs go safe right here for pause and abort; the task shifts or
+// drains the timeline when it runs.
+static uint32_t prepare_command(SchedulerCommand cmd) {
+    uint32_t bit = 0;
+    portENTER_CRITICAL_SAFE(&s_lock);
+    if (s_busy) {
+        switch (cmd) {
+            case SCHED_CMD_PAUSE:
+                if (!s_hold) {
+                    s_hold_at_us = esp_timer_get_time();
+                    hold_outputs();
+                }
+                bit = NOTIFY_PAUSE;
+                break;
+            case SCHED_CMD_RESUME:
+                bit = NOTIFY_RESUME;
+                break;
+            case SCHED_CMD_ABORT:
+                hold_outputs();
+                bit = NOTIFY_ABORT;
+                break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&s_lock);
+    return bit;
+}
+
+esp_err_t scheduler_command(SchedulerCommand cmd) {
+    uint32_t bit = prepare_command(cmd);
+    if (!bit) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xTaskNotify(s_task, bit, eSetBits);
+    return ESP_OK;
+}
+
+void scheduler_command_from_isr(SchedulerCommand cmd, BaseType_t* woken) {
+    uint32_t bit = prepare_command(cmd);
+    if (bit) {
+        xTaskNotifyFromISR(s_task, bit, eSetBits, woken);
+    }
+}
+
+void scheduler_sense(void) {
+    if (s_busy) {
+        xTaskNotify(s_task, NOTIFY_SENSOR, eSetBits);
+    }
+}
+
+void scheduler_sense_from_isr(BaseType_t* woken) {
+    if (s_busy) {
+        xTaskNotifyFromISR(s_task, NOTIFY_SENSOR, eSetBits, woken);
+    }
+}
+
+bool scheduler_paused(void) {
+    return s_busy && s_hold;
+}
+
+bool scheduler_progress(SchedulerProgress* out) {
+    portENTER_CRITICAL(&s_lock);
+    bool    busy    = s_busy;
+    bool    held    = s_hold;
+    int64_t hold_at = s_hold_at_us;
+    int     phase   = s_pub_phase;
+    int64_t base_us = s_pub_base_us;
+    int64_t wake_us = s_pub_wake_us;
+    uint32_t total  = s_pub_total_ms;
+    portEXIT_CRITICAL(&s_lock);
+    if (!busy) {
+        return false;
+    }
+    int64_t now = esp_timer_get_time();
+    int64_t at  = held ? hold_at : now;
+    *out = (SchedulerProgress){
+        .phase      = phase,
+        .elapsed_ms = at > base_us ? (uint32_t)((at - base_us) / 1000) : 0,
+        .total_ms   = total,
+        .quiet_ms   = held ? UINT32_MAX : wake_us > now ? (uint32_t)((wake_us - now) / 1000) : 0,
+        .paused     = held,
+    };
+    return true;
+}
+
+bool scheduler_claim(TickType_t timeout) {
+    return s_claim && xSemaphoreTake(s_claim, timeout) == pdTRUE;
+}
+
+void scheduler_release(void) {
+    xSemaphoreGive(s_claim);
+}
+
+bool scheduler_wait_report(PhaseReport* report, TickType_t timeout) {
+    return xQueueReceive(s_reports, report, timeout) == pdTRUE;
+}
+
+bool scheduler_wait_idle(TickType_t timeout) {
+    if (!s_busy) {
+        return true;
+    }
+    return xSemaphoreTake(s_idle, timeout) == pdTRUE;
+}
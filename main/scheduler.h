@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "program.h"
+#include "timeline.h"
+
+// ------------------------- EDGE SCHEDULER -------------------------
+// One long-lived task owns every output edge. It walks a compiled
+// TimelineEdge array in order and fires each record from an esp_timer
+// alarm, so heap use does not depend on the size of the program.
+//
+// Every deadline is absolute: epoch + abs_time_ms on the esp_timer clock.
+// Nothing is measured relative to the previous edge or phase, so time
+// spent dispatching never accumulates into drift over a long cycle.
+//
+// A pause switches every output OFF in the caller's own context, then the
+// task freezes the clock. On resume the epoch moves forward by the time
+// spent paused, the outputs the timeline had ON come back, and a running
+// motor pattern rejoins where it left off.
+//
+// The walk itself lives in timeline.c; this file adds the task, the timer
+// and pause/resume/abort around it. Sensor values come from sensors.h;
+// each new one runs the timeline so its triggers act without waiting for
+// the next edge.
+
+typedef enum {
+    SCHED_CMD_PAUSE,
+    SCHED_CMD_RESUME,
+    SCHED_CMD_ABORT,
+} SchedulerCommand;
+
+// Create the scheduler task and its timer. Call once at boot.
+esp_err_t scheduler_init(void);
+
+// Start walking `prog`'s edges. Edge times are counted from `epoch_us` on
+// the esp_timer clock, beginning `from_ms` into the cycle (timeline_seek;
+// 0 for the whole cycle). `prog` must stay valid until the scheduler is
+// idle.
+esp_err_t scheduler_start(const Program* prog, int64_t epoch_us, uint32_t from_ms);
+
+// The same walk with every output left alone, timing and phase reports
+// included: the diagnostics bench (diag.h). Motor segments would still
+// run, so `prog` should have none.
+esp_err_t scheduler_start_dry_run(const Program* prog, int64_t epoch_us);
+
+// Whoever runs the scheduler, or writes the program partition a cycle
+// reads its edges from, holds it for as long as that takes: the cycle loop
+// from a cycle's start to its end, the diagnostics bench, and an upload
+// (program_http.c), whose flash erases would stall the scheduler and the
+// motor timer for as long as the cache is off. False if it is not free
+// within `timeout`.
+bool      scheduler_claim(TickType_t timeout);
+void      scheduler_release(void);
+
+// Wait for the next PhaseReport; one is produced per phase, in order, and
+// all of a cycle's are queued by the time it goes idle.
+bool scheduler_wait_report(PhaseReport* report, TickType_t timeout);
+
+// Block until every edge has fired or the cycle was aborted.
+bool scheduler_wait_idle(TickType_t timeout);
+
+// Pause, resume or abort the running cycle. Pause and abort switch the
+// outputs OFF before returning. ESP_ERR_INVALID_STATE when idle.
+esp_err_t scheduler_command(SchedulerCommand cmd);
+void      scheduler_command_from_isr(SchedulerCommand cmd, BaseType_t* woken);
+
+// A sensor has a new value: check the running phase's triggers. Cheap
+// when no cycle runs.
+void      scheduler_sense(void);
+void      scheduler_sense_from_isr(BaseType_t* woken);
+
+// A pause is in effect.
+bool      scheduler_paused(void);
+
+// Where the running cycle is, for a checkpoint (checkpoint.h) or the
+// live status (live_status.h).
+typedef struct {
+    int      phase;           // phase of the next edge
+    uint32_t elapsed_ms;      // cycle time reached, frozen while paused
+    uint32_t total_ms;        // end of the program's last phase
+    uint32_t quiet_ms;        // until the scheduler next has work, UINT32_MAX while paused
+    bool     paused;
+} SchedulerProgress;
+
+// False when no cycle runs. Safe from any task.
+bool      scheduler_progress(SchedulerProgress* out);
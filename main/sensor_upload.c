@@ -0,0 +1,105 @@
+#include "sensor_upload.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "components.h"
+#include "sensors.h"
+#include "tasks.h"
+
+static const char* TAG = "SENSOR_UP";
+
+#define UPLOAD_BATCH          16        // windows per request at most
+#define UPLOAD_BODY_MAX       4096
+#define UPLOAD_TIMEOUT_MS     5000
+#define UPLOAD_TASK_STACK     4096
+
+static esp_http_client_handle_t s_client = NULL;
+static char                     s_body[UPLOAD_BODY_MAX];
+
+// Format as many of `n` windows as fit; returns how many went in, or 0.
+static size_t format_batch(const SensorSample* samples, size_t n, int* len) {
+    int off = snprintf(s_body, sizeof(s_body),
+                       "{\"uptimeMs\":%lu,\"periodMs\":%d,\"dropped\":%lu,\"overruns\":%lu,\"samples\":[",
+                       (unsigned long)(esp_timer_get_time() / 1000), CONFIG_CYCLE_SENSOR_PERIOD_MS,
+                       (unsigned long)sensors_dropped(), (unsigned long)sensors_overruns());
+    size_t done = 0;
+    for (; done < n; done++) {
+        const SensorSample* s = &samples[done];
+        char sample[64 + NUM_SENSORS * 80];
+        int k = snprintf(sample, sizeof(sample), "%s{\"t\":%lu", done ? "," : "", (unsigned long)s->t_ms);
+        for (int id = 0; id < NUM_SENSORS; id++) {
+            if (s->valid & (1u << id)) {
+                k += snprintf(sample + k, sizeof(sample) - k, ",\"%s\":{\"min\":%ld,\"mean\":%ld,\"max\":%ld}",
+                              sensor_states[id].name, (long)s->stat[id].min, (long)s->stat[id].mean,
+                              (long)s->stat[id].max);
+            }
+        }
+        k += snprintf(sample + k, sizeof(sample) - k, "}");
+        if (off + k + 2 >= (int)sizeof(s_body)) {    // room for "]}"
+            break;
+        }
+        memcpy(s_body + off, sample, k);
+        off += k;
+    }
+    off += snprintf(s_body + off, sizeof(s_body) - off, "]}");
+    *len = off;
+    return done;
+}
+
+static bool post(int len) {
+    esp_http_client_set_post_field(s_client, s_body, len);
+    esp_err_t err = esp_http_client_perform(s_client);
+    int status = err == ESP_OK ? esp_http_client_get_status_code(s_client) : 0;
+    if (err != ESP_OK || status < 200 || status >= 300) {
+        ESP_LOGW(TAG, "Upload failed: %s, HTTP %d", esp_err_to_name(err), status);
+        return false;
+    }
+    return true;
+}
+
+static void upload_task(void* arg) {
+    static SensorSample batch[UPLOAD_BATCH];
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_CYCLE_SENSOR_UPLOAD_S * 1000));
+
+        // Drain what has queued up, a batch per request; stop at the first
+        // failure and retry the same windows next time.
+        size_t n;
+        while ((n = sensors_peek(batch, UPLOAD_BATCH)) > 0) {
+            int len;
+            size_t sent = format_batch(batch, n, &len);
+            if (sent == 0 || !post(len)) {
+                break;
+            }
+            sensors_consume(sent);
+        }
+    }
+}
+
+esp_err_t sensor_upload_start(void) {
+    const esp_http_client_config_t cfg = {
+        .url               = CONFIG_CYCLE_SENSOR_UPLOAD_URL,
+        .method            = HTTP_METHOD_POST,
+        .timeout_ms        = UPLOAD_TIMEOUT_MS,
+        .keep_alive_enable = true,
+    };
+    s_client = esp_http_client_init(&cfg);
+    if (!s_client) {
+        ESP_LOGE(TAG, "Failed to create the HTTP client");
+        return ESP_ERR_NO_MEM;
+    }
+    esp_http_client_set_header(s_client, "Content-Type", "application/json");
+    if (xTaskCreatePinnedToCore(upload_task, "sensor_up", UPLOAD_TASK_STACK, NULL,
+                                TASK_PRIO_UPLOAD, NULL, TASK_CORE_BG) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the upload task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "esp_err.h"
+
+// ------------------------- SENSOR UPLOAD -------------------------
+// With CONFIG_CYCLE_SENSOR_UPLOAD a low-priority task posts the aggregated
+// sensor windows (sensors.h) to CONFIG_CYCLE_SENSOR_UPLOAD_URL, the Node
+// server's POST /api/esp32/sensor-data, every
+// CONFIG_CYCLE_SENSOR_UPLOAD_S seconds: one request per batch, over one
+// kept-alive connection, never one per reading.
+//
+//   {"uptimeMs":..,"periodMs":..,"dropped":..,"overruns":..,
+//    "samples":[{"t":..,"Water Level":{"min":..,"mean":..,"max":..},..},..]}
+//
+// Windows stay queued until the server has taken them, so a network
+// outage only costs what overflows the history ring.
+
+// Start the upload task; Wi-Fi is brought up by program_http_start().
+esp_err_t sensor_upload_start(void);
@@ -0,0 +1,335 @@
+#include "sensors.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/gpio.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "scheduler.h"
+#include "tasks.h"
+
+static const char* TAG = "SENSORS";
+
+#define ADC_SAMPLE_HZ         1000      // all ADC sensors together
+#define ADC_FRAME_SAMPLES     100       // decimated to one reading per sensor: 10 frames/s
+#define ADC_FRAME_BYTES       (ADC_FRAME_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES)
+#define ADC_POOL_FRAMES       2         // DMA fills one while the task reads the other
+#define FILTER_SHIFT          2         // low-pass: y += (x - y) / 4 per frame
+#define ADC_ATTEN             ADC_ATTEN_DB_12
+#define ADC_FULL_SCALE_MV     2500      // ADC_ATTEN_DB_12, uncalibrated
+#define ADC_MAX_CHANNELS      8         // the 3-bit channel field of a TYPE2 result
+#define ACQ_TASK_STACK        3072
+
+#define HISTORY_LEN           CONFIG_CYCLE_SENSOR_HISTORY
+#define HISTORY_MASK          (HISTORY_LEN - 1)
+
+_Static_assert((HISTORY_LEN & HISTORY_MASK) == 0, "CYCLE_SENSOR_HISTORY must be a power of two");
+
+static volatile int32_t  s_values[NUM_SENSORS];
+static volatile uint32_t s_ready = 0;   // bit per sensor with a value; set by init and the task
+
+static adc_continuous_handle_t s_adc = NULL;
+static adc_cali_handle_t       s_cali[NUM_SENSORS];
+static uint8_t                 s_by_channel[ADC_MAX_CHANNELS];
+static TaskHandle_t            s_task = NULL;
+static volatile uint32_t       s_overruns = 0;     // written by the ADC interrupt only
+
+// Aggregation, acquisition task only.
+typedef struct {
+    int64_t  sum;
+    int32_t  min;
+    int32_t  max;
+    uint32_t count;
+} Window;
+
+static Window  s_window[NUM_SENSORS];
+static int64_t s_window_end_us = 0;
+
+// Closed windows, single producer (the acquisition task) / single
+// consumer. Free-running indices as in telemetry.c.
+static SensorSample s_history[HISTORY_LEN];
+static uint32_t     s_head = 0;
+static uint32_t     s_tail = 0;
+static uint32_t     s_dropped = 0;
+
+// Closed pulls the input to GND.
+static void switch_isr(void* arg) {
+    uint8_t id = (uint8_t)(uintptr_t)arg;
+    s_values[id] = gpio_get_level(sensor_states[id].source) == 0;
+
+    BaseType_t woken = pdFALSE;
+    scheduler_sense_from_isr(&woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+static esp_err_t switch_init(uint8_t id) {
+    int pin = sensor_states[id].source;
+    const gpio_config_t cfg = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode         = GPIO_MODE_INPUT,
+        .pull_up_en   = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type    = GPIO_INTR_ANYEDGE,
+    };
+    esp_err_t err = gpio_config(&cfg);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {    // already installed is fine
+        return err;
+    }
+    s_values[id] = gpio_get_level(pin) == 0;
+    s_ready |= 1u << id;
+    return gpio_isr_handler_add(pin, switch_isr, (void*)(uintptr_t)id);
+}
+
+// Runs in the ADC interrupt once a frame is in memory.
+static bool IRAM_ATTR adc_frame_done(adc_continuous_handle_t handle, const adc_continuous_evt_data_t* edata,
+                                     void* arg) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(s_task, &woken);
+    return woken == pdTRUE;
+}
+
+static bool IRAM_ATTR adc_pool_full(adc_continuous_handle_t handle, const adc_continuous_evt_data_t* edata,
+                                    void* arg) {
+    s_overruns++;
+    return false;
+}
+
+static int32_t to_mv(uint8_t id, uint32_t raw) {
+    int mv;
+    if (s_cali[id] && adc_cali_raw_to_voltage(s_cali[id], (int)raw, &mv) == ESP_OK) {
+        return mv;
+    }
+    return (int32_t)(raw * ADC_FULL_SCALE_MV / ((1u << SOC_ADC_DIGI_MAX_BITWIDTH) - 1));
+}
+
+// Decimate every channel over one frame of conversions, then filter.
+static void take_frame(const uint8_t* frame, uint32_t len) {
+    uint32_t sum[NUM_SENSORS] = {0};
+    uint32_t count[NUM_SENSORS] = {0};
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        const adc_digi_output_data_t* d = (const adc_digi_output_data_t*)&frame[i];
+        if (d->type2.unit != ADC_UNIT_1) {
+            continue;
+        }
+        uint8_t id = s_by_channel[d->type2.channel];
+        if (id != SENSOR_NONE) {
+            sum[id] += d->type2.data;
+            count[id]++;
+        }
+    }
+    for (int id = 0; id < NUM_SENSORS; id++) {
+        if (!count[id]) {
+            continue;
+        }
+        int32_t mv = to_mv((uint8_t)id, sum[id] / count[id]);
+        if (s_ready & (1u << id)) {
+            int32_t y = s_values[id];
+            mv = y + ((mv - y) >> FILTER_SHIFT);
+        }
+        s_values[id] = mv;
+        s_ready |= 1u << id;
+    }
+}
+
+static void close_window(void) {
+    uint32_t head = s_head;
+    if (head - __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE) >= HISTORY_LEN) {
+        __atomic_store_n(&s_dropped, s_dropped + 1, __ATOMIC_RELAXED);
+    } else {
+        SensorSample* out = &s_history[head & HISTORY_MASK];
+        *out = (SensorSample){ .t_ms = (uint32_t)(s_window_end_us / 1000) };
+        for (int id = 0; id < NUM_SENSORS; id++) {
+            const Window* w = &s_window[id];
+            if (w->count) {
+                out->valid |= 1u << id;
+                out->stat[id] = (SensorStat){
+                    .min  = w->min,
+                    .mean = (int32_t)(w->sum / w->count),
+                    .max  = w->max,
+                };
+            }
+        }
+        __atomic_store_n(&s_head, head + 1, __ATOMIC_RELEASE);
+    }
+    memset(s_window, 0, sizeof(s_window));
+}
+
+// Every sensor's current value, switches included, once per frame.
+static void aggregate(int64_t now) {
+    if (s_window_end_us == 0) {
+        s_window_end_us = now + (int64_t)CONFIG_CYCLE_SENSOR_PERIOD_MS * 1000;
+    }
+    for (int id = 0; id < NUM_SENSORS; id++) {
+        if (!(s_ready & (1u << id))) {
+            continue;
+        }
+        int32_t v = s_values[id];
+        Window* w = &s_window[id];
+        if (w->count == 0 || v < w->min) {
+            w->min = v;
+        }
+        if (w->count == 0 || v > w->max) {
+            w->max = v;
+        }
+        w->sum += v;
+        w->count++;
+    }
+    if (now >= s_window_end_us) {
+        close_window();
+        s_window_end_us += (int64_t)CONFIG_CYCLE_SENSOR_PERIOD_MS * 1000;
+        if (s_window_end_us <= now) {    // fell behind; restart the grid
+            s_window_end_us = now + (int64_t)CONFIG_CYCLE_SENSOR_PERIOD_MS * 1000;
+        }
+    }
+}
+
+static void acquisition_task(void* arg) {
+    static uint8_t frame[ADC_FRAME_BYTES];
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        uint32_t len = 0;
+        bool fresh = false;
+        while (adc_continuous_read(s_adc, frame, sizeof(frame), &len, 0) == ESP_OK) {
+            take_frame(frame, len);
+            aggregate(esp_timer_get_time());
+            fresh = true;
+        }
+        if (fresh) {
+            scheduler_sense();
+        }
+    }
+}
+
+static void cali_init(uint8_t id) {
+    s_cali[id] = NULL;
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    const adc_cali_curve_fitting_config_t cfg = {
+        .unit_id  = ADC_UNIT_1,
+        .chan     = (adc_channel_t)sensor_states[id].source,
+        .atten    = ADC_ATTEN,
+        .bitwidth = ADC_BITWIDTH_DEFAULT,
+    };
+    if (adc_cali_create_scheme_curve_fitting(&cfg, &s_cali[id]) == ESP_OK) {
+        return;
+    }
+    s_cali[id] = NULL;
+#endif
+    ESP_LOGW(TAG, "%s: no ADC calibration, readings are approximate", sensor_states[id].name);
+}
+
+static esp_err_t adc_init(void) {
+    adc_digi_pattern_config_t pattern[NUM_SENSORS];
+    uint32_t n = 0;
+    memset(s_by_channel, SENSOR_NONE, sizeof(s_by_channel));
+    for (int id = 0; id < NUM_SENSORS; id++) {
+        if (sensor_states[id].kind != SENSOR_ADC) {
+            continue;
+        }
+        pattern[n++] = (adc_digi_pattern_config_t){
+            .atten     = ADC_ATTEN,
+            .channel   = (uint8_t)sensor_states[id].source,
+            .unit      = ADC_UNIT_1,
+            .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+        };
+        s_by_channel[sensor_states[id].source] = (uint8_t)id;
+        cali_init((uint8_t)id);
+    }
+    if (n == 0) {
+        return ESP_OK;
+    }
+
+    if (xTaskCreatePinnedToCore(acquisition_task, "sensors", ACQ_TASK_STACK, NULL,
+                                TASK_PRIO_SENSORS, &s_task, TASK_CORE_BG) != pdPASS) {
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    const adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = ADC_POOL_FRAMES * ADC_FRAME_BYTES,
+        .conv_frame_size    = ADC_FRAME_BYTES,
+    };
+    esp_err_t err = adc_continuous_new_handle(&handle_cfg, &s_adc);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const adc_continuous_config_t cfg = {
+        .pattern_num    = n,
+        .adc_pattern    = pattern,
+        .sample_freq_hz = ADC_SAMPLE_HZ,
+        .conv_mode      = ADC_CONV_SINGLE_UNIT_1,
+        .format         = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+    };
+    err = adc_continuous_config(s_adc, &cfg);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const adc_continuous_evt_cbs_t cbs = {
+        .on_conv_done = adc_frame_done,
+        .on_pool_ovf  = adc_pool_full,
+    };
+    err = adc_continuous_register_event_callbacks(s_adc, &cbs, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return adc_continuous_start(s_adc);
+}
+
+esp_err_t sensors_init(void) {
+    for (int id = 0; id < NUM_SENSORS; id++) {
+        if (sensor_states[id].kind == SENSOR_SWITCH) {
+            esp_err_t err = switch_init((uint8_t)id);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG, "%s: %s", sensor_states[id].name, esp_err_to_name(err));
+                return err;
+            }
+        }
+    }
+    esp_err_t err = adc_init();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "ADC sampling failed: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+bool sensor_read(uint8_t sensor, int32_t* value) {
+    if (sensor >= NUM_SENSORS || !(s_ready & (1u << sensor))) {
+        return false;
+    }
+    *value = s_values[sensor];
+    return true;
+}
+
+size_t sensors_peek(SensorSample* out, size_t max) {
+    uint32_t tail = s_tail;
+    uint32_t head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    while (n < max && tail != head) {
+        out[n++] = s_history[tail & HISTORY_MASK];
+        tail++;
+    }
+    return n;
+}
+
+void sensors_consume(size_t n) {
+    uint32_t tail = s_tail;
+    uint32_t queued = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE) - tail;
+    __atomic_store_n(&s_tail, tail + (n < queued ? (uint32_t)n : queued), __ATOMIC_RELEASE);
+}
+
+uint32_t sensors_dropped(void) {
+    return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
+
+uint32_t sensors_overruns(void) {
+    return s_overruns;
+}
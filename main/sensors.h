@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "components.h"
+
+// ------------------------- SENSOR ACQUISITION -------------------------
+// Latest value of every sensor in CYCLE_SENSORS, kept up to date without
+// polling:
+//   - a switch is read in its GPIO interrupt on every change;
+//   - the ADC sensors are sampled by the continuous ADC driver, which DMAs
+//     frames of conversions into memory, double-buffered: one frame fills
+//     while the task works on the last one. The task wakes once per frame,
+//     decimates each channel to one averaged reading, converts it to mV
+//     and runs it through a first-order low-pass filter.
+// Every new value wakes the scheduler (scheduler_sense), which checks the
+// triggers of the running phase against it.
+//
+// Once per frame the task also folds every sensor's value into an
+// aggregation window of CONFIG_CYCLE_SENSOR_PERIOD_MS. Each closed window
+// (min / mean / max) is queued in a history ring for a consumer such as
+// sensor_upload.h that sends them in batches.
+
+// Configure the inputs and start sampling. Call after scheduler_init().
+esp_err_t sensors_init(void);
+
+// Latest value of `sensor`: 0/1 for a switch, mV for an ADC input. False
+// before the first reading. Safe from any task.
+bool sensor_read(uint8_t sensor, int32_t* value);
+
+typedef struct {
+    int32_t min;
+    int32_t mean;
+    int32_t max;
+} SensorStat;
+
+// One aggregation window of every sensor.
+typedef struct {
+    uint32_t   t_ms;              // uptime at the end of the window
+    uint32_t   valid;             // bit per sensor that had readings in the window
+    SensorStat stat[NUM_SENSORS];
+} SensorSample;
+
+// Copy up to `max` of the oldest windows not consumed yet. They stay
+// queued until sensors_consume(), so a failed upload can retry them. One
+// consumer task only.
+size_t   sensors_peek(SensorSample* out, size_t max);
+void     sensors_consume(size_t n);
+
+// Windows lost to a full history ring, and ADC frames lost because the
+// task fell behind the DMA, since boot.
+uint32_t sensors_dropped(void);
+uint32_t sensors_overruns(void);
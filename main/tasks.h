@@ -0,0 +1,48 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+// ------------------------- TASK PLACEMENT -------------------------
+// Every task of the firmware, by tier. Only the real-time tier touches
+// outputs on time; everything else may be late without moving an edge.
+//
+//   real time    scheduler            edge dispatch (scheduler.h), and the
+//                                     motor timer ISR registered from it
+//   control      sensors 8            readings for the triggers
+//                console 5, select 4  operator commands, "load" parsing
+//   background   HTTP server 3        uploads, GET /status, /live sends
+//                live status 3, checkpoint 3, sensor upload 2,
+//                telemetry drain 1
+//
+// ESP-IDF's own tasks sit between the tiers: esp_timer at 22 and Wi-Fi
+// at 23 above, lwIP at 18 below the scheduler. The scheduler runs above
+// lwIP so an upload or a status stream cannot hold an edge back behind
+// network work; it stays below esp_timer, which delivers its alarm unless
+// the ISR dispatches it directly.
+//
+// On dual-core targets the real-time tier is pinned to CONFIG_CYCLE_RT_CORE
+// and the other tiers to the other core, where Wi-Fi runs by default. On
+// single-core targets (ESP32-C3) everything shares core 0 and only the
+// priorities separate the tiers.
+
+#define TASK_PRIO_SCHEDULER   CONFIG_CYCLE_SCHED_TASK_PRIORITY
+#define TASK_PRIO_SENSORS     8
+#define TASK_PRIO_CONSOLE     5
+#define TASK_PRIO_SELECT      4
+#define TASK_PRIO_HTTPD       3
+#define TASK_PRIO_LIVE        3
+#define TASK_PRIO_CHECKPOINT  3
+#define TASK_PRIO_UPLOAD      2
+#define TASK_PRIO_TELEMETRY   1
+
+#if CONFIG_FREERTOS_UNICORE
+#define TASK_CORE_RT          0
+#define TASK_CORE_BG          0
+#else
+#define TASK_CORE_RT          CONFIG_CYCLE_RT_CORE
+#define TASK_CORE_BG          (1 - CONFIG_CYCLE_RT_CORE)
+#endif
+
+_Static_assert(TASK_PRIO_SCHEDULER > TASK_PRIO_SENSORS,
+               "CYCLE_SCHED_TASK_PRIORITY must be above the control tier");
@@ -0,0 +1,140 @@
+#include "telemetry.h"
+
+#if CONFIG_CYCLE_TELEMETRY
+
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "components.h"
+#include "tasks.h"
+
+static const char* TAG = "TELEMETRY";
+
+_Static_assert(TELEM_NO_COMPONENT == COMPONENT_NONE, "edge records store component_at_pin() as is");
+
+#define RING_LEN           CONFIG_CYCLE_TELEMETRY_RING_LEN
+#define RING_MASK          (RING_LEN - 1)
+#define DRAIN_BATCH        32
+#define DRAIN_TASK_STACK   3072
+
+_Static_assert((RING_LEN & RING_MASK) == 0, "CYCLE_TELEMETRY_RING_LEN must be a power of two");
+
+// Free-running indices: the producer only writes s_head, the consumer only
+// writes s_tail. A record is published by the release store of s_head after
+// it is filled, and its slot is given back by the release store of s_tail.
+static TelemetryRecord s_ring[RING_LEN];
+static uint32_t        s_head = 0;
+static uint32_t        s_tail = 0;
+static uint32_t        s_dropped = 0;       // written by the producer only
+
+static TelemetrySink   s_sink = NULL;
+
+static const char* const event_names[] = {
+    [TELEM_ON]             = "on",
+    [TELEM_OFF]            = "off",
+    [TELEM_PHASE_END]      = "phase_end",
+    [TELEM_MOTOR_START]    = "motor_start",
+    [TELEM_MOTOR_FAILED]   = "motor_failed",
+    [TELEM_PAUSE]          = "pause",
+    [TELEM_RESUME]         = "resume",
+    [TELEM_ABORT]          = "abort",
+    [TELEM_REPORT_DROPPED] = "report_dropped",
+    [TELEM_SENSOR_END]     = "sensor_end",
+    [TELEM_SENSOR_CUT]     = "sensor_cut",
+};
+
+static int16_t saturate(int32_t v) {
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : (int16_t)v;
+}
+
+static void push(uint32_t now, uint8_t event, uint8_t component, int16_t arg) {
+    uint32_t head = s_head;
+    if (head - __atomic_load_n(&s_tail, __ATOMIC_ACQUIRE) >= RING_LEN) {
+        __atomic_store_n(&s_dropped, s_dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    s_ring[head & RING_MASK] = (TelemetryRecord){
+        .time_us   = now,
+        .component = component,
+        .event     = event,
+        .arg       = arg,
+    };
+    __atomic_store_n(&s_head, head + 1, __ATOMIC_RELEASE);
+}
+
+void telemetry_record(uint8_t event, uint8_t component, int32_t arg) {
+    push((uint32_t)esp_timer_get_time(), event, component, saturate(arg));
+}
+
+void telemetry_record_edge(uint32_t set_mask, uint32_t clear_mask, int32_t late_us) {
+    uint32_t now = (uint32_t)esp_timer_get_time();
+    int16_t late = saturate(late_us);
+    for (uint32_t m = set_mask; m; m &= m - 1) {
+        push(now, TELEM_OFF, component_at_pin(__builtin_ctz(m)), late);
+    }
+    for (uint32_t m = clear_mask; m; m &= m - 1) {
+        push(now, TELEM_ON, component_at_pin(__builtin_ctz(m)), late);
+    }
+}
+
+uint32_t telemetry_dropped(void) {
+    return __atomic_load_n(&s_dropped, __ATOMIC_RELAXED);
+}
+
+// One line per record, so a host can grep "TLM" out of the console.
+static void console_sink(const TelemetryRecord* recs, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const TelemetryRecord* r = &recs[i];
+        const char* event = r->event < sizeof(event_names) / sizeof(event_names[0]) ? event_names[r->event] : "?";
+        const char* comp  = r->component < NUM_COMPONENTS ? component_states[r->component].name : "-";
+        printf("TLM %lu %s \"%s\" %d\n", (unsigned long)r->time_us, event, comp, r->arg);
+    }
+}
+
+static void drain_task(void* arg) {
+    TelemetryRecord batch[DRAIN_BATCH];
+    uint32_t reported_drops = 0;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_CYCLE_TELEMETRY_FLUSH_MS));
+
+        uint32_t tail = s_tail;
+        uint32_t head;
+        while ((head = __atomic_load_n(&s_head, __ATOMIC_ACQUIRE)) != tail) {
+            size_t n = 0;
+            while (n < DRAIN_BATCH && tail != head) {
+                batch[n++] = s_ring[tail & RING_MASK];
+                tail++;
+            }
+            __atomic_store_n(&s_tail, tail, __ATOMIC_RELEASE);
+            TelemetrySink sink = s_sink;
+            sink(batch, n);
+        }
+
+        uint32_t drops = telemetry_dropped();
+        if (drops != reported_drops) {
+            ESP_LOGW(TAG, "%lu records dropped (ring full)", (unsigned long)(drops - reported_drops));
+            reported_drops = drops;
+        }
+    }
+}
+
+void telemetry_set_sink(TelemetrySink sink) {
+    s_sink = sink ? sink : console_sink;
+}
+
+esp_err_t telemetry_init(void) {
+    if (!s_sink) {
+        s_sink = console_sink;
+    }
+    if (xTaskCreatePinnedToCore(drain_task, "telemetry", DRAIN_TASK_STACK, NULL,
+                                TASK_PRIO_TELEMETRY, NULL, TASK_CORE_BG) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the drain task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+#endif
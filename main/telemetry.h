@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+// ------------------------- TELEMETRY -------------------------
+// Binary event log for the timing path. The scheduler task is the only
+// producer: it appends fixed-size records to a lock-free single-producer /
+// single-consumer ring and never formats or blocks. A low-priority task
+// drains the ring in batches into a sink (the console by default), so
+// recording an event costs a few stores instead of a UART write.
+// A full ring drops new records and counts them; it never stalls the
+// producer.
+
+#define TELEM_NO_COMPONENT  0xFF
+
+typedef enum {
+    TELEM_ON,               // component switched ON; arg = edge lateness (us)
+    TELEM_OFF,              // component switched OFF; arg = edge lateness (us)
+    TELEM_PHASE_END,        // arg = phase
+    TELEM_MOTOR_START,      // arg = segment index
+    TELEM_MOTOR_FAILED,     // arg = segment index
+    TELEM_PAUSE,
+    TELEM_RESUME,           // arg = ms paused (saturated)
+    TELEM_ABORT,            // arg = phase
+    TELEM_REPORT_DROPPED,   // arg = phase
+    TELEM_SENSOR_END,       // phase ended on a sensor; arg = ms saved (saturated)
+    TELEM_SENSOR_CUT,       // component switched OFF by a sensor; arg = phase
+} TelemetryEvent;
+
+typedef struct {
+    uint32_t time_us;       // esp_timer_get_time(), low 32 bits
+    uint8_t  component;     // index into component_states, or TELEM_NO_COMPONENT
+    uint8_t  event;         // TelemetryEvent
+    int16_t  arg;           // saturated to the int16 range
+} TelemetryRecord;
+
+// Receives drained records, oldest first, from the drain task.
+typedef void (*TelemetrySink)(const TelemetryRecord* recs, size_t n);
+
+#if CONFIG_CYCLE_TELEMETRY
+
+// Start the drain task. Call before scheduler_init().
+esp_err_t telemetry_init(void);
+
+// Replace the console sink, e.g. with an HTTP or flash writer.
+void telemetry_set_sink(TelemetrySink sink);
+
+// Producer side: scheduler task only.
+void telemetry_record(uint8_t event, uint8_t component, int32_t arg);
+
+// One ON/OFF record per component switched by an edge.
+void telemetry_record_edge(uint32_t set_mask, uint32_t clear_mask, int32_t late_us);
+
+// Records lost to a full ring since boot.
+uint32_t telemetry_dropped(void);
+
+#else
+
+static inline esp_err_t telemetry_init(void) { return ESP_OK; }
+static inline void telemetry_set_sink(TelemetrySink sink) { (void)sink; }
+static inline void telemetry_record(uint8_t event, uint8_t component, int32_t arg) {
+    (void)event; (void)component; (void)arg;
+}
+static inline void telemetry_record_edge(uint32_t set_mask, uint32_t clear_mask, int32_t late_us) {
+    (void)set_mask; (void)clear_mask; (void)late_us;
+}
+static inline uint32_t telemetry_dropped(void) { return 0; }
+
+#endif
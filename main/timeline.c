@@ -0,0 +1,418 @@
+#include "timeline.h"
+
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "components.h"
+#include "jitter.h"
+#include "motor.h"
+#include "telemetry.h"
+
+#define INRUSH_CAP_MA  CONFIG_CYCLE_INRUSH_CAP_MA
+#define STAGGER_US     (INRUSH_CAP_MA ? CONFIG_CYCLE_INRUSH_STAGGER_US : 0)
+
+static uint32_t phase_end_ms(const Timeline* t, int phase) {
+    const Phase* ph = &t->prog->phases[phase];
+    return ph->start_ms + ph->duration_ms;
+}
+
+static void begin_report(Timeline* t, int phase) {
+    t->report = (PhaseReport){ .phase = phase };
+}
+
+// Hand the report for t->phase to the hook and move on.
+static void finish_phase(Timeline* t) {
+    telemetry_record(TELEM_PHASE_END, TELEM_NO_COMPONENT, t->report.phase);
+    t->hooks->report(&t->report);
+    t->cut_mask = 0;
+    begin_report(t, ++t->phase);
+}
+
+static void record_edge(Timeline* t, const TimelineEdge* e, int64_t late_us) {
+    // Phases never overlap, so an edge past the end of the current phase
+    // belongs to a later one; phases without edges are reported empty.
+    while (t->phase < t->prog->num_phases && e->abs_time_ms > phase_end_ms(t, t->phase)) {
+        finish_phase(t);
+    }
+    int32_t late = late_us > INT32_MAX ? INT32_MAX : (int32_t)late_us;
+    jitter_record(e->gpio_mask_set, e->gpio_mask_clear, late_us);
+    telemetry_record_edge(e->gpio_mask_set, e->gpio_mask_clear, late);
+    PhaseReport* r = &t->report;
+    if (r->edges == 0) {
+        r->start_late_us = late;
+    }
+    r->end_late_us = late;
+    if (late > r->max_late_us) {
+        r->max_late_us = late;
+    }
+    r->edges++;
+}
+
+// Components in the order they get an inrush slot: the direction relay
+// first, so the motor never starts before its direction is set, then the
+// heaviest first so the groups pack tight. Fixed, so a program switches
+// the same way on every run.
+static uint8_t  s_order[NUM_COMPONENTS];
+static uint32_t s_component_mask;
+static bool     s_ordered = false;
+
+static void order_components(void) {
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        uint16_t w = i == COMP_MOTOR_DIRECTION ? UINT16_MAX : component_states[i].inrush_ma;
+        int j = i;
+        for (; j > 0; j--) {
+            uint8_t prev = s_order[j - 1];
+            uint16_t pw = prev == COMP_MOTOR_DIRECTION ? UINT16_MAX : component_states[prev].inrush_ma;
+            if (pw >= w) {
+                break;
+            }
+            s_order[j] = prev;
+        }
+        s_order[j] = (uint8_t)i;
+        s_component_mask |= 1u << component_states[i].pin;
+    }
+    s_ordered = true;
+}
+
+// The outputs of `pending` that may switch ON together: first fit in
+// s_order up to the cap. The first one always fits, however heavy.
+static uint32_t inrush_group(uint32_t pending) {
+    if (INRUSH_CAP_MA == 0) {
+        return pending;
+    }
+    uint32_t group = pending & ~s_component_mask;
+    uint32_t load  = 0;
+    for (int i = 0; i < NUM_COMPONENTS; i++) {
+        const ComponentState* c = &component_states[s_order[i]];
+        uint32_t bit = 1u << c->pin;
+        if (!(pending & bit) || (load && load + c->inrush_ma > INRUSH_CAP_MA)) {
+            continue;
+        }
+        group |= bit;
+        load  += c->inrush_ma;
+    }
+    return group;
+}
+
+// A group just went ON at `at`: the next slot is on the grid from
+// stagger_from, but never closer than STAGGER_US to this one.
+static void next_slot(Timeline* t, int64_t at) {
+    t->stagger_slot++;
+    int64_t due = t->stagger_from + (int64_t)t->stagger_slot * STAGGER_US;
+    t->stagger_due = due > at + STAGGER_US ? due : at + STAGGER_US;
+}
+
+// Switch the held-back outputs group by group as their slots come. True
+// once none are left.
+static bool run_stagger(Timeline* t, int64_t now) {
+    while (t->stagger_mask) {
+        if (t->stagger_due > now) {
+            return false;
+        }
+        const TimelineEdge on = {
+            .abs_time_ms     = (uint32_t)((now - t->base_us) / 1000),
+            .gpio_mask_clear = inrush_group(t->stagger_mask),
+        };
+        if (!t->hooks->apply(&on)) {
+            return false;
+        }
+        t->stagger_mask &= ~on.gpio_mask_clear;
+        t->on_mask      |= on.gpio_mask_clear;
+        int64_t at = esp_timer_get_time();
+        int64_t late_us = at - t->stagger_due;
+        jitter_record(0, on.gpio_mask_clear, late_us);
+        telemetry_record_edge(0, on.gpio_mask_clear, late_us > INT32_MAX ? INT32_MAX : (int32_t)late_us);
+        int64_t waited = t->stagger_due - t->stagger_from;
+        if (waited > t->report.max_stagger_us) {
+            t->report.max_stagger_us = (uint32_t)waited;
+        }
+        next_slot(t, at);
+    }
+    return true;
+}
+
+// Report every phase whose end has passed and whose edges have all fired.
+static void finish_elapsed_phases(Timeline* t, int64_t now) {
+    const Program* prog = t->prog;
+    while (t->phase < prog->num_phases &&
+           t->base_us + (int64_t)phase_end_ms(t, t->phase) * 1000 <= now &&
+           (t->next >= prog->num_edges ||
+            prog->edges[t->next].abs_time_ms > phase_end_ms(t, t->phase))) {
+        finish_phase(t);
+    }
+}
+
+// Cycle time of the next motor segment boundary, or UINT32_MAX.
+static uint32_t next_segment_ms(const Timeline* t) {
+    if (t->seg >= t->prog->num_segments) {
+        return UINT32_MAX;
+    }
+    const MotorSegment* m = &t->prog->segments[t->seg];
+    return t->seg_running ? m->end_ms : m->start_ms;
+}
+
+// The motor engine times the pattern and its end itself; the timeline
+// starts it on the cycle clock and keeps the segment end as a wake-up so
+// phase reports see the motor finish.
+static void dispatch_segments(Timeline* t, int64_t now) {
+    if (t->seg_restart) {
+        if (t->hooks->held() || t->stagger_mask || t->stagger_due > now) {
+            return;
+        }
+        uint32_t late_ms = (uint32_t)((now - t->stagger_from) / 1000);
+        motor_start(t->prog, &t->prog->segments[t->seg], t->seg_elapsed_ms + late_ms);
+        t->seg_restart = false;
+    }
+    uint32_t at;
+    while ((at = next_segment_ms(t)) != UINT32_MAX) {
+        int64_t due = t->base_us + (int64_t)at * 1000;
+        if (due > now) {
+            break;
+        }
+        const MotorSegment* m = &t->prog->segments[t->seg];
+        if (!t->seg_running) {
+            // Outputs that went ON at this instant settle first.
+            if (t->hooks->held() || t->stagger_mask || t->stagger_due > now) {
+                break;
+            }
+            // Started late: join the pattern where it should be by now.
+            esp_err_t err = motor_start(t->prog, m, (uint32_t)((now - due) / 1000));
+            telemetry_record(err == ESP_OK ? TELEM_MOTOR_START : TELEM_MOTOR_FAILED,
+                             TELEM_NO_COMPONENT, t->seg);
+            t->seg_running = true;
+        } else {
+            t->seg_running = false;
+            t->seg++;
+        }
+    }
+}
+
+// Triggers of the current phase, or NULL if it has none.
+static const PhaseTrigger* phase_triggers(Timeline* t) {
+    const Program* prog = t->prog;
+    while (t->trigger < prog->num_triggers && prog->triggers[t->trigger].phase < t->phase) {
+        t->trigger++;
+    }
+    if (t->trigger >= prog->num_triggers || prog->triggers[t->trigger].phase != t->phase) {
+        return NULL;
+    }
+    return &prog->triggers[t->trigger];
+}
+
+static bool trigger_met(const Timeline* t, const PhaseTrigger* k) {
+    int32_t v;
+    if (!t->hooks->sense(k->sensor, &v)) {
+        return false;
+    }
+    return k->op == TRIGGER_BELOW ? v < k->threshold : v > k->threshold;
+}
+
+// Stop the motor pattern of the phase ending at `end_ms`, if it runs, and
+// skip any it has still to come.
+static void cut_motor(Timeline* t, uint32_t end_ms) {
+    while (t->seg < t->prog->num_segments && t->prog->segments[t->seg].start_ms <= end_ms) {
+        if (t->seg_running) {
+            motor_stop();
+            t->seg_running = false;
+        }
+        t->seg++;
+    }
+}
+
+// Everything the phase holds goes OFF at once and its remaining edges are
+// dropped; the rest of the timeline moves forward by the time left.
+static void end_phase_early(Timeline* t, int64_t now, uint32_t end_ms) {
+    int64_t left_us = t->base_us + (int64_t)end_ms * 1000 - now;
+    const TimelineEdge off = {
+        .abs_time_ms   = (uint32_t)((now - t->base_us) / 1000),
+        .gpio_mask_set = t->on_mask,
+    };
+    if (off.gpio_mask_set && !t->hooks->apply(&off)) {
+        return;
+    }
+    telemetry_record_edge(off.gpio_mask_set, 0, 0);
+    t->on_mask = 0;
+    t->stagger_mask = 0;
+    while (t->next < t->prog->num_edges && t->prog->edges[t->next].abs_time_ms <= end_ms) {
+        t->next++;
+    }
+    cut_motor(t, end_ms);
+    t->base_us -= left_us;
+    t->report.saved_ms += (uint32_t)(left_us / 1000);
+    telemetry_record(TELEM_SENSOR_END, TELEM_NO_COMPONENT, (int32_t)(left_us / 1000));
+}
+
+// The component's output goes OFF now and stays OFF until the phase ends.
+static void cut_component(Timeline* t, int64_t now, uint8_t comp, uint32_t end_ms) {
+    uint32_t bit = 1u << component_states[comp].pin;
+    if (t->cut_mask & bit) {
+        return;
+    }
+    if (t->on_mask & bit) {
+        const TimelineEdge off = {
+            .abs_time_ms   = (uint32_t)((now - t->base_us) / 1000),
+            .gpio_mask_set = bit,
+        };
+        if (!t->hooks->apply(&off)) {
+            return;
+        }
+        telemetry_record_edge(bit, 0, 0);
+    }
+    if (comp == COMP_MOTOR) {
+        cut_motor(t, end_ms);
+    }
+    t->on_mask      &= ~bit;
+    t->stagger_mask &= ~bit;
+    t->cut_mask |= bit;
+    telemetry_record(TELEM_SENSOR_CUT, comp, t->phase);
+}
+
+// Act on the triggers of the phase in progress, if any are met.
+static void check_triggers(Timeline* t, int64_t now) {
+    const PhaseTrigger* k = phase_triggers(t);
+    if (!k || t->hooks->held()) {
+        return;
+    }
+    const Phase* ph = &t->prog->phases[t->phase];
+    uint32_t end_ms = ph->start_ms + ph->duration_ms;
+    if (now < t->base_us + (int64_t)ph->start_ms * 1000 || now >= t->base_us + (int64_t)end_ms * 1000) {
+        return;
+    }
+    const PhaseTrigger* last = t->prog->triggers + t->prog->num_triggers;
+    for (; k < last && k->phase == t->phase; k++) {
+        if (!trigger_met(t, k)) {
+            continue;
+        }
+        if (k->component == COMPONENT_NONE) {
+            end_phase_early(t, now, end_ms);
+            return;
+        }
+        cut_component(t, now, k->component, end_ms);
+    }
+}
+
+void timeline_begin(Timeline* t, const Program* prog, int64_t epoch_us, const TimelineHooks* hooks) {
+    *t = (Timeline){
+        .prog    = prog,
+        .hooks   = hooks,
+        .base_us = epoch_us,
+    };
+    begin_report(t, 0);
+    if (!s_ordered) {
+        order_components();
+    }
+}
+
+void timeline_seek(Timeline* t, uint32_t at_ms) {
+    const Program* prog = t->prog;
+    uint32_t on = 0;
+    for (; t->next < prog->num_edges && prog->edges[t->next].abs_time_ms <= at_ms; t->next++) {
+        on = (on & ~prog->edges[t->next].gpio_mask_set) | prog->edges[t->next].gpio_mask_clear;
+    }
+    while (t->seg < prog->num_segments && prog->segments[t->seg].end_ms <= at_ms) {
+        t->seg++;
+    }
+    t->phase = program_phase_at(prog, at_ms);
+    begin_report(t, t->phase);
+
+    int64_t at_us = t->base_us + (int64_t)at_ms * 1000;
+    t->stagger_mask = on;
+    t->stagger_from = at_us;
+    t->stagger_due  = at_us;
+    if (t->seg < prog->num_segments && prog->segments[t->seg].start_ms <= at_ms) {
+        t->seg_running    = true;
+        t->seg_restart    = true;
+        t->seg_elapsed_ms = at_ms - prog->segments[t->seg].start_ms;
+    }
+}
+
+int64_t timeline_run(Timeline* t, int64_t now) {
+    // Before the edges, so a condition met at phase start switches nothing ON.
+    check_triggers(t, now);
+    const TimelineEdge* edges = t->prog->edges;
+    // The rest of a staggered edge goes before anything after it.
+    bool caught_up = run_stagger(t, now);
+    while (caught_up && t->next < t->prog->num_edges) {
+        const TimelineEdge* e = &edges[t->next];
+        int64_t due = t->base_us + (int64_t)e->abs_time_ms * 1000;
+        if (due > now) {
+            break;
+        }
+        TimelineEdge fired = *e;
+        // Outputs a sensor cut stay OFF until their phase is over.
+        if (t->cut_mask && e->abs_time_ms <= phase_end_ms(t, t->phase)) {
+            fired.gpio_mask_clear &= ~t->cut_mask;
+        }
+        uint32_t on = fired.gpio_mask_clear;
+        fired.gpio_mask_clear = inrush_group(on);
+        if (!t->hooks->apply(&fired)) {
+            break;
+        }
+        t->on_mask = (t->on_mask & ~fired.gpio_mask_set) | fired.gpio_mask_clear;
+        // Measured after the GPIO write, not at wake-up.
+        int64_t at = esp_timer_get_time();
+        record_edge(t, &fired, at - due);
+        t->next++;
+        if (on) {
+            t->stagger_mask = on & ~fired.gpio_mask_clear;
+            t->stagger_from = due;
+            t->stagger_slot = 0;
+            next_slot(t, at);
+            caught_up = t->stagger_mask == 0;
+        }
+    }
+    dispatch_segments(t, now);
+    finish_elapsed_phases(t, now);
+
+    uint32_t next_ms = next_segment_ms(t);
+    if (t->next < t->prog->num_edges && edges[t->next].abs_time_ms < next_ms) {
+        next_ms = edges[t->next].abs_time_ms;
+    }
+    // A condition already met when its phase starts is caught right there.
+    if (phase_triggers(t)) {
+        uint32_t start_ms = t->prog->phases[t->phase].start_ms;
+        if (t->base_us + (int64_t)start_ms * 1000 > now && start_ms < next_ms) {
+            next_ms = start_ms;
+        }
+    }
+    // Whatever is held back for an inrush slot waits for that slot.
+    if (t->stagger_mask || t->seg_restart) {
+        return t->stagger_due;
+    }
+    if (next_ms == UINT32_MAX) {
+        return TIMELINE_DONE;
+    }
+    int64_t due = t->base_us + (int64_t)next_ms * 1000;
+    // A motor pattern due already is waiting for its slot.
+    return due <= now && due < t->stagger_due ? t->stagger_due : due;
+}
+
+bool timeline_sensing(Timeline* t, int64_t now) {
+    return phase_triggers(t) && now >= t->base_us + (int64_t)t->prog->phases[t->phase].start_ms * 1000;
+}
+
+void timeline_resume(Timeline* t, int64_t now, uint32_t motor_elapsed_ms) {
+    t->stagger_mask  |= t->on_mask;
+    t->on_mask        = 0;
+    t->stagger_from   = now;
+    t->stagger_slot   = 0;
+    t->stagger_due    = now;
+    t->seg_restart    = t->seg_running;
+    t->seg_elapsed_ms = motor_elapsed_ms;
+}
+
+void timeline_abort(Timeline* t) {
+    t->on_mask      = 0;
+    t->stagger_mask = 0;
+    t->seg_restart  = false;
+    if (t->phase < t->prog->num_phases) {
+        telemetry_record(TELEM_ABORT, TELEM_NO_COMPONENT, t->phase);
+        t->report.aborted = true;
+        finish_phase(t);
+    }
+}
+
+void timeline_finish(Timeline* t) {
+    while (t->phase < t->prog->num_phases) {
+        finish_phase(t);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "program.h"
+
+// ------------------------- TIMELINE WALK -------------------------
+// The part of the scheduler that needs no RTOS: fire a compiled program's
+// edges and motor segments on an absolute clock and build the phase
+// reports. Its only contact with the hardware is esp_timer_get_time(),
+// outputs_apply() via the apply hook, and motor_start(); host/ swaps those
+// for a fake clock, GPIO and motor to run it natively.
+//
+// Sensor triggers (PhaseTrigger) are checked on every run while their
+// phase is in progress, so the caller runs the timeline again whenever a
+// sensor has a new value. A met phase trigger switches the phase's outputs
+// OFF, drops its remaining edges and pulls the rest of the timeline
+// forward by the time left, the reverse of a pause; a met component
+// trigger switches that component OFF for the rest of its phase.
+//
+// Outputs due ON together are switched in inrush groups under
+// CONFIG_CYCLE_INRUSH_CAP_MA, one per CONFIG_CYCLE_INRUSH_STAGGER_US slot
+// counted from the edge's own time. Only that edge's later groups and the
+// records behind it wait; nothing after them is shifted.
+
+#define TIMELINE_DONE  INT64_MAX
+
+// Timing of one finished phase, measured against the compiled timeline.
+typedef struct {
+    int      phase;
+    uint32_t edges;           // records fired in this phase
+    int32_t  start_late_us;   // actual - scheduled, first record of the phase
+    int32_t  end_late_us;     // actual - scheduled, last record of the phase
+    int32_t  max_late_us;     // worst record of the phase
+    uint32_t paused_ms;       // time spent paused during the phase
+    uint32_t saved_ms;        // ended by a sensor this long before its timeout
+    uint32_t max_stagger_us;  // longest an output waited for inrush headroom
+    bool     aborted;         // cycle aborted here; no more reports follow
+} PhaseReport;
+
+typedef struct {
+    // Switch the outputs for `e`; false if a pause or abort holds them.
+    bool (*apply)(const TimelineEdge* e);
+    // Outputs are held: motor segments wait too.
+    bool (*held)(void);
+    void (*report)(const PhaseReport* r);
+    // Latest value of a sensor; false while it has none yet.
+    bool (*sense)(uint8_t sensor, int32_t* value);
+} TimelineHooks;
+
+typedef struct {
+    const Program*       prog;
+    const TimelineHooks* hooks;
+    int64_t     base_us;        // clock time of abs_time_ms == 0
+    int         next;           // next edge to fire
+    int         seg;            // next motor segment to start or stop
+    bool        seg_running;
+    uint32_t    on_mask;        // outputs the timeline has ON right now
+    int         phase;          // phase the next edge belongs to
+    int         trigger;        // first PhaseTrigger of `phase` or later
+    uint32_t    cut_mask;       // outputs a sensor has switched OFF for the rest of `phase`
+    uint32_t    stagger_mask;   // outputs due ON still waiting for their inrush slot
+    int64_t     stagger_from;   // clock time the staggered outputs were due
+    int64_t     stagger_due;    // earliest clock time of the next inrush slot
+    int         stagger_slot;   // slots used since stagger_from
+    bool        seg_restart;    // running motor pattern to restart after a resume
+    uint32_t    seg_elapsed_ms; // how far into it the pause came
+    PhaseReport report;         // being filled for `phase`
+} Timeline;
+
+void    timeline_begin(Timeline* t, const Program* prog, int64_t epoch_us, const TimelineHooks* hooks);
+
+// Start the walk `at_ms` into the cycle instead of at 0, e.g. to carry on
+// after a power loss. The outputs ON at that point come back in inrush
+// groups, a motor pattern in progress rejoins where it should be, and
+// the phases already over are not reported. Right after timeline_begin().
+void    timeline_seek(Timeline* t, uint32_t at_ms);
+
+// Fire everything due by `now`, check the sensor triggers of the current
+// phase, and return the clock time of the next edge, segment boundary or
+// start of a phase with triggers, or TIMELINE_DONE once nothing is left.
+int64_t timeline_run(Timeline* t, int64_t now);
+
+// The phase in progress has sensor triggers, which are checked whenever a
+// sensor has a new value.
+bool    timeline_sensing(Timeline* t, int64_t now);
+
+// After a pause: switch back ON what the timeline had ON, in inrush groups
+// from `now`, then restart the running motor pattern `motor_elapsed_ms`
+// into it. The caller has already shifted base_us; timeline_run() does the
+// switching.
+void    timeline_resume(Timeline* t, int64_t now, uint32_t motor_elapsed_ms);
+
+// Report the current phase as aborted, if any is left.
+void    timeline_abort(Timeline* t);
+
+// Report every phase not reported yet.
+void    timeline_finish(Timeline* t);
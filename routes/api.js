@@ -3,6 +3,18 @@ const path = require("path");
 const router = express.Router();
 const { SerialPort } = require("serialport");
 const { ReadlineParser } = require("@serialport/parser-readline");
+const { buildProgramBinary } = require("../lib/program-binary");
+const { buildLibraryFromDir } = require("../lib/program-library");
+const { crc32 } = require("../lib/program-binary");
+const { uploadProgram, uploadPatch, pushProgram, pushPatch } = require("../lib/program-upload");
+const { imageId } = require("../lib/program-library");
+const { PatchError, applyEdits, buildPatch } = require("../lib/program-patch");
+const { optimizeProgram } = require("../lib/program-optimize");
+const { fetchDiag, benchBoard } = require("../lib/device-diag");
+const { openLiveStatus } = require("../lib/live-status");
+
+// Serial port of the board attached to this machine.
+const SERIAL_PORT = process.env.SERIAL_PORT || "COM9";
 
 // ESP32 specific routes
 router.get("/esp32/status", (req, res) => {
@@ -18,7 +30,7 @@ router.get("/esp32/status", (req, res) => {
 router.post("/flash", (req, res) => {
   const { spawn } = require("child_process");
   const path = require("path");
-  const flash = spawn("cmd", ["/c", "idf.py -p COM9 flash monitor"], {
+  const flash = spawn("cmd", ["/c", `idf.py -p ${SERIAL_PORT} flash monitor`], {
     cwd: path.join(__dirname, ".."),
     shell: false,
   });
@@ -65,7 +77,37 @@ router.post("/esp32/update", (req, res) => {
   });
 });
 
+// Aggregated sensor windows from the board (main/sensor_upload.h), oldest
+// first. Kept in memory only.
+const SENSOR_HISTORY_MAX = 3600;
+const sensorHistory = [];
+
 router.post("/esp32/sensor-data", (req, res) => {
+  const { samples } = req.body;
+
+  // Batch from the firmware: one object per window, sensors by name.
+  if (Array.isArray(samples)) {
+    const { uptimeMs, periodMs, dropped, overruns } = req.body;
+    const receivedAt = new Date().toISOString();
+    for (const sample of samples) {
+      if (sample && typeof sample === "object") {
+        sensorHistory.push({ ...sample, periodMs, receivedAt });
+      }
+    }
+    if (sensorHistory.length > SENSOR_HISTORY_MAX) {
+      sensorHistory.splice(0, sensorHistory.length - SENSOR_HISTORY_MAX);
+    }
+    console.log(
+      `Sensor batch: ${samples.length} windows at uptime ${uptimeMs} ms` +
+        (dropped || overruns ? ` (${dropped} windows dropped, ${overruns} ADC overruns on the board)` : "")
+    );
+    return res.json({
+      status: "success",
+      accepted: samples.length,
+      received_at: receivedAt,
+    });
+  }
+
   const { temperature, humidity, pressure, timestamp } = req.body;
   console.log("Sensor data received:", {
     temperature,
@@ -81,6 +123,12 @@ router.post("/esp32/sensor-data", (req, res) => {
   });
 });
 
+// The latest ?limit=N windows (default 100), oldest first.
+router.get("/esp32/sensor-data", (req, res) => {
+  const limit = Math.max(1, Math.min(SENSOR_HISTORY_MAX, parseInt(req.query.limit, 10) || 100));
+  res.json({ samples: sensorHistory.slice(-limit) });
+});
+
 // Configuration routes
 router.get("/config", (req, res) => {
   res.json({
@@ -133,18 +181,305 @@ router.put("/input", (req, res) => {
   if (!newJson || typeof newJson !== "object") {
     return res.status(400).json({ error: "Invalid JSON body" });
   }
-  fs.writeFile(inputPath, JSON.stringify(newJson, null, 2), (err) => {
+  const jsonText = JSON.stringify(newJson, null, 2);
+  let program;
+  try {
+    program = buildProgramBinary(jsonText);
+  } catch (err) {
+    return res.status(400).json({ error: "Invalid program", details: err.message });
+  }
+  const binPath = path.join(__dirname, "..", "spiffs", "input.bin");
+  const binary = {
+    bytes: program.binary.length,
+    phases: program.compiled.phases.length,
+    edges: program.compiled.edges.length,
+    motorPatterns: program.compiled.segments.length,
+    totalMs: program.compiled.totalMs,
+    warnings: program.compiled.warnings,
+  };
+  // Same program as on disk: leave both files (and their timestamps) alone.
+  let current = null;
+  try {
+    current = fs.readFileSync(inputPath, "utf8");
+  } catch (err) {
+    // no input.json yet
+  }
+  if (current === jsonText && fs.existsSync(binPath)) {
+    return res.json({ status: "success", message: "input.json unchanged", unchanged: true, data: newJson, binary });
+  }
+  fs.writeFile(inputPath, jsonText, (err) => {
     if (err) {
       return res
         .status(500)
         .json({ error: "Failed to write file", details: err.message });
     }
+    // Precompiled copy for the firmware's fast boot path.
+    fs.writeFile(binPath, program.binary, (err) => {
+      if (err) {
+        return res
+          .status(500)
+          .json({ error: "Failed to write input.bin", details: err.message });
+      }
+      res.json({
+        status: "success",
+        message: "input.json updated",
+        data: newJson,
+        binary,
+      });
+    });
+  });
+});
+
+// Retime phases or components of input.json, by their "id", and send only
+// that change to a running board (main/program_patch.h). Body:
+//   { "phases": { "phase_a": { "startTime": 0, "components": {
+//       "1752779020217": { "start": 0, "duration": 4000,
+//                          "motorConfig": { "stepTime": 900, "pauseTime": 300 } } } } },
+//     "host": "192.168.1.40" }      or "serial": true for the console
+// Only those timing fields can be patched (400 otherwise). input.json and
+// input.bin are rewritten; the board recompiles just the phases that
+// changed and runs the result from its next cycle. An edit that changes
+// more than timing is refused with 409 and goes through PUT /api/input.
+// A board running another program than input.bin gets the whole program.
+router.patch("/input", async (req, res) => {
+  const fs = require("fs");
+  const inputPath = path.join(__dirname, "..", "spiffs", "input.json");
+  const binPath = path.join(__dirname, "..", "spiffs", "input.bin");
+  const body = req.body || {};
+
+  let before, after, jsonText, patch;
+  try {
+    const currentText = fs.readFileSync(inputPath, "utf8");
+    before = buildProgramBinary(currentText);
+    jsonText = JSON.stringify(applyEdits(JSON.parse(currentText), body.phases), null, 2);
+    after = buildProgramBinary(jsonText);
+    patch = buildPatch(before.binary, before.compiled, after.compiled, crc32(Buffer.from(jsonText, "utf8")));
+  } catch (err) {
+    const status = err instanceof PatchError ? err.status : 400;
+    return res.status(status).json({ error: "Invalid patch", details: err.message });
+  }
+  const image = imageId(after.binary);
+  const binary = {
+    bytes: after.binary.length,
+    phases: after.compiled.phases.length,
+    edges: after.compiled.edges.length,
+    totalMs: after.compiled.totalMs,
+    image,
+  };
+  if (!patch) {
+    return res.json({ status: "success", message: "Nothing changed", unchanged: true, binary });
+  }
+
+  try {
+    fs.writeFileSync(inputPath, jsonText);
+    fs.writeFileSync(binPath, after.binary);
+  } catch (err) {
+    return res.status(500).json({ error: "Failed to write file", details: err.message });
+  }
+  const result = { status: "success", patchBytes: patch.patch.length, patchedPhases: patch.phases, binary };
+  const host = body.host || (body.serial ? null : process.env.DEVICE_HOST);
+  if (!host && !body.serial) {
+    return res.json({ ...result, message: "input.json updated; no device given" });
+  }
+
+  try {
+    let device;
+    let sent = "patch";
+    try {
+      device = host ? await pushPatch(host, patch.patch) : await uploadPatch(SERIAL_PORT, patch.patch);
+    } catch (err) {
+      if (!err.conflict) throw err;
+      sent = "full";
+      device = host
+        ? await pushProgram(host, after.binary, { force: true })
+        : await uploadProgram(SERIAL_PORT, after.binary);
+    }
+    if (sent === "patch" && device.image !== image) {
+      return res.status(502).json({ ...result, error: "Device built a different image", expected: image, device });
+    }
+    res.json({
+      ...result,
+      message: sent === "patch"
+        ? "Patch staged; it runs from the next cycle"
+        : "The device ran another program; the whole program was sent",
+      sent,
+      device,
+    });
+  } catch (err) {
+    if (err.busy) {
+      return res.status(503).json({ ...result, error: "The device is taking another program; patch again" });
+    }
+    if (err.unauthorized) {
+      return res.status(502).json({ ...result, error: "The device refused the token; check DEVICE_TOKEN" });
+    }
+    res.status(502).json({ ...result, error: "Patch upload failed", details: err.message });
+  }
+});
+
+// Cycle optimizer (lib/program-optimize.js): a compacted version of a
+// program and what it saves per phase, for review. Nothing is written or
+// sent; deploy the result with PUT /api/input. Body, all optional:
+//   { "phases": [...] }    a program; spiffs/input.json by default
+//   { "options": { "startDelays": false, "leadingIdle": true,
+//                  "idleGaps": false, "overlap": true } }
+router.post("/optimize", (req, res) => {
+  const fs = require("fs");
+  const body = req.body || {};
+  try {
+    const phases = Array.isArray(body.phases)
+      ? body.phases
+      : JSON.parse(fs.readFileSync(path.join(__dirname, "..", "spiffs", "input.json"), "utf8"));
+    const { program, report } = optimizeProgram(phases, body.options || {});
+    res.json({ status: "success", report, program });
+  } catch (err) {
+    res.status(400).json({ error: "Invalid program", details: err.message });
+  }
+});
+
+// Hot reload: send the current input.json to the running firmware over the
+// serial console instead of re-flashing. It takes over after the cycle
+// that is running now.
+router.post("/reload", (req, res) => {
+  const fs = require("fs");
+  const inputPath = path.join(__dirname, "..", "spiffs", "input.json");
+  let program;
+  try {
+    program = buildProgramBinary(fs.readFileSync(inputPath, "utf8"));
+  } catch (err) {
+    return res.status(400).json({ error: "Invalid program", details: err.message });
+  }
+  uploadProgram(SERIAL_PORT, program.binary)
+    .then((device) => {
+      res.json({
+        status: "success",
+        message: "Program loaded; it starts after the current cycle",
+        bytes: program.binary.length,
+        device,
+      });
+    })
+    .catch((err) => {
+      res.status(502).json({ error: "Reload failed", details: err.message });
+    });
+});
+
+// Over-the-air upload: PUT the compiled program to the board's own HTTP
+// server (CONFIG_CYCLE_HTTP_UPLOAD). Body: { "host": "192.168.1.40" },
+// or DEVICE_HOST in the environment. With "library": true the whole
+// programs/ directory goes up as one library.bin instead of input.json.
+// The upload is skipped when the board already holds the same image,
+// unless "force": true.
+router.post("/push", async (req, res) => {
+  const fs = require("fs");
+  const host = (req.body && req.body.host) || process.env.DEVICE_HOST;
+  if (!host) {
+    return res.status(400).json({ error: "No device host given" });
+  }
+  const inputPath = path.join(__dirname, "..", "spiffs", "input.json");
+  let program;
+  try {
+    program = req.body && req.body.library
+      ? buildLibraryFromDir(path.join(__dirname, "..", "programs"))
+      : buildProgramBinary(fs.readFileSync(inputPath, "utf8"));
+  } catch (err) {
+    return res.status(400).json({ error: "Invalid program", details: err.message });
+  }
+  try {
+    const device = await pushProgram(host, program.binary, { force: !!(req.body && req.body.force) });
     res.json({
       status: "success",
-      message: "input.json updated",
-      data: newJson,
+      message: device.skipped
+        ? "The device already has this program; nothing sent"
+        : "Program installed; the device restarts into it",
+      bytes: program.binary.length,
+      programs: program.programs,
+      elapsedMs: device.elapsedMs,
+      device,
     });
+  } catch (err) {
+    if (err.busy) {
+      return res.status(409).json({ error: "The device is running a cycle; push again between cycles", details: err.message });
+    }
+    if (err.unauthorized) {
+      return res.status(502).json({ error: "The device refused the token; check DEVICE_TOKEN", details: err.message });
+    }
+    if (err.rejected) {
+      return res.status(502).json({ error: "Device rejected the program", details: err.message });
+    }
+    res.status(502).json({ error: "Upload failed", details: err.message });
+  }
+});
+
+// Edge jitter per component from the board's GET /status
+// (?host=... or DEVICE_HOST).
+router.get("/device-status", async (req, res) => {
+  const host = req.query.host || process.env.DEVICE_HOST;
+  if (!host) {
+    return res.status(400).json({ error: "No device host given" });
+  }
+  try {
+    const response = await fetch(`http://${host}/status`);
+    res.status(response.ok ? 200 : 502).json(await response.json());
+  } catch (err) {
+    res.status(502).json({ error: "Device unreachable", details: err.message });
+  }
+});
+
+// Performance counters from the board's GET /diag (?host=... or
+// DEVICE_HOST): boot load times, heap, task stacks, timer dispatch
+// latency and scheduler load.
+router.get("/device-diag", async (req, res) => {
+  const host = req.query.host || process.env.DEVICE_HOST;
+  if (!host) {
+    return res.status(400).json({ error: "No device host given" });
+  }
+  try {
+    res.json(await fetchDiag(host));
+  } catch (err) {
+    res.status(502).json({ error: "Device unreachable", details: err.message });
+  }
+});
+
+// Run the board's scheduler bench (lib/device-diag.js) between cycles.
+// Body, all optional: { "host": "...", "runs": 3, "edges": 2000,
+// "spacingMs": 1 }; without edges / spacingMs the build's defaults.
+router.post("/device-bench", async (req, res) => {
+  const body = req.body || {};
+  const host = body.host || process.env.DEVICE_HOST;
+  if (!host) {
+    return res.status(400).json({ error: "No device host given" });
+  }
+  try {
+    res.json(await benchBoard(host, { runs: Number(body.runs) || 1, edges: body.edges, spacingMs: body.spacingMs }));
+  } catch (err) {
+    const status = err.status === 409 || err.status === 400 ? err.status : 502;
+    res.status(status).json({ error: "Bench failed", details: err.message });
+  }
+});
+
+// Live cycle status from the board's WebSocket (?host=... or DEVICE_HOST),
+// relayed as Server-Sent Events: one "status" event per frame, pushed by
+// the board on every change.
+router.get("/live", (req, res) => {
+  const host = req.query.host || process.env.DEVICE_HOST;
+  if (!host) {
+    return res.status(400).json({ error: "No device host given" });
+  }
+  let live;
+  try {
+    live = openLiveStatus(host, {
+      onStatus: (status) => res.write(`event: status\ndata: ${JSON.stringify(status)}\n\n`),
+      onError: (err) => res.write(`event: error\ndata: ${JSON.stringify({ error: err.message })}\n\n`),
+      onClose: () => res.end(),
+    });
+  } catch (err) {
+    return res.status(501).json({ error: "Live status unavailable", details: err.message });
+  }
+  res.writeHead(200, {
+    "Content-Type": "text/event-stream",
+    "Cache-Control": "no-cache",
+    Connection: "keep-alive",
   });
+  req.on("close", () => live.close());
 });
 
 router.get("/files/:filename", (req, res) => {
@@ -163,7 +498,7 @@ router.get("/files/:filename", (req, res) => {
 
 router.get("/monitor", (req, res) => {
   const port = new SerialPort({
-    path: "COM9",
+    path: SERIAL_PORT,
     baudRate: 115200,
     autoOpen: false,
   });
@@ -0,0 +1,102 @@
+// Fleet routes, mounted at /api/fleet: a registry of boards (lib/fleet.js),
+// one push to many of them, and their status in one view.
+
+const express = require("express");
+const fs = require("fs");
+const path = require("path");
+const router = express.Router();
+const { Fleet, DEFAULT_CONCURRENCY } = require("../lib/fleet");
+const { buildProgramBinary } = require("../lib/program-binary");
+const { buildLibraryFromDir } = require("../lib/program-library");
+
+const fleet = new Fleet();
+const PROGRAMS_DIR = path.join(__dirname, "..", "programs");
+
+// The program a push sends: { "library": true } for the whole programs/
+// library, { "file": "01-delicate.json" } for one program from programs/,
+// spiffs/input.json otherwise.
+function buildPushProgram(body) {
+  if (body.library) {
+    return buildLibraryFromDir(PROGRAMS_DIR);
+  }
+  const file = body.file
+    ? path.join(PROGRAMS_DIR, path.basename(body.file))
+    : path.join(__dirname, "..", "spiffs", "input.json");
+  return buildProgramBinary(fs.readFileSync(file, "utf8"));
+}
+
+router.get("/", (req, res) => {
+  res.json({ devices: fleet.list() });
+});
+
+// Add a device, or replace the one with the same ID:
+// { "id": "rig-1", "host": "192.168.1.40", "tags": ["lab-a"] }
+router.post("/devices", (req, res) => {
+  try {
+    res.json({ status: "success", device: fleet.upsert(req.body) });
+  } catch (err) {
+    res.status(400).json({ error: "Invalid device", details: err.message });
+  }
+});
+
+router.delete("/devices/:id", (req, res) => {
+  if (!fleet.remove(req.params.id)) {
+    return res.status(404).json({ error: "Unknown device", id: req.params.id });
+  }
+  res.json({ status: "success", id: req.params.id });
+});
+
+// Push one program to many boards at once, at most "concurrency" uploads
+// in flight (default 4, or FLEET_CONCURRENCY). Body: { "devices": ["rig-1",
+// ...] } and/or { "tag": "lab-a" } pick the boards, all of them by
+// default; the program as for buildPushProgram(). Boards that already
+// hold it are skipped unless "force": true. 200 when every board has it
+// installed, 207 with per-device results otherwise.
+router.post("/push", async (req, res) => {
+  const body = req.body || {};
+  let devices;
+  try {
+    devices = fleet.select({ ids: body.devices, tag: body.tag });
+  } catch (err) {
+    return res.status(404).json({ error: err.message });
+  }
+  if (!devices.length) {
+    return res.status(400).json({ error: "No devices selected" });
+  }
+  let program;
+  try {
+    program = buildPushProgram(body);
+  } catch (err) {
+    return res.status(400).json({ error: "Invalid program", details: err.message });
+  }
+  const concurrency = parseInt(body.concurrency, 10) || parseInt(process.env.FLEET_CONCURRENCY, 10) || DEFAULT_CONCURRENCY;
+  const result = await fleet.push(devices, program.binary, { concurrency, force: !!body.force });
+  res.status(result.failed ? 207 : 200).json({
+    status: result.failed ? "partial" : "success",
+    bytes: program.binary.length,
+    programs: program.programs,
+    concurrency,
+    ...result,
+  });
+});
+
+// Latest live status of every board, with counts per state.
+router.get("/status", (req, res) => {
+  res.json(fleet.status());
+});
+
+// Every board's status frames as one Server-Sent Events stream: a "status"
+// event per frame, tagged with the device ID.
+router.get("/live", (req, res) => {
+  res.writeHead(200, {
+    "Content-Type": "text/event-stream",
+    "Cache-Control": "no-cache",
+    Connection: "keep-alive",
+  });
+  const unsubscribe = fleet.subscribe((id, status) => {
+    res.write(`event: status\ndata: ${JSON.stringify({ id, ...status })}\n\n`);
+  });
+  req.on("close", unsubscribe);
+});
+
+module.exports = router;
@@ -0,0 +1,60 @@
+// Measure a board (lib/device-diag.js) the same way on every firmware
+// build and keep the result, to compare builds on real hardware. No output
+// is switched; the board must be idle between cycles.
+//
+//   node scripts/bench-device.js <host> [--runs=3] [--edges=N] [--spacing=ms]
+//                                [--out=result.json] [--compare=older.json]
+//
+// Without --edges / --spacing the board runs its build's default bench.
+// --out defaults to bench-<firmware version>.json; --compare prints the
+// change from an earlier result.
+
+const fs = require("fs");
+const { benchBoard, compareRuns } = require("../lib/device-diag");
+
+const args = process.argv.slice(2).filter((a) => !a.startsWith("--"));
+const flags = Object.fromEntries(
+  process.argv
+    .slice(2)
+    .filter((a) => a.startsWith("--"))
+    .map((a) => a.slice(2).split("="))
+);
+const host = args[0] || process.env.DEVICE_HOST;
+if (!host) {
+  console.error("usage: node scripts/bench-device.js <host> [--runs=3] [--edges=N] [--spacing=ms] [--out=file] [--compare=file]");
+  process.exit(1);
+}
+
+(async () => {
+  const result = await benchBoard(host, {
+    runs: Number(flags.runs) || 3,
+    edges: Number(flags.edges) || undefined,
+    spacingMs: Number(flags.spacing) || undefined,
+  });
+  const outputPath = flags.out || `bench-${result.build.version}.json`;
+  fs.writeFileSync(outputPath, JSON.stringify(result, null, 2));
+
+  const { load, heap } = result.diag;
+  const b = result.benches[0];
+  console.log(`Firmware ${result.build.version} (IDF ${result.build.idf}, ${result.build.date})`);
+  console.log(
+    `Boot load from ${load.source}: ${load.totalUs} us (read ${load.readUs}, parse ${load.parseUs}, ` +
+      `compile ${load.compileUs}); heap ${heap.beforeLoad} -> ${heap.afterLoad}, now ${heap.free}`
+  );
+  for (const s of result.diag.stacks) console.log(`  stack ${s.task.padEnd(12)} ${s.freeMin} bytes free`);
+  console.log(`${result.benches.length} x ${b.edges} edges ${b.spacingMs} ms apart over ${b.outputs} outputs, medians:`);
+  for (const [k, v] of Object.entries(result.summary)) console.log(`  ${k.padEnd(14)} ${v}`);
+
+  if (flags.compare) {
+    const before = JSON.parse(fs.readFileSync(flags.compare, "utf8"));
+    console.log(`Against ${before.build.version}:`);
+    for (const r of compareRuns(before, result)) {
+      const change = r.change === null ? "" : ` (${r.change > 0 ? "+" : ""}${r.change}%)`;
+      console.log(`  ${r.what.padEnd(16)} ${String(r.before).padStart(8)} -> ${String(r.after).padStart(8)}${change}`);
+    }
+  }
+  console.log(`Wrote ${outputPath}`);
+})().catch((err) => {
+  console.error(`Bench failed: ${err.message}${err.status === 409 ? " (a cycle is running)" : ""}`);
+  process.exit(1);
+});
@@ -0,0 +1,23 @@
+// Build step: compile every program in programs/ into programs/library.bin
+// for the program partition, where any of them can be selected at run time
+// (console "list" / "select <id>", or the select button).
+//
+//   node scripts/build-library.js [programs dir] [library.bin]
+//
+// Programs get their IDs in file name order, e.g. 00-cotton.json,
+// 01-delicate.json, ...
+
+const fs = require("fs");
+const path = require("path");
+const { buildLibraryFromDir } = require("../lib/program-library");
+
+const dir = process.argv[2] || path.join(__dirname, "..", "programs");
+const outputPath = process.argv[3] || path.join(dir, "library.bin");
+
+const { binary, programs } = buildLibraryFromDir(dir);
+fs.writeFileSync(outputPath, binary);
+
+for (const p of programs) {
+  console.log(`  ${p.id}: ${p.name} (${p.bytes} bytes, cycle ${p.totalMs} ms)`);
+}
+console.log(`Wrote ${outputPath}: ${programs.length} programs (${binary.length} bytes)`);
@@ -0,0 +1,24 @@
+// Build step: compile spiffs/input.json into spiffs/input.bin so the
+// firmware can skip JSON parsing at boot.
+//
+//   node scripts/build-program.js [input.json] [input.bin]
+
+const fs = require("fs");
+const path = require("path");
+const { buildProgramBinary } = require("../lib/program-binary");
+
+const spiffs = path.join(__dirname, "..", "spiffs");
+const inputPath = process.argv[2] || path.join(spiffs, "input.json");
+const outputPath = process.argv[3] || path.join(spiffs, "input.bin");
+
+const { binary, compiled } = buildProgramBinary(fs.readFileSync(inputPath, "utf8"));
+fs.writeFileSync(outputPath, binary);
+
+for (const w of compiled.warnings) {
+  console.warn(`Motor config of "${w.compId}" in phase "${w.phase}" ignored: ${w.reason}`);
+}
+console.log(
+  `Wrote ${outputPath}: ${compiled.phases.length} phases, ${compiled.edges.length} edges, ` +
+    `${compiled.segments.length} motor patterns, ` +
+    `cycle ${compiled.totalMs} ms (${binary.length} bytes)`
+);
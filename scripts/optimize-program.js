@@ -0,0 +1,38 @@
+// Run the cycle optimizer (lib/program-optimize.js) over a program and
+// write the compacted version next to it for review; the original is left
+// alone. Deploy the result with PUT /api/input once it looks right.
+//
+//   node scripts/optimize-program.js [input.json] [output.json] [--delays] [--gaps] [--no-overlap]
+//
+// --delays also removes the waits from increasing startTimes, --gaps the
+// idle stretches inside phases; --no-overlap keeps every phase separate.
+
+const fs = require("fs");
+const path = require("path");
+const { optimizeProgram } = require("../lib/program-optimize");
+
+const args = process.argv.slice(2).filter((a) => !a.startsWith("--"));
+const flags = process.argv.slice(2).filter((a) => a.startsWith("--"));
+const inputPath = args[0] || path.join(__dirname, "..", "spiffs", "input.json");
+const outputPath = args[1] || inputPath.replace(/\.json$/, "") + ".optimized.json";
+
+const { program, report } = optimizeProgram(JSON.parse(fs.readFileSync(inputPath, "utf8")), {
+  startDelays: flags.includes("--delays"),
+  idleGaps: flags.includes("--gaps"),
+  overlap: !flags.includes("--no-overlap"),
+});
+fs.writeFileSync(outputPath, JSON.stringify(program, null, 2));
+
+for (const p of report.perPhase) {
+  const merged = p.mergedInto ? `, merged into "${p.mergedInto}"` : "";
+  console.log(`Phase ${p.index} "${p.name || p.id}": ${p.durationMs} ms, saved ${p.savedMs} ms${merged}`);
+  for (const f of p.findings) {
+    const state = f.applied ? "applied" : f.reason || "suggested";
+    console.log(`  ${f.kind.padEnd(12)} ${String(f.ms).padStart(8)} ms  ${state}`);
+  }
+}
+console.log(
+  `Cycle ${report.totalMs} ms -> ${report.optimizedMs} ms (saved ${report.savedMs} ms), ` +
+    `${report.phases.before} -> ${report.phases.after} phases, ` +
+    `conflicts ${report.conflicts.before} -> ${report.conflicts.after}. Wrote ${outputPath}`
+);
@@ -6,6 +6,7 @@ const path = require("path");
 
 // Import routes
 const apiRoutes = require("./routes/api");
+const fleetRoutes = require("./routes/fleet");
 
 const app = express();
 const PORT = process.env.PORT || 3000;
@@ -36,6 +37,7 @@ app.get("/spiffs/", (req, res, next) => {
 });
 
 // Use API routes
+app.use("/api/fleet", fleetRoutes);
 app.use("/api", apiRoutes);
 
 // Routes
@@ -73,7 +75,19 @@ app.get("/api", (req, res) => {
       esp32: [
         "GET /api/esp32/status - ESP32 status",
         "POST /api/esp32/update - Send updates to ESP32",
-        "POST /api/esp32/sensor-data - Receive sensor data",
+        "POST /api/esp32/sensor-data - Receive sensor data (single reading or batch)",
+        "GET /api/esp32/sensor-data - Recent sensor windows",
+        "GET /api/live - Live cycle status from the board (Server-Sent Events)",
+        "GET /api/device-diag - Board performance counters",
+        "POST /api/device-bench - Run the scheduler bench on the board",
+      ],
+      fleet: [
+        "GET /api/fleet - Registered devices",
+        "POST /api/fleet/devices - Add or replace a device",
+        "DELETE /api/fleet/devices/:id - Remove a device",
+        "POST /api/fleet/push - Push a program to many devices at once",
+        "GET /api/fleet/status - Latest status of every device",
+        "GET /api/fleet/live - Status of every device (Server-Sent Events)",
       ],
       config: [
         "GET /api/config - Get configuration",
@@ -81,6 +95,8 @@ app.get("/api", (req, res) => {
       ],
       files: [
         "GET /api/input - Get input.json",
+        "PATCH /api/input - Retime phases or components and patch the running board",
+        "POST /api/optimize - Compacted program and time saved per phase, for review",
         "GET /api/files/:filename - Get specific file",
         "GET /spiffs/* - Access SPIFFS files directly",
       ],